@@ -1,10 +1,5 @@
 #include "CError.h"
 
-CError::CError()
-{
-    //ctor
-}
-
 CError::~CError()
 {
     //dtor
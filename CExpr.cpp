@@ -0,0 +1,27 @@
+#include "CExpr.h"
+#include "CFunction.h"
+#include <algorithm>
+
+using namespace std;
+
+void CExpr::variables(vector<CVariable*>& vars) const
+{
+    if (type == XVAR && find(vars.begin(), vars.end(), var) == vars.end())
+        vars.push_back(var);
+
+    for (size_t i = 0; i < args.size(); ++i)
+        args[i]->variables(vars);
+}
+
+bool CExpr::calls(const CFunction* f) const
+{
+    if (type == XCALL && (func == f || func->Body()->calls(f)))
+        return true;
+
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        if (args[i]->calls(f))
+            return true;
+    }
+    return false;
+}
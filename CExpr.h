@@ -0,0 +1,80 @@
+#ifndef CEXPR_H
+#define CEXPR_H
+
+#include <string>
+#include <vector>
+#include "CMatrix.h"
+
+class CVariable;
+class CFunction;
+struct CBuiltin;
+
+enum OP {ASN, ADD, SUB, MULT, DIV, EXP, MOD, INC, DEC, ASNADD, ASNSUB, ASNMULT, ASNDIV, BIND, EQ, NE, LT, GT, LE, GE, RANGE, NULLOP};
+
+enum EXPRTYPE {XVALUE, XVAR, XOP, XARG, XCALL, XBUILTIN, XINDEX};
+
+enum OPKERNEL {KNONE, KSCALAR, KSCALARMAT, KMATSCALAR, KELEMENT, KGEMV, KGEMM};
+
+//////////////////////////////////////////////////
+//      Struct CExpr                            //
+//////////////////////////////////////////////////
+
+/* A node of a compiled expression. Calc::Compile builds a tree of these from the parts of a statement, following the
+   order of operations, and Calc::Eval walks it. A tree can be evaluated any number of times without going back to
+   the input, which is how bindings (:=) keep their expression.
+
+        XVALUE  ::: A number or matrix written in the expression, held in value.
+        XVAR    ::: A variable, already looked up in the database.
+        XOP     ::: A binary operator op applied to args[0] and args[1].
+        XARG    ::: Argument number slot of the function whose body this is.
+        XCALL   ::: A call of the user-defined function func, with its arguments in args.
+        XBUILTIN::: A call of the built-in function builtin (sin, max, ...), with its arguments in args.
+        XINDEX  ::: The elements of args[0] selected by the mask args[1], as in a(a > 0).
+
+   text holds the source of the node (the variable name or operator symbol) for error messages. A node owns its
+   arguments.
+
+   rows and cols are the size of the node's value as far as Calc::Infer could tell when compiling, or -1 if it
+   can't be known before running. An XOP node whose operand sizes were known has its kernel chosen already (see
+   CKernel), for operands of the sizes in planned.
+*/
+struct CExpr
+{
+    EXPRTYPE            type;
+    OP                  op;
+    CMatrix             value;
+    CVariable*          var;
+    CFunction*          func;
+    const CBuiltin*     builtin;
+    int                 slot;
+    std::vector<CExpr*> args;
+    std::string         text;
+    int                 rows, cols;
+    OPKERNEL            kernel;
+    int                 planned[4];     // rows and columns of args[0], then of args[1]
+
+    CExpr(CMatrix v) : type{XVALUE}, op{NULLOP}, value{std::move(v)}, var{0}, func{0}, builtin{0}, slot{-1}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(CVariable* v, const std::string& name) : type{XVAR}, op{NULLOP}, var{v}, func{0}, builtin{0}, slot{-1}, text{name}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(OP o, CExpr* a, CExpr* b, const std::string& sym) : type{XOP}, op{o}, var{0}, func{0}, builtin{0}, slot{-1}, args{a, b}, text{sym}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(const std::string& name, int s) : type{XARG}, op{NULLOP}, var{0}, func{0}, builtin{0}, slot{s}, text{name}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(CFunction* f, const std::string& name) : type{XCALL}, op{NULLOP}, var{0}, func{f}, builtin{0}, slot{-1}, text{name}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(const CBuiltin* b, const std::string& name) : type{XBUILTIN}, op{NULLOP}, var{0}, func{0}, builtin{b}, slot{-1}, text{name}, rows{-1}, cols{-1}, kernel{KNONE} {};
+    CExpr(CExpr* of, CExpr* mask, const std::string& name) : type{XINDEX}, op{NULLOP}, var{0}, func{0}, builtin{0}, slot{-1}, args{of, mask}, text{name}, rows{-1}, cols{-1}, kernel{KNONE} {};
+
+    ~CExpr()
+    {
+        for (size_t i = 0; i < args.size(); ++i)
+            delete args[i];
+    }
+
+    CExpr(const CExpr&) = delete;
+    CExpr& operator=(const CExpr&) = delete;
+
+    // Adds every variable in the tree to vars, once each.
+    void variables(std::vector<CVariable*>& vars) const;
+
+    // True if the tree calls f, directly or through other functions.
+    bool calls(const CFunction* f) const;
+};
+
+#endif // CEXPR_H
@@ -0,0 +1,137 @@
+#include "CFormatter.h"
+#include "CMatrix.h"
+#include <charconv>
+#include <cstring>
+
+using namespace std;
+
+#define FMT_CELL_MAX 32 //Longest text to_chars can produce for a double at any sane precision, plus padding
+
+char* CFormatter::grow(size_t n)
+{
+    if (m_nLen + n > m_Buf.size())
+        m_Buf.resize(max(m_Buf.size() * 2, m_nLen + n));
+    return m_Buf.data() + m_nLen;
+}
+
+CFormatter& CFormatter::add(const char* s)
+{
+    size_t n = strlen(s);
+    memcpy(grow(n), s, n);
+    m_nLen += n;
+    return *this;
+}
+
+CFormatter& CFormatter::add(const string& s)
+{
+    memcpy(grow(s.size()), s.data(), s.size());
+    m_nLen += s.size();
+    return *this;
+}
+
+CFormatter& CFormatter::add(char c)
+{
+    *grow(1) = c;
+    ++m_nLen;
+    return *this;
+}
+
+CFormatter& CFormatter::add(double d)
+{
+    char* p = grow(FMT_CELL_MAX);
+    m_nLen = to_chars(p, p + FMT_CELL_MAX, d, chars_format::general, m_nPrec).ptr - m_Buf.data();
+    return *this;
+}
+
+//Adds a number left-justified in a FMT_WIDTH column. The caller must already have grown the buffer.
+void CFormatter::addCell(double d)
+{
+    char* p = m_Buf.data() + m_nLen;
+    char* e = to_chars(p, p + FMT_CELL_MAX, d, chars_format::general, m_nPrec).ptr;
+    while (e - p < FMT_WIDTH)
+        *e++ = ' ';
+    m_nLen = e - m_Buf.data();
+}
+
+//Adds every row of m (or the edges of it, for a summary). The first row starts with first, the others with lnstart,
+//and last goes after the final row. Each row ends in a newline.
+void CFormatter::addRows(const CMatrix& m, const char* first, const char* lnstart, const char* last)
+{
+    int r = m.getNRow(), c = m.getNCol();
+    bool summary = (m_nSummaryAt > 0 && m.Size() > m_nSummaryAt);
+    bool cutRows = summary && r > 2*m_nEdge + 1;
+    bool cutCols = summary && c > 2*m_nEdge + 1;
+    size_t lnlen = strlen(first) + strlen(lnstart) + strlen(last) + 2;
+    size_t rowlen = (cutCols ? 2*m_nEdge + 1 : c) * FMT_CELL_MAX + lnlen;
+
+    for (int i = 0; i < r; ++i)
+    {
+        // Jump over the middle rows of a summary, leaving a row of dots in their place.
+        if (cutRows && i == m_nEdge)
+        {
+            add(lnstart);
+            for (int j = 0; j < (cutCols ? 2*m_nEdge + 1 : c); ++j)
+                add("...   ");
+            add('\n');
+            i = r - m_nEdge - 1;
+            continue;
+        }
+
+        grow(rowlen);
+        add(i == 0 ? first : lnstart);
+
+        const double* row = &m.element(i, 0);
+        for (int j = 0; j < c; ++j)
+        {
+            if (cutCols && j == m_nEdge)
+            {
+                memcpy(m_Buf.data() + m_nLen, "...   ", FMT_WIDTH);
+                m_nLen += FMT_WIDTH;
+                j = c - m_nEdge - 1;
+                continue;
+            }
+            addCell(row[j]);
+        }
+
+        if (i == r-1)
+            add(last);
+        add('\n');
+    }
+
+    if (summary)
+    {
+        add(lnstart).add('(');
+        add((double)r).add(" x ").add((double)c).add(")\n");
+    }
+}
+
+CFormatter& CFormatter::addMatrix(const CMatrix& m)
+{
+    if (m.IsNull())
+        add("\tnull matrix\n");
+    else if (m.IsSingle())
+        add(m.element(0,0));
+    else
+    {
+        add('\n');
+        addRows(m, "\t\t", "\t\t", "");
+    }
+    return *this;
+}
+
+CFormatter& CFormatter::addPrinted(const CMatrix& m, const string& lnstart, bool single_as_matrix)
+{
+    if (m.IsNull())
+        add("\tnull matrix\n");
+    else if (m.IsSingle() && !single_as_matrix)
+        add(m.element(0,0));
+    else
+        addRows(m, "[", lnstart.c_str(), "] ");
+    return *this;
+}
+
+void CFormatter::write(ostream& out)
+{
+    out.write(m_Buf.data(), m_nLen);
+    m_nLen = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef CFORMATTER_H
+#define CFORMATTER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define FMT_WIDTH       6       //Width of a matrix column, as with setw(6)
+#define FMT_PRECISION   6       //Significant digits, as with the default ostream precision
+#define FMT_SUMMARY_AT  1000    //Element count above which "format short" summarizes a matrix
+#define FMT_EDGE        3       //Number of rows and columns shown at each edge of a summary
+
+class CMatrix;
+
+//////////////////////////////////////////////////
+//      Class CFormatter                        //
+//////////////////////////////////////////////////
+
+/* Formats text and matrices into one reusable buffer, which is then handed to a stream with a single write.
+   Numbers are converted with std::to_chars and padded to their column as they are written, so a matrix is
+   formatted in one pass with no per-element stream calls. The buffer keeps its memory between writes.
+
+   The layouts are the same ones operator<< and PrintMatrix have always produced:
+        addMatrix   ::: Like operator<<. A single value on its own, otherwise a newline and then one tab-indented row per line.
+        addPrinted  ::: Like PrintMatrix. The matrix is wrapped in [ ] and every row after the first starts with lnstart.
+
+   If summaries are on (setSummary), matrices with more than summaryAt elements only show the first and last
+   few rows and columns, with "..." in place of the rest, followed by their size.
+*/
+class CFormatter
+{
+        std::vector<char>   m_Buf;          // the formatted text
+        size_t              m_nLen;         // how much of m_Buf is in use
+        long                m_nSummaryAt;   // summarize matrices with more elements than this (0 = never)
+        int                 m_nEdge;        // rows/cols shown at each edge of a summary
+        int                 m_nPrec;        // significant digits for numbers
+
+        char*   grow(size_t n);             // makes room for n more characters and returns where they go
+        void    addCell(double d);          // adds a number padded to FMT_WIDTH
+        void    addRows(const CMatrix& m, const char* first, const char* lnstart, const char* last);
+
+public:
+        CFormatter() : m_nLen{0}, m_nSummaryAt{0}, m_nEdge{FMT_EDGE}, m_nPrec{FMT_PRECISION} {};
+
+        void    setSummary(long summaryAt, int edge = FMT_EDGE) { m_nSummaryAt = summaryAt; m_nEdge = (edge > 0) ? edge : 1; };
+        bool    isSummary() const { return m_nSummaryAt > 0; };
+        long    summaryAt() const { return m_nSummaryAt; };
+        int     edge() const { return m_nEdge; };
+        void    setPrecision(int prec) { m_nPrec = (prec > 0) ? prec : FMT_PRECISION; };
+
+        CFormatter& add(const char* s);
+        CFormatter& add(const std::string& s);
+        CFormatter& add(char c);
+        CFormatter& add(double d);
+
+        CFormatter& addMatrix(const CMatrix& m);
+        CFormatter& addPrinted(const CMatrix& m, const std::string& lnstart = "", bool single_as_matrix = false);
+
+        const char* data() const { return m_Buf.data(); };
+        size_t      size() const { return m_nLen; };
+        void        clear() { m_nLen = 0; };
+
+        // Writes everything formatted so far to out in one call and empties the buffer.
+        void        write(std::ostream& out);
+};
+
+#endif // CFORMATTER_H
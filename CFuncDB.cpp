@@ -0,0 +1,33 @@
+#include "CFuncDB.h"
+
+using namespace std;
+
+CFuncDB::~CFuncDB()
+{
+    for (size_t i = 0; i < m_Funcs.size(); ++i)
+        delete m_Funcs[i];
+}
+
+CFunction* CFuncDB::search(const char* name)
+{
+    for (size_t i = 0; i < m_Funcs.size(); ++i)
+    {
+        if (m_Funcs[i]->Name() == name)
+            return m_Funcs[i];
+    }
+    return NULL; //Return null if we can't find the name.
+}
+
+CFunction* CFuncDB::define(const string& name, const string& out, const vector<string>& params, CExpr* body,
+                           const string& text)
+{
+    CFunction* func = search(name.c_str());
+    if (func != NULL)
+        func->Redefine(out, params, body, text);
+    else
+    {
+        func = new CFunction(name, out, params, body, text);
+        m_Funcs.push_back(func);
+    }
+    return func;
+}
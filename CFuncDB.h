@@ -0,0 +1,33 @@
+#include "CFunction.h"
+
+#ifndef CFUNCDB_H
+#define CFUNCDB_H
+
+//////////////////////////////////////////////////
+//      Class CFuncDB                           //
+//////////////////////////////////////////////////
+
+/* The table of user-defined functions, kept next to the variable database. Functions are never removed, so the
+   pointers it hands out stay good for as long as the table does.
+*/
+class CFuncDB
+{
+        std::vector<CFunction*> m_Funcs;
+public:
+        CFuncDB() {};
+        ~CFuncDB();
+
+        CFuncDB(const CFuncDB&) = delete;
+        CFuncDB& operator=(const CFuncDB&) = delete;
+
+        // return a valid ptr if found, else a NULL
+        CFunction*      search(const char* name);
+
+        // Adds the function, or replaces the definition of the one with that name. Takes ownership of body.
+        CFunction*      define(const std::string& name, const std::string& out, const std::vector<std::string>& params,
+                               CExpr* body, const std::string& text);
+
+        CFunction*      at(int i) { return (i < size()) ? m_Funcs[i] : 0; };
+        int             size()    { return m_Funcs.size(); };
+};
+#endif // CFUNCDB_H
@@ -0,0 +1,40 @@
+#include "CFunction.h"
+#include "CExpr.h"
+
+using namespace std;
+
+CFunction::CFunction(const string& name, const string& out, const vector<string>& params, CExpr* body, const string& text)
+    : m_sName{name}, m_sOut{out}, m_Params{params}, m_sText{text}, m_pBody{body}
+{}
+
+CFunction::~CFunction()
+{
+    delete m_pBody;
+}
+
+void CFunction::Redefine(const string& out, const vector<string>& params, CExpr* body, const string& text)
+{
+    delete m_pBody;
+    m_pBody  = body;
+    m_sOut   = out;
+    m_Params = params;
+    m_sText  = text;
+}
+
+string CFunction::Signature() const
+{
+    string sig;
+    if (!m_sOut.empty())
+        sig = m_sOut + " = ";
+
+    sig += m_sName;
+    sig += '(';
+    for (size_t i = 0; i < m_Params.size(); ++i)
+    {
+        if (i > 0)
+            sig += ", ";
+        sig += m_Params[i];
+    }
+    sig += ')';
+    return sig;
+}
@@ -0,0 +1,54 @@
+#ifndef CFUNCTION_H
+#define CFUNCTION_H
+
+#include <string>
+#include <vector>
+
+#define FUNC_MAX_ARGS 8 //Most arguments a user-defined function can take
+
+struct CExpr;
+
+//////////////////////////////////////////////////
+//      Class CFunction                         //
+//////////////////////////////////////////////////
+
+/* A user-defined function, such as
+
+        function y = f(a, b) = a*b + 1
+
+   The body is compiled once, when the function is defined. Its arguments are compiled into slots (XARG nodes holding
+   the position of the argument) rather than names, so a call only has to evaluate its arguments and point the
+   Evaluator at them; nothing is parsed or looked up by name. Bodies can only use their arguments and other functions.
+
+   Compiled calls keep a pointer to the function, so redefining it replaces the body in place and existing calls see
+   the new one.
+*/
+class CFunction
+{
+        std::string                 m_sName;
+        std::string                 m_sOut;     // the name of the result (y above); may be empty
+        std::vector<std::string>    m_Params;
+        std::string                 m_sText;    // the source of the body, for listing
+        CExpr*                      m_pBody;
+
+public:
+        CFunction(const std::string& name, const std::string& out, const std::vector<std::string>& params,
+                  CExpr* body, const std::string& text);
+        ~CFunction();
+
+        CFunction(const CFunction&) = delete;
+        CFunction& operator=(const CFunction&) = delete;
+
+        // Replaces the definition, taking ownership of body.
+        void    Redefine(const std::string& out, const std::vector<std::string>& params, CExpr* body, const std::string& text);
+
+        const std::string&  Name() const { return m_sName; };
+        const std::string&  Text() const { return m_sText; };
+        size_t              Arity() const { return m_Params.size(); };
+        const CExpr*        Body() const { return m_pBody; };
+
+        // "y = f(a, b)", or "f(a, b)" without a result name.
+        std::string         Signature() const;
+};
+
+#endif // CFUNCTION_H
@@ -0,0 +1,80 @@
+#include "CHistogram.h"
+#include <algorithm>
+
+using namespace std;
+
+static const size_t SUB     = size_t(1) << HIST_SUB_BITS;
+static const size_t LINEAR  = 2 * SUB;                                  // values with a bucket each
+static const size_t BUCKETS = LINEAR + (HIST_MAX_BITS - HIST_SUB_BITS - 1) * SUB;
+
+// The top bit of value says which power of two it is in, and the HIST_SUB_BITS bits under it which bucket of that.
+size_t CHistogram::bucket(uint64_t value)
+{
+    if (value < LINEAR)
+        return value;
+
+    int top = 63 - __builtin_clzll(value);
+    if (top >= HIST_MAX_BITS)
+        return BUCKETS - 1;
+    return LINEAR + (top - HIST_SUB_BITS - 1) * SUB + ((value >> (top - HIST_SUB_BITS)) & (SUB - 1));
+}
+
+uint64_t CHistogram::highest(size_t b)
+{
+    if (b < LINEAR)
+        return b;
+
+    int top = (b - LINEAR) / SUB + HIST_SUB_BITS + 1;
+    uint64_t width = uint64_t(1) << (top - HIST_SUB_BITS);
+    return (SUB + (b - LINEAR) % SUB + 1) * width - 1;
+}
+
+void CHistogram::record(uint64_t value)
+{
+    if (m_Counts.empty())
+        m_Counts.resize(BUCKETS, 0);
+
+    ++m_Counts[bucket(value)];
+    ++m_nCount;
+    m_nTotal += value;
+    m_nMax = std::max(m_nMax, value);
+}
+
+void CHistogram::merge(const CHistogram& other)
+{
+    if (other.m_nCount == 0)
+        return;
+    if (m_Counts.empty())
+        m_Counts.resize(BUCKETS, 0);
+
+    for (size_t b = 0; b < BUCKETS; ++b)
+        m_Counts[b] += other.m_Counts[b];
+    m_nCount += other.m_nCount;
+    m_nTotal += other.m_nTotal;
+    m_nMax = std::max(m_nMax, other.m_nMax);
+}
+
+void CHistogram::reset()
+{
+    m_Counts.clear();
+    m_nCount = m_nTotal = m_nMax = 0;
+}
+
+uint64_t CHistogram::percentile(double p) const
+{
+    if (m_nCount == 0)
+        return 0;
+
+    // The rank of the value we want, counting from 1.
+    uint64_t rank = uint64_t(p / 100 * m_nCount + 0.5);
+    rank = std::min(std::max(rank, uint64_t(1)), m_nCount);
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < BUCKETS; ++b)
+    {
+        seen += m_Counts[b];
+        if (seen >= rank)
+            return std::min(highest(b), m_nMax);
+    }
+    return m_nMax;
+}
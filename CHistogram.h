@@ -0,0 +1,50 @@
+#ifndef CHISTOGRAM_H
+#define CHISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define HIST_SUB_BITS   5   //Each power of two is split into 2^HIST_SUB_BITS buckets
+#define HIST_MAX_BITS   40  //Values of 2^HIST_MAX_BITS and over (18 minutes, in nanoseconds) share the last bucket
+
+//////////////////////////////////////////////////
+//      Class CHistogram                        //
+//////////////////////////////////////////////////
+
+/* A histogram of latencies, or of any other counts, in the style of HdrHistogram. Values below 2^(HIST_SUB_BITS+1)
+   have a bucket each. Above that, every power of two is split into 2^HIST_SUB_BITS buckets of equal width, so the
+   buckets widen as the values grow. A fixed 1152 buckets cover nanoseconds to minutes, and every value lands in a
+   bucket less than 1/32 (3%) wider than itself.
+
+   Recording a value is a couple of shifts and an increment. Percentiles are the top of the bucket they fall in, which
+   makes them at most 3% high. The count, total and maximum are exact. The buckets are only allocated on the first
+   record(), so a histogram which is never used costs next to nothing.
+
+   Not thread-safe: use one per thread and merge() them.
+*/
+class CHistogram
+{
+        std::vector<uint64_t>   m_Counts;   // by bucket, empty until something is recorded
+        uint64_t                m_nCount;
+        uint64_t                m_nTotal;
+        uint64_t                m_nMax;
+
+        static size_t   bucket(uint64_t value);
+        static uint64_t highest(size_t b);  // the largest value which goes in bucket b
+
+public:
+        CHistogram() : m_nCount{0}, m_nTotal{0}, m_nMax{0} {};
+
+        void        record(uint64_t value);
+        void        merge(const CHistogram& other);
+        void        reset();
+
+        uint64_t    count() const { return m_nCount; };
+        uint64_t    max() const { return m_nMax; };
+        double      mean() const { return (m_nCount > 0) ? double(m_nTotal) / m_nCount : 0; };
+        // The value which p percent (0 to 100) of those recorded are no larger than. 0 if there are none.
+        uint64_t    percentile(double p) const;
+};
+
+#endif // CHISTOGRAM_H
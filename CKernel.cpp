@@ -0,0 +1,243 @@
+#include "CKernel.h"
+#include "CMathLib.h"
+#include <cmath>
+
+using namespace std;
+
+/*** Element-wise ***
+
+Every element-wise kernel is the same loop with a different operation, and aOne or bOne saying which side is a
+single value. The loop is written once, and the operation is a lambda so the compiler can vectorize each copy.
+
+*/
+template <class F>
+static void zip(const double* a, bool aOne, const double* b, bool bOne, double* y, size_t n, F f)
+{
+    if (aOne)
+    {
+        double s = a[0];
+        for (size_t i = 0; i < n; ++i)
+            y[i] = f(s, b[i]);
+    }
+    else if (bOne)
+    {
+        double s = b[0];
+        for (size_t i = 0; i < n; ++i)
+            y[i] = f(a[i], s);
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+            y[i] = f(a[i], b[i]);
+    }
+}
+
+static void elementwise(OP op, const double* a, bool aOne, const double* b, bool bOne, double* y, size_t n)
+{
+    switch (op)
+    {
+    case ADD:
+        zip(a, aOne, b, bOne, y, n, [](double p, double q) { return p + q; });
+        break;
+    case SUB:
+        zip(a, aOne, b, bOne, y, n, [](double p, double q) { return p - q; });
+        break;
+    case MULT:
+        zip(a, aOne, b, bOne, y, n, [](double p, double q) { return p * q; });
+        break;
+    case DIV:
+        zip(a, aOne, b, bOne, y, n, [](double p, double q) { return p / q; });
+        break;
+    default:
+        break;
+    }
+}
+
+const char* CKernel::symbol(OP op)
+{
+    switch (op)
+    {
+    case ADD:   return "+";
+    case SUB:   return "-";
+    case MULT:  return "*";
+    case DIV:   return "/";
+    case EXP:   return "^";
+    case MOD:   return "%";
+    case EQ:    return "==";
+    case NE:    return "!=";
+    case LT:    return "<";
+    case GT:    return ">";
+    case LE:    return "<=";
+    case GE:    return ">=";
+    default:    return "?";
+    }
+}
+
+OPKERNEL CKernel::plan(OP op, int aRows, int aCols, int bRows, int bCols, int& rows, int& cols, string& err)
+{
+    bool aOne = (aRows == 1 && aCols == 1);
+    bool bOne = (bRows == 1 && bCols == 1);
+    rows = aRows;
+    cols = aCols;
+
+    bool arith = (op == ADD || op == SUB || op == MULT || op == DIV);
+    if (!arith && !CMathLib::isComparison(op) && op != EXP && op != MOD)
+    {
+        err = "Operation ";
+        err += symbol(op);
+        err += " cannot be calculated.";
+        return KNONE;
+    }
+
+    if (aRows <= 0 || aCols <= 0 || bRows <= 0 || bCols <= 0)
+    {
+        err = "Operation ";
+        err += symbol(op);
+        err += " has an empty operand.";
+        return KNONE;
+    }
+
+    if (aOne && bOne)
+        return KSCALAR;
+
+    // Matrix powers are not implemented yet.
+    if (op == EXP || op == MOD)
+    {
+        err = "Cannot use ";
+        err += symbol(op);
+        err += " with matrices.";
+        return KNONE;
+    }
+
+    if (bOne)
+        return KMATSCALAR;
+    if (aOne)
+    {
+        rows = bRows;
+        cols = bCols;
+        return KSCALARMAT;
+    }
+
+    if (op == MULT && aCols == bRows)
+    {
+        cols = bCols;
+        return (bCols == 1) ? KGEMV : KGEMM;
+    }
+    if (aRows == bRows && aCols == bCols)
+        return KELEMENT;
+
+    err = "Cannot use ";
+    err += symbol(op);
+    err += " on a " + to_string(aRows) + "x" + to_string(aCols) + " and a " + to_string(bRows) + "x"
+         + to_string(bCols) + " matrix.";
+    return KNONE;
+}
+
+bool CKernel::run(OPKERNEL k, OP op, const CMatrix& a, const CMatrix& b, CMatrix& out)
+{
+    if (CMathLib::isComparison(op))
+        return CMathLib::compare(op, a, b, out) == NULL;
+
+    const double* x = a.data();
+    const double* y = b.data();
+
+    switch (k)
+    {
+    case KSCALAR: {
+        double p = x[0], q = y[0], r;
+        switch (op)
+        {
+        case ADD:   r = p + q; break;
+        case SUB:   r = p - q; break;
+        case MULT:  r = p * q; break;
+        case DIV:
+            if (q == 0)
+                return false;
+            r = p / q;
+            break;
+        case EXP:   r = pow(p, q); break;
+        case MOD:
+            if (int(q) == 0)
+                return false;
+            r = int(p) % int(q);
+            break;
+        default:
+            return false;
+        }
+        out.reshape(1, 1);
+        out.data()[0] = r;
+        return true; }
+    case KMATSCALAR:
+        // A matrix divided by zero has no value, although elements divided by zero are infinite.
+        if (op == DIV && y[0] == 0)
+            return false;
+        out.reshape(a.getNRow(), a.getNCol());
+        elementwise(op, x, false, y, true, out.data(), out.Size());
+        return true;
+    case KSCALARMAT:
+        out.reshape(b.getNRow(), b.getNCol());
+        elementwise(op, x, true, y, false, out.data(), out.Size());
+        return true;
+    case KELEMENT:
+        out.reshape(a.getNRow(), a.getNCol());
+        elementwise(op, x, false, y, false, out.data(), out.Size());
+        return true;
+    case KGEMV:
+        out.reshape(a.getNRow(), 1);
+        gemv(x, y, out.data(), a.getNRow(), a.getNCol());
+        return true;
+    case KGEMM:
+        out.reshape(a.getNRow(), b.getNCol());
+        gemm(x, y, out.data(), a.getNRow(), a.getNCol(), b.getNCol());
+        return true;
+    case KNONE:
+        break;
+    }
+    return false;
+}
+
+bool CKernel::update(OPKERNEL k, OP op, CMatrix& a, const CMatrix& b)
+{
+    if (k != KSCALAR && k != KMATSCALAR && k != KELEMENT)
+        return false;
+
+    bool bOne = (k != KELEMENT);
+    if (op == DIV && bOne && b.data()[0] == 0)
+        return false;
+
+    elementwise(op, a.data(), false, b.data(), bOne, a.data(), a.Size());
+    return true;
+}
+
+// Row i of y is the sum of the rows of b, weighted by row i of a. Going along rows keeps every access sequential, and
+// the inner loop vectorizes.
+void CKernel::gemm(const double* a, const double* b, double* y, int m, int n, int p)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        double* yi = y + (size_t)i * p;
+        for (int j = 0; j < p; ++j)
+            yi[j] = 0;
+
+        const double* ai = a + (size_t)i * n;
+        for (int k = 0; k < n; ++k)
+        {
+            double aik = ai[k];
+            const double* bk = b + (size_t)k * p;
+            for (int j = 0; j < p; ++j)
+                yi[j] += aik * bk[j];
+        }
+    }
+}
+
+void CKernel::gemv(const double* a, const double* x, double* y, int m, int n)
+{
+    for (int i = 0; i < m; ++i)
+    {
+        const double* ai = a + (size_t)i * n;
+        double sum = 0;
+        for (int k = 0; k < n; ++k)
+            sum += ai[k] * x[k];
+        y[i] = sum;
+    }
+}
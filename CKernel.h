@@ -0,0 +1,53 @@
+#ifndef CKERNEL_H
+#define CKERNEL_H
+
+#include <string>
+#include "CMatrix.h"
+#include "CExpr.h"
+
+//////////////////////////////////////////////////
+//      Class CKernel                           //
+//////////////////////////////////////////////////
+
+/* The kernels behind the binary operators. Which one an operator needs depends only on the shapes of its operands,
+   so it is chosen once by plan() (Calc::Infer does so while compiling) and run() then goes straight to it:
+
+        KSCALAR     ::: Two single values. The only kernel for ^ and %.
+        KSCALARMAT  ::: A single value and a matrix, s op M, applied to every element of M.
+        KMATSCALAR  ::: A matrix and a single value, M op s.
+        KELEMENT    ::: Two matrices of the same size, element by element.
+        KGEMV       ::: A matrix times a column vector with as many rows as the matrix has columns.
+        KGEMM       ::: A matrix product, when the columns of the first match the rows of the second.
+
+   * is a matrix product whenever the sizes allow it, and element by element otherwise; the other arithmetic
+   operators are always element by element. Comparisons plan the same way but run through CMathLib::compare.
+
+   Element-wise kernels only read element i of each operand to write element i of the result, so they can also write
+   over their first operand (update), even when the second one is the same matrix.
+*/
+class CKernel
+{
+public:
+        // Chooses the kernel for a op b, for operands of the given sizes, and the size of the result. KNONE if the
+        // sizes don't go together, with the reason in err.
+        static OPKERNEL plan(OP op, int aRows, int aCols, int bRows, int bCols, int& rows, int& cols, std::string& err);
+
+        // Runs kernel k for a op b, with the result in out. The operands must have the sizes the kernel was planned
+        // for. out can only be a or b for element-wise arithmetic which gives a result of the same size. False if the
+        // result has no value (division by zero).
+        static bool     run(OPKERNEL k, OP op, const CMatrix& a, const CMatrix& b, CMatrix& out);
+
+        // a = a op b in a's own storage, for the kernels which keep the size of a (KSCALAR, KMATSCALAR, KELEMENT) and
+        // the operators +, -, * and /. b may be a itself. False, with a unchanged, on a division by zero.
+        static bool     update(OPKERNEL k, OP op, CMatrix& a, const CMatrix& b);
+
+        // y = a*b for an m x n matrix a and an n x p matrix b. y must not overlap either of them.
+        static void     gemm(const double* a, const double* b, double* y, int m, int n, int p);
+        // y = a*x for an m x n matrix a and a vector x of n elements.
+        static void     gemv(const double* a, const double* x, double* y, int m, int n);
+
+        // The symbol of a binary operator, for error messages.
+        static const char*  symbol(OP op);
+};
+
+#endif // CKERNEL_H
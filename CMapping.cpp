@@ -0,0 +1,90 @@
+#include "CMapping.h"
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+shared_ptr<const CMapping> CMapping::open(const string& path, string& err)
+{
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in)
+    {
+        err = "Cannot open " + path + ".";
+        return NULL;
+    }
+
+    shared_ptr<CMapping> map(new CMapping);
+    map->m_nSize = in.tellg();
+    char* data = new char [map->m_nSize];
+    map->m_pData = data;
+    in.seekg(0);
+    if (!in.read(data, map->m_nSize))
+    {
+        err = "Cannot read " + path + ".";
+        return NULL;
+    }
+    return map;
+}
+
+CMapping::~CMapping()
+{
+    delete [] m_pData;
+}
+
+#else
+
+shared_ptr<const CMapping> CMapping::open(const string& path, string& err)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        err = "Cannot open " + path + ": " + strerror(errno) + ".";
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        err = "Cannot read " + path + ": " + strerror(errno) + ".";
+        ::close(fd);
+        return NULL;
+    }
+
+    shared_ptr<CMapping> map(new CMapping);
+    map->m_nSize = st.st_size;
+    if (map->m_nSize > 0)
+    {
+        void* data = mmap(NULL, map->m_nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            err = "Cannot map " + path + ": " + strerror(errno) + ".";
+            map->m_nSize = 0;
+            ::close(fd);
+            return NULL;
+        }
+        map->m_pData = static_cast<const char*>(data);
+    }
+
+    // The mapping keeps the file open by itself.
+    ::close(fd);
+    return map;
+}
+
+CMapping::~CMapping()
+{
+    if (m_pData != NULL)
+        munmap(const_cast<char*>(m_pData), m_nSize);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef CMAPPING_H
+#define CMAPPING_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+//////////////////////////////////////////////////
+//      Class CMapping                          //
+//////////////////////////////////////////////////
+
+/* A whole file, mapped read-only into memory. Nothing is read from the disk until a page of it is first touched, so
+   mapping a big file costs no more than a small one. The mapping is shared by everything holding a pointer to it, and
+   goes away with the last of them, so the file can be replaced or deleted while it is in use.
+
+   Where there is no mmap (Windows), the file is read into memory instead.
+*/
+class CMapping
+{
+        const char*     m_pData;
+        size_t          m_nSize;
+
+        CMapping() : m_pData{NULL}, m_nSize{0} {};
+
+public:
+        ~CMapping();
+
+        CMapping(const CMapping&) = delete;
+        CMapping& operator=(const CMapping&) = delete;
+
+        // Maps the file at path, or returns NULL with the reason in err.
+        static std::shared_ptr<const CMapping> open(const std::string& path, std::string& err);
+
+        const char*     data() const { return m_pData; };
+        size_t          size() const { return m_nSize; };
+};
+
+#endif // CMAPPING_H
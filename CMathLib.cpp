@@ -0,0 +1,575 @@
+#include "CMathLib.h"
+#include "CThreadPool.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+//Doubles per vector: the width of the widest SIMD registers the compiler may use.
+#if defined(__AVX512F__)
+#define MATH_LANES 8
+#elif defined(__AVX__)
+#define MATH_LANES 4
+#else
+#define MATH_LANES 2
+#endif
+
+typedef void (*KERNEL)(const double* x, double* y, size_t n);
+
+/*** Vectors ***
+
+The kernels work on MATH_LANES doubles at a time with the vector extensions of GCC and Clang, which compile to
+whatever SIMD instructions the target has. Comparisons give a mask of all ones or all zeros per lane, and m ? a : b
+picks per lane, so there are no branches. Casting between vdouble and vint keeps the bits.
+
+Adding ROUNDER to a double of magnitude below 2^51 rounds it to the nearest integer, which then sits in the low bits
+of the sum. Subtracting ROUNDER again gives the integer as a double, and subtracting the bits of ROUNDER gives it as an
+integer.
+
+*/
+typedef double  vdouble __attribute__((vector_size(MATH_LANES * sizeof(double))));
+typedef int64_t vint    __attribute__((vector_size(MATH_LANES * sizeof(int64_t))));
+
+static const double  ROUNDER      = 6755399441055744.0; // 1.5 * 2^52
+static const int64_t ROUNDER_BITS = 0x4338000000000000LL;
+static const int64_t SIGN_BIT     = int64_t(1ULL << 63);
+
+static inline vdouble splat(double d)
+{
+    return vdouble{} + d;
+}
+
+static inline vdouble vabs(vdouble v)
+{
+    return (vdouble)((vint)v & ~SIGN_BIT);
+}
+
+// 2^k for -1022 <= k <= 1023
+static inline vdouble pow2(vint k)
+{
+    return (vdouble)((k + 1023) << 52);
+}
+
+// Runs f over n doubles, a vector at a time. The last few go through a padded vector of their own.
+template <vdouble (*F)(vdouble)>
+static void map(const double* x, double* y, size_t n)
+{
+    size_t i = 0;
+    for (; i + MATH_LANES <= n; i += MATH_LANES)
+    {
+        vdouble v;
+        memcpy(&v, x + i, sizeof(v));
+        v = F(v);
+        memcpy(y + i, &v, sizeof(v));
+    }
+
+    if (i < n)
+    {
+        vdouble v = {};
+        memcpy(&v, x + i, (n - i) * sizeof(double));
+        v = F(v);
+        memcpy(y + i, &v, (n - i) * sizeof(double));
+    }
+}
+
+/*** Kernels ***/
+
+// The parts of ln(2) and pi/2 used for range reduction: the high parts have their low bits zero, so multiplying them
+// by the small integers involved is exact.
+static const double LN2_HI   = 6.93147180369123816490e-01;
+static const double LN2_LO   = 1.90821492927058770002e-10;
+static const double PIO2_1   = 1.57079632673412561417e+00;
+static const double PIO2_2   = 6.07710050630396597660e-11;
+static const double PIO2_3   = 2.02226624871116645580e-21;
+static const double TWO_OPI  = 6.36619772367581382433e-01; // 2/pi
+static const double TRIG_MAX = 1e6;  // largest |x| the trig reduction is accurate for
+
+// sin(r) and cos(r) for |r| <= pi/4, by their Taylor series up to r^17 and r^16. The first term left out is below
+// 5e-17 of the result.
+static inline vdouble sinPoly(vdouble r)
+{
+    vdouble r2 = r*r;
+    vdouble p = splat(2.81145725434552076e-15); //  1/17!
+    p = p*r2 - 7.64716373181981648e-13;         // -1/15!
+    p = p*r2 + 1.60590438368216146e-10;         //  1/13!
+    p = p*r2 - 2.50521083854417188e-08;         // -1/11!
+    p = p*r2 + 2.75573192239858907e-06;         //  1/9!
+    p = p*r2 - 1.98412698412698413e-04;         // -1/7!
+    p = p*r2 + 8.33333333333333333e-03;         //  1/5!
+    p = p*r2 - 1.66666666666666667e-01;         // -1/3!
+    return r + r*r2*p;
+}
+
+static inline vdouble cosPoly(vdouble r)
+{
+    vdouble r2 = r*r;
+    vdouble p = splat(4.77947733238738530e-14); //  1/16!
+    p = p*r2 - 1.14707455977297247e-11;         // -1/14!
+    p = p*r2 + 2.08767569878680990e-09;         //  1/12!
+    p = p*r2 - 2.75573192239858907e-07;         // -1/10!
+    p = p*r2 + 2.48015873015873016e-05;         //  1/8!
+    p = p*r2 - 1.38888888888888889e-03;         // -1/6!
+    p = p*r2 + 4.16666666666666667e-02;         //  1/4!
+    p = p*r2 - 0.5;                             // -1/2!
+    return 1.0 + r2*p;
+}
+
+// sin(x + shift*pi/2): reduces x to r in [-pi/4, pi/4] and a quadrant, then picks the polynomial and the sign. Lanes
+// beyond TRIG_MAX come out as garbage, and are redone by the caller.
+template <int shift>
+static inline vdouble trig(vdouble x)
+{
+    vdouble v = (vabs(x) < TRIG_MAX) ? x : splat(0.0);
+    vdouble t = v*TWO_OPI + ROUNDER;
+    vdouble q = t - ROUNDER;
+    vint quad = (vint)t - ROUNDER_BITS + shift;
+
+    vdouble r = ((v - q*PIO2_1) - q*PIO2_2) - q*PIO2_3;
+    vdouble y = ((quad & 1) != 0) ? cosPoly(r) : sinPoly(r);
+    return (vdouble)((vint)y ^ ((quad & 2) << 62));
+}
+
+// e^x = 2^k * e^r with x = k*ln(2) + r and |r| <= ln(2)/2. e^r is its Taylor series up to r^12; the first term left
+// out is below 2e-16 of the result. 2^k is applied in two halves so that results near the ends of the range, where
+// 2^k itself isn't a normal double, come out right.
+static inline vdouble vexp(vdouble v)
+{
+    vdouble c = (v > 709.8) ? splat(709.8) : (v < -745.2) ? splat(-745.2) : (v == v) ? v : splat(0.0);
+
+    vdouble t = c*1.44269504088896341 + ROUNDER;
+    vdouble k = t - ROUNDER;
+    vint    ki = (vint)t - ROUNDER_BITS;
+    vdouble r = (c - k*LN2_HI) - k*LN2_LO;
+
+    vdouble p = splat(2.08767569878680990e-09); // 1/12!
+    p = p*r + 2.50521083854417188e-08;          // 1/11!
+    p = p*r + 2.75573192239858907e-07;          // 1/10!
+    p = p*r + 2.75573192239858907e-06;          // 1/9!
+    p = p*r + 2.48015873015873016e-05;          // 1/8!
+    p = p*r + 1.98412698412698413e-04;          // 1/7!
+    p = p*r + 1.38888888888888889e-03;          // 1/6!
+    p = p*r + 8.33333333333333333e-03;          // 1/5!
+    p = p*r + 4.16666666666666667e-02;          // 1/4!
+    p = p*r + 1.66666666666666667e-01;          // 1/3!
+    p = p*r + 0.5;
+    p = p*r + 1.0;
+    p = p*r + 1.0;
+
+    vint    k1 = ki >> 1;
+    vdouble e = p * pow2(k1) * pow2(ki - k1);
+
+    e = (v > 709.78271289338397) ? splat(numeric_limits<double>::infinity()) : e;
+    e = (v < -745.13321910194122) ? splat(0.0) : e;
+    return (v == v) ? e : v;
+}
+
+// ln(x) = k*ln(2) + ln(m) with x = 2^k * m and sqrt(1/2) <= m < sqrt(2). ln(m) = 2*atanh(f) with f = (m-1)/(m+1),
+// whose series in f is summed up to f^21; the first term left out is below 1e-18.
+static inline vdouble vlog(vdouble v)
+{
+    //Bring subnormals up to normal numbers first.
+    vint    tiny = (v < 2.2250738585072014e-308);
+    vdouble s = (tiny != 0) ? v*18014398509481984.0 : v;   // 2^54
+    vint    u = (vint)s;
+
+    vint    k = ((u >> 52) & 0x7ff) - 1023 - (tiny & 54);
+    vdouble m = (vdouble)((u & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+    vint    high = (m > 1.41421356237309505);
+    m = (high != 0) ? m*0.5 : m;
+    k -= high;
+    vdouble kd = (vdouble)(k + ROUNDER_BITS) - ROUNDER;
+
+    vdouble f = (m - 1.0) / (m + 1.0);
+    vdouble f2 = f*f;
+    vdouble p = splat(1.0/21);
+    p = p*f2 + 1.0/19;
+    p = p*f2 + 1.0/17;
+    p = p*f2 + 1.0/15;
+    p = p*f2 + 1.0/13;
+    p = p*f2 + 1.0/11;
+    p = p*f2 + 1.0/9;
+    p = p*f2 + 1.0/7;
+    p = p*f2 + 1.0/5;
+    p = p*f2 + 1.0/3;
+    vdouble l = kd*LN2_HI + (2*f + (2*f*f2*p + kd*LN2_LO));
+
+    l = (v == 0.0) ? splat(-numeric_limits<double>::infinity()) : l;
+    l = (v == numeric_limits<double>::infinity()) ? v : l;
+    return (v < 0.0 || v != v) ? splat(numeric_limits<double>::quiet_NaN()) : l;
+}
+
+void CMathLib::sin(const double* x, double* y, size_t n)
+{
+    map<trig<0>>(x, y, n);
+
+    //Huge values, infinities and NaNs, which are rare enough to do one at a time.
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!(fabs(x[i]) < TRIG_MAX))
+            y[i] = std::sin(x[i]);
+    }
+}
+
+void CMathLib::cos(const double* x, double* y, size_t n)
+{
+    map<trig<1>>(x, y, n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!(fabs(x[i]) < TRIG_MAX))
+            y[i] = std::cos(x[i]);
+    }
+}
+
+void CMathLib::exp(const double* x, double* y, size_t n)
+{
+    map<vexp>(x, y, n);
+}
+
+void CMathLib::log(const double* x, double* y, size_t n)
+{
+    map<vlog>(x, y, n);
+}
+
+// The square root is a single instruction already.
+void CMathLib::sqrt(const double* x, double* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] = std::sqrt(x[i]);
+}
+
+void CMathLib::abs(const double* x, double* y, size_t n)
+{
+    map<vabs>(x, y, n);
+}
+
+/*** Comparisons ***/
+
+static const int64_t ONE_BITS = 0x3ff0000000000000LL; // 1.0
+
+// A vector of a, or a copied into every lane if it is a single value.
+static inline vdouble load(const double* a, bool one, size_t i)
+{
+    if (one)
+        return splat(a[0]);
+
+    vdouble v;
+    memcpy(&v, a + i, sizeof(v));
+    return v;
+}
+
+// Calls body with the comparison for op, as a function from two vectors to a mask.
+template <class BODY>
+static void withComparison(OP op, BODY body)
+{
+    switch (op)
+    {
+    case EQ: body([](vdouble a, vdouble b) { return (vint)(a == b); }); break;
+    case NE: body([](vdouble a, vdouble b) { return (vint)(a != b); }); break;
+    case LT: body([](vdouble a, vdouble b) { return (vint)(a < b); });  break;
+    case GT: body([](vdouble a, vdouble b) { return (vint)(a > b); });  break;
+    case LE: body([](vdouble a, vdouble b) { return (vint)(a <= b); }); break;
+    case GE: body([](vdouble a, vdouble b) { return (vint)(a >= b); }); break;
+    default: break;
+    }
+}
+
+void CMathLib::compare(OP op, const double* a, bool aOne, const double* b, bool bOne, double* y, size_t n)
+{
+    withComparison(op, [=](auto cmp)
+    {
+        size_t i = 0;
+        for (; i + MATH_LANES <= n; i += MATH_LANES)
+        {
+            vdouble v = (vdouble)(cmp(load(a, aOne, i), load(b, bOne, i)) & ONE_BITS);
+            memcpy(y + i, &v, sizeof(v));
+        }
+
+        for (; i < n; ++i)
+            y[i] = double(cmp(splat(a[aOne ? 0 : i]), splat(b[bOne ? 0 : i]))[0] & 1);
+    });
+}
+
+size_t CMathLib::count(OP op, const double* a, bool aOne, const double* b, bool bOne, size_t n)
+{
+    size_t total = 0;
+
+    withComparison(op, [&](auto cmp)
+    {
+        //Masks are -1 where the comparison holds.
+        vint   hits = {};
+        size_t i = 0;
+        for (; i + MATH_LANES <= n; i += MATH_LANES)
+            hits -= cmp(load(a, aOne, i), load(b, bOne, i));
+
+        for (int j = 0; j < MATH_LANES; ++j)
+            total += hits[j];
+
+        for (; i < n; ++i)
+            total += cmp(splat(a[aOne ? 0 : i]), splat(b[bOne ? 0 : i]))[0] & 1;
+    });
+    return total;
+}
+
+// Every element is written to the next free place in y, which only moves on if the element is taken. That is safe
+// while there are a vector's worth of places left; the last few elements are checked one by one instead.
+void CMathLib::select(const double* x, OP op, const double* a, bool aOne, const double* b, bool bOne, double* y,
+                      size_t n)
+{
+    size_t room = count(op, a, aOne, b, bOne, n);
+
+    withComparison(op, [=](auto cmp)
+    {
+        size_t k = 0;
+        size_t i = 0;
+        for (; i + MATH_LANES <= n && k + MATH_LANES <= room; i += MATH_LANES)
+        {
+            vint take = cmp(load(a, aOne, i), load(b, bOne, i)) & 1;
+            for (int j = 0; j < MATH_LANES; ++j)
+            {
+                y[k] = x ? x[i + j] : double(i + j + 1);
+                k += take[j];
+            }
+        }
+
+        for (; i < n && k < room; ++i)
+        {
+            if (cmp(splat(a[aOne ? 0 : i]), splat(b[bOne ? 0 : i]))[0])
+                y[k++] = x ? x[i] : double(i + 1);
+        }
+    });
+}
+
+const char* CMathLib::compare(OP op, const CMatrix& a, const CMatrix& b, CMatrix& out)
+{
+    if (a.IsNull() || b.IsNull())
+        return "cannot compare null matrices.";
+    if (!a.IsSingle() && !b.IsSingle() && (a.getNRow() != b.getNRow() || a.getNCol() != b.getNCol()))
+        return "matrices must be the same size to be compared.";
+
+    const CMatrix& shape = a.IsSingle() ? b : a;
+    out = CMatrix(shape.getNRow(), shape.getNCol());
+    compare(op, a.data(), a.IsSingle(), b.data(), b.IsSingle(), out.data(), out.Size());
+    return NULL;
+}
+
+const char* CMathLib::select(const CMatrix& x, OP op, const CMatrix& a, const CMatrix& b, CMatrix& out)
+{
+    if (x.IsNull() || a.IsNull() || b.IsNull())
+        return "cannot select from or with null matrices.";
+    if (!a.IsSingle() && !b.IsSingle() && (a.getNRow() != b.getNRow() || a.getNCol() != b.getNCol()))
+        return "matrices must be the same size to be compared.";
+
+    const CMatrix& mask = a.IsSingle() ? b : a;
+    if (mask.getNRow() != x.getNRow() || mask.getNCol() != x.getNCol())
+        return "the mask must be the same size as the matrix.";
+
+    size_t n = x.Size();
+    int    taken = count(op, a.data(), a.IsSingle(), b.data(), b.IsSingle(), n);
+    if (taken == 0)
+        out = CMatrix();
+    else
+    {
+        out = (x.getNRow() == 1) ? CMatrix(1, taken) : CMatrix(taken, 1);
+        select(x.data(), op, a.data(), a.IsSingle(), b.data(), b.IsSingle(), out.data(), n);
+    }
+    return NULL;
+}
+
+/*** Threads ***/
+
+// Runs kernel over x into y, split into one piece per thread if there is enough of it. The pool is only made the
+// first time it's needed.
+static void runSplit(KERNEL kernel, const double* x, double* y, size_t n)
+{
+    if (n < MATH_PAR_MIN)
+    {
+        kernel(x, y, n);
+        return;
+    }
+
+    static CThreadPool pool(int(thread::hardware_concurrency()) - 1);
+
+    //Pieces are multiples of 8 elements so that each starts on a fresh cache line.
+    size_t pieces = pool.size() + 1;
+    size_t each   = ((n + pieces - 1) / pieces + 7) & ~size_t(7);
+
+    //This can't use pool.wait(), since other threads may be using the pool at the same time.
+    mutex               lock;
+    condition_variable  finished;
+    size_t              left = 0;
+
+    for (size_t st = each; st < n; st += each)
+    {
+        size_t len = (n - st < each) ? n - st : each;
+        ++left;
+        pool.submit([&, st, len]
+        {
+            kernel(x + st, y + st, len);
+            lock_guard<mutex> guard(lock);
+            if (--left == 0)
+                finished.notify_one();
+        });
+    }
+
+    kernel(x, y, (n < each) ? n : each);
+
+    unique_lock<mutex> guard(lock);
+    finished.wait(guard, [&]{ return left == 0; });
+}
+
+/*** Built-in functions ***/
+
+static const char* callUnary(KERNEL kernel, const CMatrix* const* args, CMatrix& out)
+{
+    const CMatrix& x = *args[0];
+    if (x.IsNull())
+        return "the argument is null.";
+
+    out = CMatrix(x.getNRow(), x.getNCol());
+    runSplit(kernel, x.data(), out.data(), x.Size());
+    return NULL;
+}
+
+// max and min. big tells which.
+static const char* callExtreme(bool big, const CMatrix* const* args, int nArgs, CMatrix& out)
+{
+    //Which value to keep out of a and b. NaNs lose against anything else.
+    auto pick = [big](double a, double b)
+    {
+        return ((big ? a > b : a < b) || b != b) ? a : b;
+    };
+
+    for (int i = 0; i < nArgs; ++i)
+    {
+        if (args[i]->IsNull())
+            return "an argument is null.";
+    }
+
+    // With one argument, the extreme of its elements.
+    if (nArgs == 1)
+    {
+        const double* x = args[0]->data();
+        double e = x[0];
+        for (int i = 1; i < args[0]->Size(); ++i)
+            e = pick(e, x[i]);
+        out = e;
+        return NULL;
+    }
+
+    // Otherwise, element by element. The result is the size of the matrices among the arguments.
+    const CMatrix* shape = args[0];
+    for (int i = 1; i < nArgs; ++i)
+    {
+        if (args[i]->IsSingle())
+            continue;
+        if (shape->IsSingle())
+            shape = args[i];
+        else if (args[i]->getNRow() != shape->getNRow() || args[i]->getNCol() != shape->getNCol())
+            return "the arguments must be matrices of the same size, or scalars.";
+    }
+
+    out = *shape;
+    double* y = out.data();
+    size_t  n = out.Size();
+    for (int a = 0; a < nArgs; ++a)
+    {
+        if (args[a] == shape)
+            continue;
+
+        const double* x = args[a]->data();
+        if (args[a]->IsSingle())
+        {
+            for (size_t i = 0; i < n; ++i)
+                y[i] = pick(y[i], x[0]);
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+                y[i] = pick(y[i], x[i]);
+        }
+    }
+    return NULL;
+}
+
+// any, all, nnz and find, which all look for nonzero elements.
+static const double ZERO = 0.0;
+
+static const char* callNnz(const CMatrix* const* args, int, CMatrix& out)
+{
+    const CMatrix& x = *args[0];
+    if (x.IsNull())
+        return "the argument is null.";
+
+    out = double(CMathLib::count(NE, x.data(), false, &ZERO, true, x.Size()));
+    return NULL;
+}
+
+static const char* callAny(const CMatrix* const* args, int, CMatrix& out)
+{
+    const CMatrix& x = *args[0];
+    if (x.IsNull())
+        return "the argument is null.";
+
+    //NaNs are the elements which aren't equal to themselves.
+    size_t nonzero = CMathLib::count(NE, x.data(), false, &ZERO, true, x.Size());
+    size_t nans    = CMathLib::count(NE, x.data(), false, x.data(), false, x.Size());
+    out = double(nonzero > nans);
+    return NULL;
+}
+
+static const char* callAll(const CMatrix* const* args, int, CMatrix& out)
+{
+    const CMatrix& x = *args[0];
+    if (x.IsNull())
+        return "the argument is null.";
+
+    out = double(CMathLib::count(EQ, x.data(), false, &ZERO, true, x.Size()) == 0);
+    return NULL;
+}
+
+static const char* callFind(const CMatrix* const* args, int, CMatrix& out)
+{
+    const CMatrix& x = *args[0];
+    if (x.IsNull())
+        return "the argument is null.";
+
+    int found = CMathLib::count(NE, x.data(), false, &ZERO, true, x.Size());
+    if (found == 0)
+        out = CMatrix();
+    else
+    {
+        out = (x.getNRow() == 1) ? CMatrix(1, found) : CMatrix(found, 1);
+        CMathLib::select(NULL, NE, x.data(), false, &ZERO, true, out.data(), x.Size());
+    }
+    return NULL;
+}
+
+static const CBuiltin s_Builtins[] =
+{
+    {"sin",  1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::sin, a, out); }},
+    {"cos",  1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::cos, a, out); }},
+    {"exp",  1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::exp, a, out); }},
+    {"log",  1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::log, a, out); }},
+    {"ln",   1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::log, a, out); }},
+    {"sqrt", 1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::sqrt, a, out); }},
+    {"abs",  1, 1,  [](const CMatrix* const* a, int, CMatrix& out) { return callUnary(CMathLib::abs, a, out); }},
+    {"max",  1, -1, [](const CMatrix* const* a, int n, CMatrix& out) { return callExtreme(true, a, n, out); }},
+    {"min",  1, -1, [](const CMatrix* const* a, int n, CMatrix& out) { return callExtreme(false, a, n, out); }},
+    {"any",  1, 1,  callAny},
+    {"all",  1, 1,  callAll},
+    {"nnz",  1, 1,  callNnz},
+    {"find", 1, 1,  callFind},
+};
+
+const CBuiltin* CMathLib::find(const char* name)
+{
+    for (size_t i = 0; i < sizeof(s_Builtins)/sizeof(s_Builtins[0]); ++i)
+    {
+        if (strcmp(s_Builtins[i].name, name) == 0)
+            return &s_Builtins[i];
+    }
+    return NULL;
+}
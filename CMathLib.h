@@ -0,0 +1,89 @@
+#ifndef CMATHLIB_H
+#define CMATHLIB_H
+
+#include <cstddef>
+#include "CMatrix.h"
+#include "CExpr.h"
+
+#define MATH_PAR_MIN (1 << 16) //Elements from which the element-wise functions are split across threads
+
+//////////////////////////////////////////////////
+//      Struct CBuiltin                         //
+//////////////////////////////////////////////////
+
+/* A built-in function, as the Compiler finds it by name. call() computes the result from the nArgs argument values
+   into out, and returns NULL, or an error message if the arguments don't suit the function.
+*/
+struct CBuiltin
+{
+    const char* name;
+    int         minArgs;
+    int         maxArgs;    // -1 for any number
+    const char* (*call)(const CMatrix* const* args, int nArgs, CMatrix& out);
+};
+
+//////////////////////////////////////////////////
+//      Class CMathLib                          //
+//////////////////////////////////////////////////
+
+/* The built-in math functions. They all work element by element on matrices:
+
+        sin(x), cos(x)      ::: Within 2 ulp of the true value for |x| < 1e6. Beyond that, and for inf and NaN, the
+                                standard library is called for the elements concerned.
+        exp(x)              ::: Within 3 ulp (2 with fused multiply-adds). Overflows to inf above 709.78, and is 0
+                                below -745.13.
+        log(x), ln(x)       ::: Natural logarithm, within 2 ulp. -inf at 0, NaN below 0.
+        sqrt(x), abs(x)     ::: Exact (correctly rounded).
+        max(x), min(x)      ::: The largest or smallest element of x.
+        max(x, y, ...)      ::: The element-wise largest or smallest of any number of arguments. The arguments which
+        min(x, y, ...)          aren't scalars must all be the same size, and scalars are compared with every element.
+                                NaNs are ignored unless every value is NaN.
+        any(x), all(x)      ::: 1 if any element of x is nonzero (NaNs don't count), or if all of them are, else 0.
+        nnz(x)              ::: How many elements of x are nonzero (NaNs included).
+        find(x)             ::: The positions of the nonzero elements of x, counting from 1 along the rows. A row
+                                vector if x is one, otherwise a column.
+
+   sin, cos, exp and log are polynomial approximations after range reduction, computed several elements at a time in
+   SIMD registers, without branches. The bounds above were measured against the C library over millions of random
+   inputs. Inputs of MATH_PAR_MIN elements or more are split across threads.
+
+   The comparison operators (==, !=, <, >, <=, >=) are here as well, as are masked selections (a(mask)). Comparisons
+   give 1 where they hold and 0 elsewhere, without branches. A selection counts the elements it will take first, so
+   its result is allocated once at the right size, and it can compare as it goes instead of reading a mask: a(a > 0)
+   never makes the mask a > 0.
+
+   The kernels are public so they can be used on plain arrays as well. x and y may be the same array.
+*/
+class CMathLib
+{
+public:
+        // The built-in function with this name, or NULL.
+        static const CBuiltin*  find(const char* name);
+
+        static void sin(const double* x, double* y, size_t n);
+        static void cos(const double* x, double* y, size_t n);
+        static void exp(const double* x, double* y, size_t n);
+        static void log(const double* x, double* y, size_t n);
+        static void sqrt(const double* x, double* y, size_t n);
+        static void abs(const double* x, double* y, size_t n);
+
+        // y = (a op b) as 1s and 0s, for a comparison op. If aOne or bOne is set, that side is a single value which is
+        // compared with every element of the other.
+        static void     compare(OP op, const double* a, bool aOne, const double* b, bool bOne, double* y, size_t n);
+        // How many elements of a op b hold.
+        static size_t   count(OP op, const double* a, bool aOne, const double* b, bool bOne, size_t n);
+        // Copies x[i] into y for every i where a op b holds. y needs room for count() elements. If x is NULL, the
+        // positions (i + 1) are copied instead.
+        static void     select(const double* x, OP op, const double* a, bool aOne, const double* b, bool bOne,
+                               double* y, size_t n);
+
+        // The same for matrices, which must be the same size unless one is a single value. They return NULL, or an
+        // error message.
+        static const char*  compare(OP op, const CMatrix& a, const CMatrix& b, CMatrix& out);
+        // Takes the elements of x where a op b holds. The condition must be the same size as x.
+        static const char*  select(const CMatrix& x, OP op, const CMatrix& a, const CMatrix& b, CMatrix& out);
+
+        static bool     isComparison(OP op) { return op >= EQ && op <= GE; };
+};
+
+#endif // CMATHLIB_H
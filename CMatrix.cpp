@@ -1,14 +1,16 @@
 #include "CMatrix.h"
+#include "CFormatter.h"
+#include "CMemory.h"
 #include <iostream>
-#include <iomanip>
 #include <math.h>
 #include <vector>
 #include <cassert>
 
 using namespace std;
 
-//Define nullzero
-double CMatrix::nullzero = nan("");
+//What reading an element which isn't there gives. Writes to one go to a scratch element of the thread's own.
+static const double s_NaN = nan("");
+static thread_local double s_Scratch;
 
 CMatrix::CMatrix() : m_aData{0}
 {
@@ -19,13 +21,12 @@ CMatrix::CMatrix() : m_aData{0}
 void CMatrix::makeNullMatrix()
 {
     if (m_aData != 0)
-        delete [] m_aData;
+        CMemory::release(m_aData);
 
 	m_nRow = 0;
 	m_nCol = 0;
 	m_isNull = true;
 	m_aData = 0; //Null Pointer
-	CMatrix::nullzero = nan(""); //Set the NAN element in case anyone tries to print this.
 }
 
 //Allocate for a single double and assign the value of d.
@@ -34,7 +35,7 @@ CMatrix::CMatrix(double d) : m_aData{0}
 	m_nRow = 1;
 	m_nCol = 1;
 	m_isNull = false;
-	m_aData = new double[1] {};
+	m_aData = CMemory::allocate(1);
 	*m_aData = d;
 }
 
@@ -48,7 +49,7 @@ CMatrix::CMatrix(char* str) : m_aData{0}
     if ((elemNum = isValidMatrix(str)) > 0)
     {
         //Reserve new memory. Since we know the exact number of elements, we don't need to worry about knowing rows and columns yet.
-        m_aData = new double [elemNum] {}; //Initialize the new memory to zero.
+        m_aData = CMemory::allocate(elemNum, true); //Initialize the new memory to zero.
         m_isNull = false; //Obviously, since we are proceeding with this process, we won't have a null matrix (hopefully)
 
         //Declare some default variables.
@@ -131,10 +132,10 @@ CMatrix::CMatrix(double arr[], int nRow, int nCol) : m_aData{0}
         makeNullMatrix();
     else
     {
+        m_aData = CMemory::allocate((size_t)nRow * nCol);
         m_nRow = nRow;
         m_nCol = nCol;
         m_isNull = false;
-        m_aData = new double [nRow * nCol]  {}; //Initialize every element to zero (actually to double())
         for (int i = 0; i < nRow * nCol; ++i)
             m_aData[i] = arr[i];
     }
@@ -147,46 +148,75 @@ CMatrix::CMatrix(int nRow, int nCol) : m_aData{0}
         makeNullMatrix();
     else
     {
+        m_aData = CMemory::allocate((size_t)nRow * nCol, true); //Initialize every element to zero
         m_nRow = nRow;
         m_nCol = nCol;
         m_isNull = false;
-        m_aData = new double [nRow * nCol]  {}; //Initialize every element to zero (actually to double())
     }
 }
 
 //Copy constructor
-CMatrix::CMatrix(const CMatrix& m) : m_aData{0}
+CMatrix::CMatrix(const CMatrix& m) : m_nRow{0}, m_nCol{0}, m_isNull{true}, m_aData{0}
 {
     copy(m);
 }
 
+//Move constructor. Takes m's memory and leaves m a null matrix.
+CMatrix::CMatrix(CMatrix&& m) : m_nRow{0}, m_nCol{0}, m_isNull{true}, m_aData{0}
+{
+    swap(m);
+}
+
 //Destructor
 CMatrix::~CMatrix()
 {
     //If the matrix is not null (when it is null, no memory is allocated)
 	if (!m_isNull && m_aData != 0)
         //Then delete the allocated data.
-		delete [] m_aData;
+		CMemory::release(m_aData);
 	m_aData = 0; //Set to null, just for safety's sake;
 }
 
 void CMatrix::copy(const CMatrix& m)
 {
-    m_nRow = m.m_nRow;
-    m_nCol = m.m_nCol;
-    m_isNull = m.m_isNull;
-    double* newdata = new double [m_nRow * m_nCol]; //Allocate new memory for the copy.
+    if (&m == this)
+        return;
+
+    if (m.m_isNull)
+    {
+        makeNullMatrix();
+        return;
+    }
+
+    //Only allocate new memory for the copy if the number of elements changes.
+    reshape(m.m_nRow, m.m_nCol);
 
     //Copy the data
     for (int i = 0; i < m_nRow*m_nCol; ++i)
     {
-            newdata[i] = m.m_aData[i];
+            m_aData[i] = m.m_aData[i];
+    }
+}
+
+void CMatrix::reshape(int nRow, int nCol)
+{
+    if (nRow <= 0 || nCol <= 0)
+    {
+        makeNullMatrix();
+        return;
     }
 
-    if (m_aData != NULL)
-        delete [] m_aData;
+    // The new buffer is allocated first, so that if it can't be the matrix is left as it was.
+    if (m_isNull || m_nRow * m_nCol != nRow * nCol)
+    {
+        double* data = CMemory::allocate((size_t)nRow * nCol);
+        CMemory::release(m_aData);
+        m_aData = data;
+    }
 
-    m_aData = newdata;
+    m_nRow = nRow;
+    m_nCol = nCol;
+    m_isNull = false;
 }
 
 void CMatrix::swap(CMatrix &m)
@@ -228,7 +258,7 @@ void CMatrix::resize(int nRow, int nCol)
 	else
 	{
 		//Create a new matrix pointer to allocate the new memory to.
-		new_matrix = new double[nRow * nCol] {};
+		new_matrix = CMemory::allocate((size_t)nRow * nCol, true);
 
 		//Fill the new matrix will the elements from the old matrix.
 		short i, j;
@@ -252,7 +282,7 @@ void CMatrix::resize(int nRow, int nCol)
 	}
 
 	//Delete the old memory
-	delete [] m_aData;
+	CMemory::release(m_aData);
 	m_aData = 0; //Set to null for safety;
 
 	//Reassign pointers
@@ -274,8 +304,8 @@ double &CMatrix::element(int i, int j)
 		return m_aData[i*m_nCol+ j];
     else
     {
-        nullzero = nan("");
-        return nullzero; //Return NAN*/
+        s_Scratch = s_NaN;
+        return s_Scratch; //Return NAN
     }
 }
 
@@ -288,10 +318,7 @@ const double &CMatrix::element(int i, int j) const
 	  && !m_isNull)
 		return m_aData[i*m_nCol+ j];
     else
-    {
-        nullzero = nan("");
-        return nullzero; //Return NAN
-    }
+        return s_NaN;
 }
 
 //Access like an array, but with round brackets
@@ -305,66 +332,24 @@ const double& CMatrix::operator()(int i, int j) const
 	return this->element(i,j);
 }
 
-//Prints a matrix m to cout.
+//Prints a matrix m to out, wrapped in [ ] with lnstart at the beginning of every row but the first.
 void PrintMatrix( CMatrix& m, std::ostream& out, const std::string& lnstart, bool single_as_matrix)
 {
-    if (m.IsNull())
-        out << "\tnull matrix" << endl;
-    else if (m.IsSingle() && !single_as_matrix)
-        out << m.element(0,0);
-    else
-    {
-        int i,j,r,c;
-        r = m.getNRow();
-        c = m.getNCol();
-
-        left(out);
-        //out << endl;
-        for (i = 0; i < r; ++i)
-        {
-            if (i == 0)
-                out << '[';
-            else
-                out << lnstart; // Print the characters that go at the start of a line.
-
-            for (j = 0; j < c; ++j)
-            {
-                out << setw(6) << m.element(i,j); //Print the elements of the i^th row.
-            }
-            if (i == r-1)
-                out << setw(2) << ']';
-            out << endl; //Print a newline
-        }
-    }
-    //Initialize counters and bounds
+    //Each thread keeps its own formatter so the buffer is reused between calls.
+    thread_local CFormatter fmt;
 
+    fmt.setPrecision(out.precision());
+    fmt.addPrinted(m, lnstart, single_as_matrix);
+    fmt.write(out);
 }
 
 ostream& operator<<( ostream& out, const CMatrix& m)
 {
-    if (m.IsNull())
-        out << "\tnull matrix" << endl;
-    else if (m.IsSingle())
-        out << m.element(0,0);
-    else
-    {
-        int i,j,r,c;
-        r = m.getNRow();
-        c = m.getNCol();
-
-        left(out);
-        out << endl;
-        for (i = 0; i < r; ++i)
-        {
-            out << "\t\t"; // Print tab character
+    thread_local CFormatter fmt;
 
-            for (j = 0; j < c; ++j)
-            {
-                out << setw(6) << m.element(i,j); //Print the elements of the i^th row.
-            }
-            out << endl; //Print a newline
-        }
-    }
+    fmt.setPrecision(out.precision());
+    fmt.addMatrix(m);
+    fmt.write(out);
     return out;
 }
 
@@ -519,7 +504,7 @@ bool isADigit(char var)
 	}
 	const CMatrix& CMatrix::operator=(const double& k)
 	{
-	    resize(1,1);
+	    reshape(1,1);
 	    m_aData[0] = k;
 	    return *this;
 	}
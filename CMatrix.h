@@ -5,13 +5,14 @@
 
 #include <iostream>
 
+// A matrix of doubles, stored row after row. Like a standard container, a CMatrix may be read by any number of threads
+// at once, but one which is being changed must not be used by any other thread. Matrices share nothing with each other.
 class CMatrix
 {
 	int		m_nRow; // # of rows
 	int		m_nCol; // # of columns
 	bool 	m_isNull;
 	double	*m_aData;
-	static double nullzero;
 
 	void makeNullMatrix();
 
@@ -26,6 +27,7 @@ public:
     CMatrix(double arr[], int nRow, int nCol); // initializes a vector from an array.
 
 	CMatrix(const CMatrix& m); //Copy Constructor
+	CMatrix(CMatrix&& m); //Move Constructor, leaves m null
 
 	~CMatrix();
 
@@ -38,13 +40,18 @@ public:
 	void copy(const CMatrix& m); //copy matrix m to me
 
 	void resize(int nRow, int nCol);
+	void reshape(int nRow, int nCol); // like resize, but the elements are left undefined, and the storage is kept if the number of them doesn't change
 
 	// get
 	int	getNRow() const { return (m_isNull) ? 0 : m_nRow; } // return # of rows
 	int	getNCol() const { return (m_isNull) ? 0 : m_nCol; }// return # of columns
 	int Size() const { return (m_isNull) ? 0 : m_nRow*m_nCol; };
 
-	// return the element at i-th row and j-th column
+	// the elements, row after row (NULL for a null matrix)
+	double* data() { return m_aData; };
+	const double* data() const { return m_aData; };
+
+	// return the element at i-th row and j-th column, or NaN if there isn't one
 	double &element(int i, int j);
     const double &element(int i, int j) const;
 	double &operator() (int i, int j); //allows access to the i,j-th element of the matrix.
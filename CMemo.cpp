@@ -0,0 +1,72 @@
+#include "CMemo.h"
+
+using namespace std;
+
+CMemo::CMemo(size_t budget) : m_nBytes{0}, m_nBudget{budget}, m_nHits{0}, m_nMisses{0}, m_nEvictions{0}
+{}
+
+bool CMemo::find(const string& key, CMatrix& out)
+{
+    lock_guard<mutex> lock(m_Lock);
+
+    unordered_map<string, list<Entry>::iterator>::iterator it = m_Index.find(key);
+    if (it == m_Index.end())
+    {
+        ++m_nMisses;
+        return false;
+    }
+
+    //Move it to the front, since it was just used.
+    m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+    ++m_nHits;
+    out = it->second->value;
+    return true;
+}
+
+void CMemo::insert(const string& key, const CMatrix& value)
+{
+    size_t bytes = value.Size() * sizeof(double);
+
+    lock_guard<mutex> lock(m_Lock);
+
+    if (bytes > m_nBudget || m_Index.count(key) != 0)
+        return;
+
+    trim(m_nBudget - bytes);
+
+    m_Lru.push_front(Entry{key, value, bytes});
+    m_Index[key] = m_Lru.begin();
+    m_nBytes += bytes;
+}
+
+void CMemo::trim(size_t budget)
+{
+    while (m_nBytes > budget && !m_Lru.empty())
+    {
+        m_nBytes -= m_Lru.back().bytes;
+        m_Index.erase(m_Lru.back().key);
+        m_Lru.pop_back();
+        ++m_nEvictions;
+    }
+}
+
+void CMemo::clear()
+{
+    lock_guard<mutex> lock(m_Lock);
+
+    m_Lru.clear();
+    m_Index.clear();
+    m_nBytes = 0;
+    m_nHits = m_nMisses = m_nEvictions = 0;
+}
+
+void CMemo::report(ostream& out) const
+{
+    lock_guard<mutex> lock(m_Lock);
+
+    unsigned long lookups = m_nHits + m_nMisses;
+    out << "\tMemo cache: " << m_nHits << " hits, " << m_nMisses << " misses ("
+        << (lookups > 0 ? 100.0 * m_nHits / lookups : 0.0) << "% hit rate)\n"
+        << "\t            " << m_Lru.size() << " entries, " << m_nBytes << " of " << m_nBudget << " bytes, "
+        << m_nEvictions << " evicted\n\n";
+}
@@ -0,0 +1,57 @@
+#ifndef CMEMO_H
+#define CMEMO_H
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "CMatrix.h"
+
+#define MEMO_BUDGET (64 << 20) //Default number of bytes of results the memo cache may hold
+
+//////////////////////////////////////////////////
+//      Class CMemo                             //
+//////////////////////////////////////////////////
+
+/* A cache of subexpression results, so that an expensive expression like A*B which is calculated again before A or B
+   change can be looked up instead. Keys are built by Calc from the structure of the expression and the versions of
+   the variables in it (see Calc::MemoKey), so an entry can never be found again once one of its variables changes; it
+   just ages out.
+
+   The cache holds at most a budget of bytes of matrix data. When it would go over, the least recently used entries are
+   evicted until the new one fits. Results bigger than the whole budget are not kept. All of the methods are safe to
+   call from several threads at once.
+*/
+class CMemo
+{
+        struct Entry
+        {
+            std::string     key;
+            CMatrix         value;
+            size_t          bytes;
+        };
+
+        std::list<Entry>    m_Lru;      // most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> m_Index;
+        size_t              m_nBytes;   // bytes of matrix data held
+        size_t              m_nBudget;
+        unsigned long       m_nHits;
+        unsigned long       m_nMisses;
+        unsigned long       m_nEvictions;
+        mutable std::mutex  m_Lock;
+
+        void    trim(size_t budget);    // evicts entries until at most budget bytes are held
+
+public:
+        CMemo(size_t budget = MEMO_BUDGET);
+
+        // Copies the result stored under key into out and returns true, or returns false if there is none.
+        bool    find(const std::string& key, CMatrix& out);
+        void    insert(const std::string& key, const CMatrix& value);
+        void    clear();
+
+        // Prints the hit rate and what the cache holds.
+        void    report(std::ostream& out) const;
+};
+
+#endif // CMEMO_H
@@ -0,0 +1,113 @@
+#include "CMemory.h"
+#include "CError.h"
+#include "CProfile.h"
+#include <cstring>
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+struct Header
+{
+    CMemory*    account;
+    size_t      bytes;
+};
+static_assert(sizeof(Header) <= MEM_HEADER, "The header doesn't fit in front of the buffer");
+
+static thread_local CMemory* s_pCurrent = NULL;
+
+CMemory& CMemory::total()
+{
+    static CMemory s_Total;
+    return s_Total;
+}
+
+CMemory* CMemory::current()
+{
+    return s_pCurrent;
+}
+
+CMemory::Scope::Scope(CMemory* account) : m_pPrev{s_pCurrent}
+{
+    s_pCurrent = account;
+}
+
+CMemory::Scope::~Scope()
+{
+    s_pCurrent = m_pPrev;
+}
+
+bool CMemory::charge(long long bytes)
+{
+    long long live = m_nLive.fetch_add(bytes) + bytes;
+    long long quota = m_nQuota.load(memory_order_relaxed);
+    if (quota > 0 && live > quota)
+    {
+        m_nLive.fetch_sub(bytes);
+        return false;
+    }
+
+    ++m_nAllocs;
+    long long peak = m_nPeak.load(memory_order_relaxed);
+    while (live > peak && !m_nPeak.compare_exchange_weak(peak, live))
+        ;
+    return true;
+}
+
+void CMemory::credit(long long bytes)
+{
+    m_nLive.fetch_sub(bytes);
+}
+
+double* CMemory::allocate(size_t n, bool zero)
+{
+    if (n > (SIZE_MAX - MEM_HEADER) / sizeof(double))
+        throw CError("Out of memory: a matrix of " + to_string(n) + " elements is too big.", EMATRI, true);
+
+    size_t bytes = n * sizeof(double);
+    CMemory* account = s_pCurrent;
+    if (account != NULL && !account->charge(bytes))
+        throw CError("Out of memory: " + to_string(bytes) + " more bytes would take this session over its quota of "
+                     + to_string(account->quota()) + " bytes.", EMATRI, true);
+
+    char* raw;
+    try
+    {
+        raw = static_cast<char*>(::operator new(MEM_HEADER + bytes));
+    }
+    catch (const bad_alloc&)
+    {
+        if (account != NULL)
+            account->credit(bytes);
+        throw CError("Out of memory: cannot allocate " + to_string(bytes) + " bytes.", EMATRI, true);
+    }
+    total().charge(bytes);
+    CProfile* profile = CProfile::current();
+    if (profile != NULL)
+        profile->allocated(bytes);
+
+    Header* h = reinterpret_cast<Header*>(raw);
+    h->account = account;
+    h->bytes = bytes;
+
+    double* p = reinterpret_cast<double*>(raw + MEM_HEADER);
+    if (zero)
+        memset(p, 0, bytes);
+    return p;
+}
+
+void CMemory::release(double* p)
+{
+    if (p == NULL)
+        return;
+
+    char* raw = reinterpret_cast<char*>(p) - MEM_HEADER;
+    Header* h = reinterpret_cast<Header*>(raw);
+    if (h->account != NULL)
+        h->account->credit(h->bytes);
+    total().credit(h->bytes);
+    CProfile* profile = CProfile::current();
+    if (profile != NULL)
+        profile->freed(h->bytes);
+    ::operator delete(raw);
+}
@@ -0,0 +1,71 @@
+#ifndef CMEMORY_H
+#define CMEMORY_H
+
+#include <atomic>
+#include <cstddef>
+
+#define MEM_HEADER 16 //Bytes in front of every buffer, saying which account it was charged to and how big it is
+
+//////////////////////////////////////////////////
+//      Class CMemory                           //
+//////////////////////////////////////////////////
+
+/* Accounts for the memory held by matrices. Every CMatrix buffer comes from allocate() and goes back through
+   release(), and is charged to two accounts: total(), for the whole process, and the account of the calculator the
+   thread is working for, if any (see Scope). Each Calc has an account of its own, which its worker threads share, so
+   it covers the variables, temporaries and memo cache of one session.
+
+   An account counts the bytes it holds now (live), the most it has held (peak) and how many buffers it has been
+   charged for (allocs). If it has a quota, an allocation which would take it over throws a CError instead, and
+   nothing is allocated. So does running out of memory altogether. Calc turns the error into an ordinary error of
+   the statement, which leaves the session as it was.
+
+   A buffer is credited back to the account it was charged to, whichever thread frees it, so an account must outlive
+   every matrix charged to it. Matrices made while no account is current, such as statics, are only in total().
+
+   Accounts are safe to use from any thread.
+*/
+class CMemory
+{
+        std::atomic<long long>  m_nLive;
+        std::atomic<long long>  m_nPeak;
+        std::atomic<long long>  m_nAllocs;
+        std::atomic<long long>  m_nQuota;   // 0 for none
+
+        bool    charge(long long bytes);    // false, with nothing charged, if bytes would take us over the quota
+        void    credit(long long bytes);
+
+public:
+        CMemory() : m_nLive{0}, m_nPeak{0}, m_nAllocs{0}, m_nQuota{0} {};
+
+        CMemory(const CMemory&) = delete;
+        CMemory& operator=(const CMemory&) = delete;
+
+        // A buffer for n doubles, zeroed if asked, charged to the current account and total(). Throws a CError if an
+        // account is over its quota or there is no memory.
+        static double*  allocate(size_t n, bool zero = false);
+        static void     release(double* p);
+
+        static CMemory& total();
+        static CMemory* current();
+
+        // Makes account the current one for this thread until the Scope goes away. NULL for none.
+        class Scope
+        {
+                CMemory*    m_pPrev;
+        public:
+                explicit Scope(CMemory* account);
+                ~Scope();
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+        };
+
+        long long   live() const { return m_nLive; };
+        long long   peak() const { return m_nPeak; };
+        long long   allocs() const { return m_nAllocs; };
+        long long   quota() const { return m_nQuota; };
+        void        setQuota(long long bytes) { m_nQuota = (bytes > 0) ? bytes : 0; };
+        void        resetPeak() { m_nPeak = m_nLive.load(); };
+};
+
+#endif // CMEMORY_H
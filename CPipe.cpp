@@ -0,0 +1,544 @@
+#include "CPipe.h"
+#include "Calc.h"
+#include "CStats.h"
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+struct Request
+{
+    string      id;         // as it was written, or "null"
+    string      expr;
+    string      err;        // why the line isn't a request, if it isn't
+    uint64_t    read;       // when it was read
+};
+
+struct Reply
+{
+    string      id;
+    bool        ok;
+    string      name;
+    CMatrix     value;
+    string      output;
+    string      err;
+    uint64_t    read, started, done;
+};
+
+// Hands items from one stage to the next. pop() takes everything waiting at once, so a busy stage takes the lock once
+// a batch rather than once an item.
+template <class T>
+class Queue
+{
+        deque<T>            m_Items;
+        mutex               m_Lock;
+        condition_variable  m_NotEmpty;
+        condition_variable  m_NotFull;
+        bool                m_bClosed = false;
+
+public:
+        void    push(T&& item)
+        {
+            unique_lock<mutex> lock(m_Lock);
+            m_NotFull.wait(lock, [this]{ return m_Items.size() < PIPE_DEPTH; });
+            m_Items.push_back(move(item));
+            if (m_Items.size() == 1)
+                m_NotEmpty.notify_one();
+        }
+
+        // No more items will come.
+        void    close()
+        {
+            lock_guard<mutex> lock(m_Lock);
+            m_bClosed = true;
+            m_NotEmpty.notify_one();
+        }
+
+        // Waits for items and moves them all into the empty batch. False once the queue is closed and empty.
+        bool    pop(deque<T>& batch)
+        {
+            unique_lock<mutex> lock(m_Lock);
+            m_NotEmpty.wait(lock, [this]{ return !m_Items.empty() || m_bClosed; });
+            if (m_Items.empty())
+                return false;
+            batch.swap(m_Items);
+            m_NotFull.notify_all();
+            return true;
+        }
+};
+
+// Points a calculator's output somewhere else until it goes away, when the output goes back where it was.
+class SinkScope
+{
+        Calc&       m_Calc;
+        ostream&    m_Prev;
+
+public:
+        SinkScope(Calc& calc, ostream& out) : m_Calc(calc), m_Prev(calc.sink()) { calc.setSink(out); };
+        ~SinkScope() { m_Calc.setSink(m_Prev); };
+
+        SinkScope(const SinkScope&) = delete;
+        SinkScope& operator=(const SinkScope&) = delete;
+};
+
+/*** Decoding ***/
+
+static void skipSpace(const string& s, size_t& at)
+{
+    while (at < s.size() && (s[at] == ' ' || s[at] == '\t' || s[at] == '\r' || s[at] == '\n'))
+        ++at;
+}
+
+static void putUtf8(string& out, unsigned c)
+{
+    if (c < 0x80)
+        out += char(c);
+    else if (c < 0x800)
+    {
+        out += char(0xC0 | (c >> 6));
+        out += char(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        out += char(0xE0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3F));
+        out += char(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        out += char(0xF0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3F));
+        out += char(0x80 | ((c >> 6) & 0x3F));
+        out += char(0x80 | (c & 0x3F));
+    }
+}
+
+static bool hex4(const string& s, size_t at, unsigned& c)
+{
+    if (at + 4 > s.size())
+        return false;
+    c = 0;
+    for (size_t i = at; i < at + 4; ++i)
+    {
+        int d = isdigit((unsigned char)s[i]) ? s[i] - '0' : (tolower(s[i]) >= 'a' && tolower(s[i]) <= 'f') ? tolower(s[i]) - 'a' + 10 : -1;
+        if (d < 0)
+            return false;
+        c = c * 16 + d;
+    }
+    return true;
+}
+
+// Reads the string starting at the quote at s[at] into out, leaving at after its closing quote.
+static bool readString(const string& s, size_t& at, string& out)
+{
+    out.clear();
+    for (++at; at < s.size(); ++at)
+    {
+        char c = s[at];
+        if (c == '"')
+        {
+            ++at;
+            return true;
+        }
+        if (c != '\\')
+        {
+            out += c;
+            continue;
+        }
+        if (++at >= s.size())
+            return false;
+        switch (s[at])
+        {
+        case '"':   out += '"';     break;
+        case '\\':  out += '\\';    break;
+        case '/':   out += '/';     break;
+        case 'b':   out += '\b';    break;
+        case 'f':   out += '\f';    break;
+        case 'n':   out += '\n';    break;
+        case 'r':   out += '\r';    break;
+        case 't':   out += '\t';    break;
+        case 'u': {
+            unsigned u, low;
+            if (!hex4(s, at + 1, u))
+                return false;
+            at += 4;
+            // A pair of surrogates is one character.
+            if (u >= 0xD800 && u < 0xDC00 && at + 2 < s.size() && s[at+1] == '\\' && s[at+2] == 'u'
+                && hex4(s, at + 3, low) && low >= 0xDC00 && low < 0xE000)
+            {
+                u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+                at += 6;
+            }
+            putUtf8(out, u);
+            break; }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool skipDigits(const string& s, size_t& at)
+{
+    size_t st = at;
+    while (at < s.size() && isdigit((unsigned char)s[at]))
+        ++at;
+    return at > st;
+}
+
+// Steps over the number starting at s[at]: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool skipNumber(const string& s, size_t& at)
+{
+    if (at < s.size() && s[at] == '-')
+        ++at;
+    if (at < s.size() && s[at] == '0')
+        ++at;
+    else if (!skipDigits(s, at))
+        return false;
+    if (at < s.size() && s[at] == '.' && !skipDigits(s, ++at))
+        return false;
+    if (at < s.size() && (s[at] == 'e' || s[at] == 'E'))
+    {
+        ++at;
+        if (at < s.size() && (s[at] == '+' || s[at] == '-'))
+            ++at;
+        if (!skipDigits(s, at))
+            return false;
+    }
+    return true;
+}
+
+// Steps over the value starting at s[at], of any type, checking that it is valid JSON, so that it can be sent back as
+// it was. Arrays and objects may hold others up to PIPE_NEST deep.
+static bool skipValue(const string& s, size_t& at, int depth = 0)
+{
+    if (at >= s.size())
+        return false;
+
+    string str;
+    char c = s[at];
+    size_t st = at;
+    if (c == '"')
+    {
+        // JSON doesn't allow control characters in a string unless they are escaped.
+        if (!readString(s, at, str))
+            return false;
+        for (size_t i = st; i < at; ++i)
+        {
+            if ((unsigned char)s[i] < 0x20)
+                return false;
+        }
+        return true;
+    }
+    if (c == '-' || isdigit((unsigned char)c))
+        return skipNumber(s, at);
+    if (c != '[' && c != '{')
+    {
+        static const char* words[] = {"true", "false", "null"};
+        for (const char* w : words)
+        {
+            if (s.compare(at, strlen(w), w) == 0)
+            {
+                at += strlen(w);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // An array or an object, which has to be closed by the bracket which matches its own.
+    if (depth >= PIPE_NEST)
+        return false;
+    char close = (c == '[') ? ']' : '}';
+    ++at;
+    skipSpace(s, at);
+    if (at < s.size() && s[at] == close)
+    {
+        ++at;
+        return true;
+    }
+    while (true)
+    {
+        if (c == '{')
+        {
+            if (at >= s.size() || s[at] != '"' || !readString(s, at, str))
+                return false;
+            skipSpace(s, at);
+            if (at >= s.size() || s[at] != ':')
+                return false;
+            ++at;
+            skipSpace(s, at);
+        }
+        if (!skipValue(s, at, depth + 1))
+            return false;
+        skipSpace(s, at);
+        if (at >= s.size())
+            return false;
+        if (s[at] == close)
+        {
+            ++at;
+            return true;
+        }
+        if (s[at] != ',')
+            return false;
+        ++at;
+        skipSpace(s, at);
+    }
+}
+
+// Takes the id and expr out of a request. Other members are ignored.
+static bool decode(const string& line, Request& req)
+{
+    size_t at = 0;
+    bool   hasExpr = false;
+    req.id = "null";
+
+    skipSpace(line, at);
+    if (at >= line.size() || line[at] != '{')
+    {
+        req.err = "A request must be a JSON object, such as {\"id\": 1, \"expr\": \"x = 2\"}.";
+        return false;
+    }
+    ++at;
+    skipSpace(line, at);
+
+    string key;
+    while (at < line.size() && line[at] != '}')
+    {
+        if (line[at] != '"' || !readString(line, at, key))
+            break;
+        skipSpace(line, at);
+        if (at >= line.size() || line[at] != ':')
+            break;
+        ++at;
+        skipSpace(line, at);
+
+        size_t st = at;
+        if (key == "expr")
+        {
+            if (at >= line.size() || line[at] != '"')
+            {
+                req.err = "expr must be a string.";
+                return false;
+            }
+            if (!readString(line, at, req.expr))
+                break;
+            hasExpr = true;
+        }
+        else if (!skipValue(line, at))
+        {
+            if (key == "id")
+            {
+                req.err = "id must be a JSON value.";
+                return false;
+            }
+            break;
+        }
+        else if (key == "id")
+            req.id = line.substr(st, at - st);
+
+        skipSpace(line, at);
+        if (at < line.size() && line[at] == ',')
+        {
+            ++at;
+            skipSpace(line, at);
+        }
+        else if (at >= line.size() || line[at] != '}')
+            break;
+    }
+
+    // The id of a request which isn't valid JSON can't be trusted to be what was meant.
+    size_t last = at + 1;
+    skipSpace(line, last);
+    if (at >= line.size() || line[at] != '}' || last < line.size())
+    {
+        req.id = "null";
+        req.err = "The request is not valid JSON.";
+    }
+    else if (!hasExpr)
+        req.err = "The request has no expr.";
+    else if (req.expr.find('\n') != string::npos)
+        req.err = "expr must be a single line.";
+    return req.err.empty();
+}
+
+/*** Encoding ***/
+
+static void putString(string& out, const string& s)
+{
+    out += '"';
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':   out += "\\\"";  break;
+        case '\\':  out += "\\\\";  break;
+        case '\n':  out += "\\n";   break;
+        case '\r':  out += "\\r";   break;
+        case '\t':  out += "\\t";   break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            }
+            else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+static void putNumber(string& out, double d)
+{
+    if (!isfinite(d))
+    {
+        out += "null";
+        return;
+    }
+    char buf[32];
+    to_chars_result r = to_chars(buf, buf + sizeof(buf), d);
+    out.append(buf, r.ptr);
+}
+
+static void putMicros(string& out, uint64_t ns)
+{
+    char buf[32];
+    to_chars_result r = to_chars(buf, buf + sizeof(buf), ns / 1000.0, chars_format::fixed, 1);
+    out.append(buf, r.ptr);
+}
+
+static void encode(const Reply& r, string& out)
+{
+    out += "{\"id\":";
+    out += r.id;
+    out += r.ok ? ",\"ok\":true" : ",\"ok\":false";
+    if (!r.ok)
+    {
+        out += ",\"error\":";
+        putString(out, r.err);
+    }
+    else
+    {
+        if (!r.name.empty())
+        {
+            int rows = r.value.getNRow(), cols = r.value.getNCol();
+            out += ",\"name\":";
+            putString(out, r.name);
+            out += ",\"shape\":[" + to_string(rows) + "," + to_string(cols) + "]";
+            if (r.value.IsSingle())
+            {
+                out += ",\"value\":";
+                putNumber(out, r.value.data()[0]);
+            }
+            out += ",\"data\":[";
+            for (int i = 0; i < r.value.Size(); ++i)
+            {
+                if (i > 0)
+                    out += ',';
+                putNumber(out, r.value.data()[i]);
+            }
+            out += ']';
+        }
+        if (!r.output.empty())
+        {
+            out += ",\"output\":";
+            putString(out, r.output);
+        }
+    }
+
+    out += ",\"timings\":{\"queue_us\":";
+    putMicros(out, r.started - r.read);
+    out += ",\"eval_us\":";
+    putMicros(out, r.done - r.started);
+    out += ",\"total_us\":";
+    putMicros(out, CStats::now() - r.read);
+    out += "}}\n";
+}
+
+/*** The stages ***/
+
+long CPipe::run()
+{
+    Queue<Request>  requests;
+    Queue<Reply>    replies;
+    long            answered = 0;
+
+    // Reads and decodes.
+    thread reader([this, &requests]
+    {
+        string line;
+        while (getline(m_In, line))
+        {
+            if (line.find_first_not_of(" \t\r") == string::npos)
+                continue;
+            Request req;
+            req.read = CStats::now();
+            decode(line, req);
+            requests.push(move(req));
+        }
+        requests.close();
+    });
+
+    // Writes what the calculator has done, a batch at a time.
+    thread writer([this, &replies, &answered]
+    {
+        deque<Reply> batch;
+        string out;
+        while (replies.pop(batch))
+        {
+            for (size_t i = 0; i < batch.size(); ++i)
+                encode(batch[i], out);
+            answered += batch.size();
+            batch.clear();
+            m_Out.write(out.data(), out.size());
+            m_Out.flush();
+            out.clear();
+        }
+    });
+
+    // Runs the statements here, in order.
+    ostringstream text;
+    SinkScope sink(m_Calc, text);
+    deque<Request> batch;
+    while (requests.pop(batch))
+    {
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            Request& req = batch[i];
+            Reply rep;
+            rep.id = move(req.id);
+            rep.read = req.read;
+            rep.started = CStats::now();
+            if (!req.err.empty())
+            {
+                rep.ok = false;
+                rep.err = move(req.err);
+            }
+            else
+            {
+                text.str("");
+                rep.ok = m_Calc.evaluate(req.expr, rep.name, rep.value, rep.err);
+                if (rep.ok)
+                    rep.output = text.str();
+            }
+            rep.done = CStats::now();
+            replies.push(move(rep));
+        }
+        batch.clear();
+    }
+    replies.close();
+
+    reader.join();
+    writer.join();
+    return answered;
+}
@@ -0,0 +1,54 @@
+#ifndef CPIPE_H
+#define CPIPE_H
+
+#include <iostream>
+#include <string>
+
+#define PIPE_DEPTH  4096    //Requests each stage can have waiting for the next one
+#define PIPE_NEST   64      //How deep arrays and objects in a request may go
+
+class Calc;
+
+//////////////////////////////////////////////////
+//      Class CPipe                             //
+//////////////////////////////////////////////////
+
+/* The calculator driven by another program, with newline-delimited JSON both ways. Every line read is a request,
+
+        {"id": 17, "expr": "A = B*C"}
+
+   and gets one line back, in the order the requests came in:
+
+        {"id":17,"ok":true,"name":"A","shape":[2,2],"data":[1,2,3,4],"timings":{"queue_us":3.1,"eval_us":1.2,"total_us":9.8}}
+        {"id":18,"ok":false,"error":"Unknown quantity \"D\". Type \"who\" to list variables.","timings":{...}}
+
+   id can be any JSON value, and is sent back as it was (null if there was none, or if the request isn't valid JSON,
+   which gets an error). Arrays and objects in it may nest PIPE_NEST deep. data holds the elements row after
+   row, each in the shortest form which reads back as the same double, and a 1x1 result has its number in "value" as
+   well. JSON has no infinities or NaN, so those are null. A line which shows no variable (a command, or a line of a
+   loop before its end) has no name, shape or data, and whatever a command printed is in "output". timings are in
+   microseconds: queue_us waiting for the calculator, eval_us running the statement, and total_us from reading the
+   request to writing out its response. A line which isn't a request gets an error; blank lines are skipped.
+
+   Each stage has a thread of its own: one reads and decodes requests, one runs them through the Calc in order, and
+   one encodes and writes the responses, flushing only when it has nothing more ready. Up to PIPE_DEPTH requests wait
+   between each stage and the next, so a program can keep thousands in flight, and the calculator never waits on
+   either pipe while it has work. After "quit", every request left gets an error.
+*/
+class CPipe
+{
+        std::istream&   m_In;
+        std::ostream&   m_Out;
+        Calc&           m_Calc;
+
+public:
+        CPipe(std::istream& in, std::ostream& out, Calc& calc) : m_In(in), m_Out(out), m_Calc(calc) {};
+
+        CPipe(const CPipe&) = delete;
+        CPipe& operator=(const CPipe&) = delete;
+
+        // Answers requests until the input ends. Returns how many were answered.
+        long    run();
+};
+
+#endif // CPIPE_H
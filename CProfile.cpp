@@ -0,0 +1,92 @@
+#include "CProfile.h"
+#include "CKernel.h"
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+using namespace std;
+
+void CProfile::end(const string& stmt)
+{
+    Entry& e = m_Stmts[stmt];
+    ++e.runs;
+    e.counts.add(m_Stmt);
+    ++m_nStatements;
+    m_Stmt = Counts();
+}
+
+void CProfile::merge(const CProfile& other)
+{
+    for (int a = 0; a < NAREAS; ++a)
+        m_Areas[a].add(other.m_Areas[a]);
+    for (map<string, Entry>::const_iterator it = other.m_Stmts.begin(); it != other.m_Stmts.end(); ++it)
+    {
+        Entry& e = m_Stmts[it->first];
+        e.runs += it->second.runs;
+        e.counts.add(it->second.counts);
+    }
+    m_nStatements += other.m_nStatements;
+}
+
+void CProfile::reset()
+{
+    for (int a = 0; a < NAREAS; ++a)
+        m_Areas[a] = Counts();
+    m_Stmts.clear();
+    m_nStatements = 0;
+}
+
+static void row(ostream& out, const string& name, const CProfile::Counts& c)
+{
+    out << setw(12) << c.allocs << setw(12) << c.frees << setw(14) << c.bytes << setw(14) << c.freed << "  " << name << '\n';
+}
+
+void CProfile::report(ostream& out) const
+{
+    Counts all;
+    for (int a = 0; a < NAREAS; ++a)
+        all.add(m_Areas[a]);
+
+    out << "\t" << m_nStatements << " statements profiled" << (m_bOn ? "" : ", and paused") << ": " << all.allocs
+        << " allocations of " << all.bytes << " bytes, " << all.frees << " frees of " << all.freed << " bytes.\n";
+    if (all.allocs == 0 && all.frees == 0)
+    {
+        out << '\n';
+        return;
+    }
+
+    out << "\t" << setw(12) << "allocs" << setw(12) << "frees" << setw(14) << "bytes" << setw(14) << "freed" << "  where\n";
+    for (int op = 0; op < NULLOP; ++op)
+    {
+        if (m_Areas[op].allocs > 0 || m_Areas[op].frees > 0)
+            row(out << '\t', string("Operator ") + CKernel::symbol(OP(op)), m_Areas[op]);
+    }
+    row(out << '\t', "Tokenizer", m_Areas[PTOKENS]);
+    row(out << '\t', "Elsewhere", m_Areas[POTHER]);
+
+    // The statements which allocated the most bytes, and then the most times.
+    vector<map<string, Entry>::const_iterator> ranked;
+    for (map<string, Entry>::const_iterator it = m_Stmts.begin(); it != m_Stmts.end(); ++it)
+        ranked.push_back(it);
+    size_t top = min(ranked.size(), size_t(PROFILE_TOP));
+    partial_sort(ranked.begin(), ranked.begin() + top, ranked.end(),
+        [](map<string, Entry>::const_iterator a, map<string, Entry>::const_iterator b)
+        {
+            if (a->second.counts.bytes != b->second.counts.bytes)
+                return a->second.counts.bytes > b->second.counts.bytes;
+            return a->second.counts.allocs > b->second.counts.allocs;
+        });
+
+    out << "\n\t" << setw(8) << "runs" << setw(12) << "allocs" << setw(12) << "frees" << setw(14) << "bytes"
+        << setw(14) << "bytes/run" << "  statement\n";
+    for (size_t i = 0; i < top; ++i)
+    {
+        const Entry& e = ranked[i]->second;
+        string text = ranked[i]->first;
+        if (text.size() > PROFILE_WIDTH)
+            text = text.substr(0, PROFILE_WIDTH - 3) + "...";
+        out << '\t' << setw(8) << e.runs << setw(12) << e.counts.allocs << setw(12) << e.counts.frees << setw(14)
+            << e.counts.bytes << setw(14) << e.counts.bytes / e.runs << "  " << text << '\n';
+    }
+    out << '\n';
+}
@@ -0,0 +1,138 @@
+#ifndef CPROFILE_H
+#define CPROFILE_H
+
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <string>
+#include "CExpr.h"
+
+#define PROFILE_TOP     10      //Statements in the report
+#define PROFILE_WIDTH   60      //Characters of a statement shown in the report
+
+// Where an allocation happened: in one of the operators (OP), in the tokenizer, or anywhere else.
+enum PROFAREA {PTOKENS = NULLOP, POTHER, NAREAS};
+
+//////////////////////////////////////////////////
+//      Class CProfile                          //
+//////////////////////////////////////////////////
+
+/* Where the heap traffic of a calculator comes from. Every matrix buffer (CMemory::allocate and release) and every
+   word, matrix and part the tokenizer makes or frees is counted, with its bytes, against the statement running and
+   the area of the code it happened in:
+
+        an OP       ::: Running the kernel of that operator, its result included.
+        PTOKENS     ::: The Partitioner and the Converter, and freeing the parts of the statement before.
+        POTHER      ::: Everything else: copying into variables, temporaries of functions and indexing, the memo
+                        cache, spilling...
+
+   Statements are kept by their text, so a line which runs many times (or a loop, under the text of its first line)
+   adds up into one entry, and report() ranks them by the bytes they allocated.
+
+   The hooks find the profile through current(), which Scope sets for the thread while a statement is profiled. When
+   nothing is being profiled it is NULL, and a hook costs a test of it and nothing else. A calculator without a
+   profile has no CProfile at all; pausing one keeps what it has counted.
+
+   Not thread-safe: each worker of a calculator running on several threads has its own, and merge() adds them up.
+*/
+class CProfile
+{
+public:
+        struct Counts
+        {
+            long long   allocs;
+            long long   frees;
+            long long   bytes;      // allocated
+            long long   freed;
+
+            Counts() : allocs{0}, frees{0}, bytes{0}, freed{0} {};
+            void add(const Counts& c) { allocs += c.allocs; frees += c.frees; bytes += c.bytes; freed += c.freed; };
+        };
+
+private:
+        struct Entry
+        {
+            long long   runs;
+            Counts      counts;
+            Entry() : runs{0} {};
+        };
+
+        Counts          m_Areas[NAREAS];
+        Counts          m_Stmt;         // of the statement running
+        std::map<std::string, Entry>    m_Stmts;
+        long long       m_nStatements;
+        int             m_nArea;        // PROFAREA, or the OP running
+        bool            m_bOn;          // false while paused
+
+        static inline thread_local CProfile*    s_pCurrent = NULL;  // constant, so reading it needs no call
+
+public:
+        CProfile() : m_nStatements{0}, m_nArea{POTHER}, m_bOn{true} {};
+
+        // The profile counting for this thread, or NULL.
+        static CProfile* current() { return s_pCurrent; };
+
+        void    allocated(size_t bytes)
+        {
+            Counts& area = m_Areas[m_nArea];
+            ++area.allocs;
+            area.bytes += bytes;
+            ++m_Stmt.allocs;
+            m_Stmt.bytes += bytes;
+        };
+        void    freed(size_t bytes)
+        {
+            Counts& area = m_Areas[m_nArea];
+            ++area.frees;
+            area.freed += bytes;
+            ++m_Stmt.frees;
+            m_Stmt.freed += bytes;
+        };
+
+        // A statement starts, and ends with the text it is to be counted under.
+        void    begin() { m_Stmt = Counts(); };
+        void    end(const std::string& stmt);
+        // What the statement running has done so far.
+        const Counts&   statement() const { return m_Stmt; };
+
+        // Makes profile the current one for this thread until the Scope goes away. NULL for none.
+        class Scope
+        {
+                CProfile*   m_pPrev;
+        public:
+                explicit Scope(CProfile* profile) : m_pPrev{s_pCurrent} { s_pCurrent = profile; };
+                ~Scope() { s_pCurrent = m_pPrev; };
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+        };
+
+        // Counts what happens while it is alive against area (a PROFAREA or an OP). Does nothing for a NULL profile.
+        class Area
+        {
+                CProfile*   m_pProfile;
+                int         m_nPrev;
+        public:
+                Area(CProfile* profile, int area) : m_pProfile{profile}, m_nPrev{POTHER}
+                {
+                    if (profile != NULL)
+                    {
+                        m_nPrev = profile->m_nArea;
+                        profile->m_nArea = area;
+                    }
+                };
+                ~Area() { if (m_pProfile != NULL) m_pProfile->m_nArea = m_nPrev; };
+                Area(const Area&) = delete;
+                Area& operator=(const Area&) = delete;
+        };
+
+        void    pause(bool paused) { m_bOn = !paused; };
+        bool    isOn() const { return m_bOn; };
+        void    merge(const CProfile& other);
+        void    reset();
+
+        // Prints the totals, the counts of every area which has any, and the PROFILE_TOP statements which allocated
+        // the most bytes.
+        void    report(std::ostream& out) const;
+};
+
+#endif // CPROFILE_H
@@ -0,0 +1,404 @@
+#include "CServer.h"
+#include "Calc.h"
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+struct CServer::Session
+{
+    int             fd;
+    Calc            calc;
+    ostringstream   out;        // what calc prints, taken by the event loop when the worker is done
+    string          in;         // what has been read since the last complete line
+    deque<string>   queued;     // complete lines waiting for a worker
+    vector<string>  running;    // the lines the worker has
+    string          pending;    // output still to be written
+    size_t          sent;       // how much of pending has been written
+    int             events;     // what epoll is waiting for, or -1 if it isn't watching the socket
+    bool            busy;       // a worker has the session
+    bool            eof;        // the client has stopped sending
+    bool            quit;       // the session ran "quit"
+    bool            broken;     // the socket failed, so nothing more can be written
+    bool            overlong;   // the client sent a line longer than SERVER_LINE
+
+    Session(int f, long long quota) : fd{f}, sent{0}, events{-1}, busy{false}, eof{false}, quit{false}, broken{false},
+        overlong{false}
+    {
+        calc.setSink(out);
+        calc.setQuota(quota);
+    }
+
+    // Has as much waiting as it may, so nothing more is read until some of it goes.
+    bool    full() const { return queued.size() >= SERVER_QUEUE || pending.size() - sent >= SERVER_PENDING; }
+};
+
+CServer::CServer(const string& path, int nThreads, long long quota, long long budget, const string& spill) : m_sPath{path},
+    m_nThreads{nThreads}, m_nQuota{quota}, m_nBudget{budget}, m_sSpill{spill.empty() ? path + ".spill" : spill}, m_nSessions{0},
+    m_nListen{-1}, m_nEpoll{-1}, m_nWake{-1}, m_bStop{false}
+{}
+
+#ifdef __linux__
+
+CServer::~CServer()
+{
+    for (auto& it : m_Sessions)
+    {
+        ::close(it.first);
+        delete it.second;
+    }
+    if (m_nListen >= 0)
+    {
+        ::close(m_nListen);
+        unlink(m_sPath.c_str());
+    }
+    if (m_nEpoll >= 0)
+        ::close(m_nEpoll);
+    if (m_nWake >= 0)
+        ::close(m_nWake);
+}
+
+void CServer::stop()
+{
+    m_bStop = true;
+    if (m_nWake >= 0)
+    {
+        uint64_t one = 1;
+        if (::write(m_nWake, &one, sizeof(one)) < 0)
+            return; // the loop is already awake
+    }
+}
+
+bool CServer::listen(string& err)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (m_sPath.empty() || m_sPath.size() >= sizeof(addr.sun_path))
+    {
+        err = "The socket path must be 1 to " + to_string(sizeof(addr.sun_path) - 1) + " characters long.";
+        return false;
+    }
+    memcpy(addr.sun_path, m_sPath.c_str(), m_sPath.size());
+
+    // A socket left behind by a server which didn't stop cleanly is in the way, but nothing else may be.
+    struct stat st;
+    if (lstat(m_sPath.c_str(), &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            err = m_sPath + " already exists.";
+            return false;
+        }
+        unlink(m_sPath.c_str());
+    }
+
+    m_nListen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_nListen < 0 || bind(m_nListen, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(m_nListen, SERVER_BACKLOG) != 0)
+    {
+        err = "Cannot listen on " + m_sPath + ": " + strerror(errno) + ".";
+        if (m_nListen >= 0)
+            ::close(m_nListen);
+        m_nListen = -1;
+        return false;
+    }
+
+    m_nEpoll = epoll_create1(EPOLL_CLOEXEC);
+    m_nWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_nEpoll < 0 || m_nWake < 0)
+    {
+        err = string("Cannot start the event loop: ") + strerror(errno) + ".";
+        return false;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = m_nListen;
+    epoll_ctl(m_nEpoll, EPOLL_CTL_ADD, m_nListen, &ev);
+    ev.data.fd = m_nWake;
+    epoll_ctl(m_nEpoll, EPOLL_CTL_ADD, m_nWake, &ev);
+    return true;
+}
+
+bool CServer::run(string& err)
+{
+    if (!listen(err))
+        return false;
+
+    {
+        CThreadPool pool(m_nThreads);
+        epoll_event events[64];
+
+        while (!m_bStop)
+        {
+            int n = epoll_wait(m_nEpoll, events, 64, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                err = string("The event loop failed: ") + strerror(errno) + ".";
+                m_bStop = true;
+                break;
+            }
+
+            for (int i = 0; i < n; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == m_nListen)
+                    accept();
+                else if (fd == m_nWake)
+                {
+                    uint64_t count;
+                    if (::read(m_nWake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                        continue;
+
+                    vector<Session*> done;
+                    {
+                        lock_guard<mutex> lock(m_Lock);
+                        done.swap(m_Done);
+                    }
+                    for (size_t j = 0; j < done.size(); ++j)
+                    {
+                        Session* s = done[j];
+                        s->busy = false;
+                        s->running.clear();
+                        s->pending += s->out.str();
+                        s->out.str("");
+                        if (s->quit)
+                        {
+                            s->queued.clear();
+                            s->eof = true;
+                            s->overlong = false;
+                        }
+                        write(s);
+                        settle(s, pool);
+                    }
+                }
+                else
+                {
+                    // The socket may have been closed, or even reused, earlier in this round.
+                    auto it = m_Sessions.find(fd);
+                    if (it == m_Sessions.end())
+                        continue;
+
+                    Session* s = it->second;
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                        read(s);
+                    if (events[i].events & EPOLLOUT)
+                        write(s);
+                    settle(s, pool);
+                }
+            }
+        }
+        // The pool finishes what the workers have before going away.
+    }
+
+    for (auto& it : m_Sessions)
+    {
+        ::close(it.first);
+        delete it.second;
+    }
+    m_Sessions.clear();
+    m_Done.clear();
+    return err.empty();
+}
+
+void CServer::accept()
+{
+    while (true)
+    {
+        int fd = accept4(m_nListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        Session* s = new Session(fd, m_nQuota);
+        ++m_nSessions;
+        if (m_nBudget > 0)
+            s->calc.setBudget(m_nBudget, m_sSpill + "." + to_string(m_nSessions));
+        m_Sessions[fd] = s;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(m_nEpoll, EPOLL_CTL_ADD, fd, &ev);
+        s->events = EPOLLIN;
+    }
+}
+
+void CServer::read(Session* s)
+{
+    char buf[SERVER_READ];
+    while (!s->eof && !s->full())
+    {
+        ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                s->eof = true;
+                s->broken = true;
+            }
+            break;
+        }
+        if (n == 0)
+        {
+            s->eof = true;
+            break;
+        }
+
+        // Split what came in into lines, keeping any part of a line for next time.
+        const char* chr = buf;
+        const char* end = buf + n;
+        while (chr < end)
+        {
+            const char* eol = static_cast<const char*>(memchr(chr, '\n', end - chr));
+            s->in.append(chr, (eol == NULL) ? end : eol);
+            if (s->in.size() > SERVER_LINE)
+            {
+                // Nothing after it can be trusted to be a line of its own, so the session ends here.
+                s->in.clear();
+                s->eof = true;
+                s->overlong = true;
+                break;
+            }
+            if (eol == NULL)
+                break;
+            s->queued.push_back(string());
+            s->queued.back().swap(s->in);
+            chr = eol + 1;
+        }
+    }
+
+    // The last line may not have ended in a newline.
+    if (s->eof && !s->in.empty())
+    {
+        s->queued.push_back(string());
+        s->queued.back().swap(s->in);
+    }
+}
+
+void CServer::write(Session* s)
+{
+    while (!s->broken && s->sent < s->pending.size())
+    {
+        ssize_t n = send(s->fd, s->pending.data() + s->sent, s->pending.size() - s->sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                s->broken = true;
+            break;
+        }
+        s->sent += n;
+    }
+
+    if (s->sent >= s->pending.size() || s->broken)
+    {
+        s->pending.clear();
+        s->sent = 0;
+    }
+}
+
+void CServer::settle(Session* s, CThreadPool& pool)
+{
+    if (!s->busy && !s->quit && !s->broken && !s->queued.empty())
+    {
+        s->running.assign(s->queued.begin(), s->queued.end());
+        s->queued.clear();
+        s->busy = true;
+        pool.submit([this, s]{ work(s); });
+    }
+
+    // The lines before a line which was too long have all run, so its error goes last.
+    if (s->overlong && !s->busy && s->queued.empty())
+    {
+        s->pending += "\tError: The line is longer than " + to_string(SERVER_LINE) + " bytes. Closing the session.\n";
+        s->pending += SERVER_END;
+        s->overlong = false;
+        write(s);
+    }
+
+    // A session is over once there is nothing left to run or write, or nowhere to write it.
+    if (!s->busy && (s->broken || (s->eof && s->queued.empty() && s->pending.empty())))
+    {
+        close(s);
+        return;
+    }
+
+    // A full session isn't read until its worker or the client takes some of what it has.
+    int events = (s->eof || s->full() ? 0 : EPOLLIN) | (s->pending.empty() ? 0 : EPOLLOUT);
+    if (events == s->events)
+        return;
+
+    // A socket which has hung up would wake us over and over, so it isn't watched when we don't need it.
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = s->fd;
+    if (events == 0)
+        epoll_ctl(m_nEpoll, EPOLL_CTL_DEL, s->fd, &ev);
+    else
+        epoll_ctl(m_nEpoll, (s->events < 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, s->fd, &ev);
+    s->events = (events == 0) ? -1 : events;
+}
+
+void CServer::close(Session* s)
+{
+    if (s->events >= 0)
+        epoll_ctl(m_nEpoll, EPOLL_CTL_DEL, s->fd, NULL);
+    ::close(s->fd);
+    m_Sessions.erase(s->fd);
+    delete s;
+}
+
+void CServer::work(Session* s)
+{
+    for (size_t i = 0; i < s->running.size(); ++i)
+    {
+        bool more = s->calc.runLine(s->running[i]);
+        s->out << SERVER_END;
+        if (!more)
+        {
+            s->quit = true;
+            break;
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(m_Lock);
+        m_Done.push_back(s);
+    }
+    uint64_t one = 1;
+    if (::write(m_nWake, &one, sizeof(one)) < 0)
+        return; // the counter is full, so the loop is waking anyway
+}
+
+#else
+
+CServer::~CServer()
+{}
+
+void CServer::stop()
+{
+    m_bStop = true;
+}
+
+bool CServer::run(string& err)
+{
+    err = "The server needs Linux.";
+    return false;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CSERVER_H
+#define CSERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "CThreadPool.h"
+
+#define SERVER_READ     (1 << 16)   //How many bytes a session reads from its socket at a time
+#define SERVER_BACKLOG  128         //Connections waiting to be accepted
+#define SERVER_END      ".\n"       //Ends the response to every line
+#define SERVER_QUEUE    4096        //Lines a session may have waiting before it stops reading
+#define SERVER_PENDING  (1 << 22)   //Bytes of output a session may have unsent before it stops reading
+#define SERVER_LINE     (1 << 20)   //The longest line a client may send
+
+//////////////////////////////////////////////////
+//      Class CServer                           //
+//////////////////////////////////////////////////
+
+/* Runs calculators for any number of clients at once, over a Unix domain socket. Every connection is a session with a
+   Calc of its own, and so its own variables and functions, which last until it disconnects.
+
+   A client sends lines, as it would type them, and gets back the output of each line followed by a line holding only
+   "." (SERVER_END). Statements are run strictly in order within a session, and any number of lines may be sent
+   without waiting for the responses. "quit" ends the session.
+
+   A client which sends faster than its lines run, or doesn't read its responses, is held back: while a session has
+   more than SERVER_QUEUE lines waiting or SERVER_PENDING bytes unsent, its socket isn't read, so the client's writes
+   block, and reading starts again once they drain. A line longer than SERVER_LINE gets an error after the lines before
+   it have run, and ends the session.
+
+   One thread (the one calling run()) waits on every socket with epoll, reads what comes in, and writes what goes out;
+   it never runs a statement. Complete lines are handed to the thread pool, a session's lines to one worker at a time,
+   so a slow statement holds up its own session only. A worker gives its session back to the event loop through a
+   list of finished sessions and an eventfd, and everything but the Calc and the lines it is running belongs to the
+   event loop, so sessions need no locks of their own.
+
+   Each session can be given a memory quota (see CMemory), so that one client can't take all of the memory of the
+   others, and a budget for its variables, over which they are spilled to a file of its own (see CVarDB).
+
+   Linux only (epoll and eventfd). Elsewhere run() fails straight away.
+*/
+class CServer
+{
+        struct Session;
+
+        std::string     m_sPath;
+        int             m_nThreads;
+        long long       m_nQuota;       // bytes each session's matrices may hold, or 0
+        long long       m_nBudget;      // bytes each session's variables may hold before they are spilled, or 0
+        std::string     m_sSpill;       // sessions spill to this path followed by their number
+        long long       m_nSessions;    // sessions accepted so far
+        int             m_nListen;      // the listening socket
+        int             m_nEpoll;
+        int             m_nWake;        // eventfd which wakes the event loop when workers finish, or on stop()
+        std::atomic<bool>   m_bStop;
+
+        std::unordered_map<int, Session*>   m_Sessions;     // by socket
+        std::mutex                          m_Lock;         // guards m_Done
+        std::vector<Session*>               m_Done;         // sessions whose worker has finished
+
+        bool    listen(std::string& err);
+        void    accept();
+        void    read(Session* s);
+        void    write(Session* s);
+        void    settle(Session* s, CThreadPool& pool);  // hands over complete lines, then waits for what the session needs next, or closes it
+        void    close(Session* s);
+        void    work(Session* s);                       // runs the session's lines, on a worker
+
+public:
+        CServer(const std::string& path, int nThreads, long long quota = 0, long long budget = 0,
+                const std::string& spill = "");
+        ~CServer();
+
+        CServer(const CServer&) = delete;
+        CServer& operator=(const CServer&) = delete;
+
+        // Listens on the socket and serves clients until stop() is called. False, with the reason in err, if the
+        // socket can't be set up.
+        bool    run(std::string& err);
+
+        // Makes run() return. Safe to call from any thread, and from a signal handler.
+        void    stop();
+};
+
+#endif // CSERVER_H
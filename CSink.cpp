@@ -0,0 +1,69 @@
+#include "CSink.h"
+#include <cstring>
+
+using namespace std;
+
+CSink::CSink(ostream& dest, size_t size) : m_pDest{dest.rdbuf()}, m_Buf(size > 0 ? size : 1)
+{
+    //Hand the block to the streambuf base so single characters go straight into it.
+    setp(m_Buf.data(), m_Buf.data() + m_Buf.size());
+}
+
+CSink::~CSink()
+{
+    sync();
+}
+
+bool CSink::drain()
+{
+    streamsize n = pptr() - pbase();
+    if (n > 0 && m_pDest->sputn(pbase(), n) != n)
+        return false;
+
+    //Start over at the beginning of the block.
+    setp(m_Buf.data(), m_Buf.data() + m_Buf.size());
+    return true;
+}
+
+int CSink::overflow(int c)
+{
+    //The block is full, so pass it on and make room.
+    if (!drain())
+        return traits_type::eof();
+
+    if (c != traits_type::eof())
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize CSink::xsputn(const char* s, streamsize n)
+{
+    //If it fits, just copy it into the block.
+    if (n <= epptr() - pptr())
+    {
+        memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
+    }
+
+    //Otherwise empty the block first. Anything bigger than a whole block goes straight to the destination.
+    if (!drain())
+        return 0;
+
+    if (n >= (streamsize)m_Buf.size())
+        return m_pDest->sputn(s, n);
+
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+
+int CSink::sync()
+{
+    if (!drain())
+        return -1;
+    return m_pDest->pubsync();
+}
@@ -0,0 +1,43 @@
+#ifndef CSINK_H
+#define CSINK_H
+
+#include <iostream>
+#include <vector>
+
+#define SINK_SIZE (1 << 20) //Default size of the sink buffer (1 MiB)
+
+//////////////////////////////////////////////////
+//      Class CSink                             //
+//////////////////////////////////////////////////
+
+/* A stream buffer which collects output in one large block and hands it to a destination stream only when the
+   block is full, when flushed, or when destroyed. Writes larger than the block go straight through to the
+   destination so they reach it in a single call. Used by the batch mode to keep result output from flushing
+   once per line.
+
+   Usage:
+        CSink buf(cout);
+        ostream out(&buf);
+        out << ...;         // buffered until buf fills or out.flush() is called
+*/
+class CSink : public std::streambuf
+{
+        std::streambuf*     m_pDest;    // where the buffered output ends up
+        std::vector<char>   m_Buf;      // the block we collect output in
+
+        bool    drain();                // writes the buffered output to m_pDest and empties the buffer
+
+protected:
+        int                 overflow(int c) override;
+        std::streamsize     xsputn(const char* s, std::streamsize n) override;
+        int                 sync() override;
+
+public:
+        CSink(std::ostream& dest, size_t size = SINK_SIZE);
+        ~CSink();
+
+        CSink(const CSink&) = delete;
+        CSink& operator=(const CSink&) = delete;
+};
+
+#endif // CSINK_H
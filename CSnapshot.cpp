@@ -0,0 +1,171 @@
+#include "CSnapshot.h"
+#include "CMapping.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static const size_t HEADER_SIZE = 24;
+static const size_t ENTRY_SIZE  = 19;   // an index entry without its name
+
+template <class T>
+static void put(ofstream& out, T value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <class T>
+static T get(const char* at)
+{
+    T value;
+    memcpy(&value, at, sizeof(T));
+    return value;
+}
+
+int CSnapshot::save(CVarDB& db, const string& path, string& err)
+{
+    string tmpPath = path + ".tmp";
+    ofstream out(tmpPath, ios::binary | ios::trunc);
+    if (!out)
+    {
+        err = "Cannot write " + tmpPath + ".";
+        return -1;
+    }
+
+    // The header, with the index offset filled in at the end
+    uint32_t count = 0;
+    for (int i = 0; i < db.size(); ++i)
+        count += (db.at(i) != NULL);
+    out.write(SNAP_MAGIC, 8);
+    put<uint32_t>(out, SNAP_VERSION);
+    put<uint32_t>(out, count);
+    put<uint64_t>(out, 0);
+
+    // The data, remembering where each variable went
+    vector<uint64_t> offsets;
+    uint64_t at = HEADER_SIZE;
+    for (int i = 0; i < db.size(); ++i)
+    {
+        if (db.at(i) == NULL)
+            continue;
+        const CMatrix& value = db.at(i)->Value();
+        offsets.push_back(at);
+        out.write(reinterpret_cast<const char*>(value.data()), sizeof(double) * value.Size());
+        at += sizeof(double) * value.Size();
+    }
+
+    // And the index
+    size_t k = 0;
+    for (int i = 0; i < db.size(); ++i)
+    {
+        CVariable* var = db.at(i);
+        if (var == NULL)
+            continue;
+        const CMatrix& value = var->Value();
+        put<uint64_t>(out, offsets[k++]);
+        put<int32_t>(out, value.getNRow());
+        put<int32_t>(out, value.getNCol());
+        put<uint8_t>(out, 0);
+        put<uint16_t>(out, strlen(var->Name()));
+        out.write(var->Name(), strlen(var->Name()));
+    }
+
+    out.seekp(16);
+    put<uint64_t>(out, at);
+    out.close();
+
+    if (!out || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+        err = "Cannot write " + path + ".";
+        return -1;
+    }
+    return count;
+}
+
+int CSnapshot::restore(CVarDB& db, const string& path, string& err)
+{
+    shared_ptr<const CMapping> map = CMapping::open(path, err);
+    if (!map)
+        return -1;
+
+    const char* data = map->data();
+    size_t size = map->size();
+    auto corrupt = [&err, &path]()
+    {
+        err = path + " is not a snapshot, or is damaged.";
+        return -1;
+    };
+
+    if (size < HEADER_SIZE || memcmp(data, SNAP_MAGIC, 8) != 0)
+        return corrupt();
+    if (get<uint32_t>(data + 8) != SNAP_VERSION)
+    {
+        err = path + " was written by a different version of the calculator.";
+        return -1;
+    }
+    uint32_t count = get<uint32_t>(data + 12);
+    uint64_t index = get<uint64_t>(data + 16);
+    if (index < HEADER_SIZE || index > size)
+        return corrupt();
+    // Every entry takes at least ENTRY_SIZE bytes, so a bigger count can't be right and mustn't be allocated for.
+    if (count > (size - index) / ENTRY_SIZE)
+        return corrupt();
+
+    // Check the whole index before changing anything.
+    struct Entry
+    {
+        uint64_t    at;
+        int32_t     rows, cols;
+        string      name;
+    };
+    vector<Entry> entries(count);
+    const char* p = data + index;
+    const char* end = data + size;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (end - p < (ptrdiff_t)ENTRY_SIZE)
+            return corrupt();
+        Entry& e = entries[i];
+        e.at = get<uint64_t>(p);
+        e.rows = get<int32_t>(p + 8);
+        e.cols = get<int32_t>(p + 12);
+        uint8_t type = get<uint8_t>(p + 16);
+        uint16_t len = get<uint16_t>(p + 17);
+        p += ENTRY_SIZE;
+
+        if (type != 0 || len == 0 || end - p < len || e.rows < 0 || e.cols < 0 || (e.rows == 0) != (e.cols == 0))
+            return corrupt();
+        e.name.assign(p, len);
+        p += len;
+
+        // Divided rather than multiplied, since rows * cols * 8 can wrap around.
+        if (e.at % sizeof(double) != 0 || e.at < HEADER_SIZE || e.at > index
+            || (e.rows != 0 && uint64_t(e.cols) > (index - e.at) / sizeof(double) / uint64_t(e.rows)))
+            return corrupt();
+
+        // The name has to be one the calculator could have made.
+        if (!isalpha((unsigned char)e.name[0]) && e.name[0] != '_')
+            return corrupt();
+        for (size_t c = 0; c < e.name.size(); ++c)
+        {
+            if (!isalnum((unsigned char)e.name[c]) && e.name[c] != '_')
+                return corrupt();
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const Entry& e = entries[i];
+        CVariable* var = db.search(e.name.c_str());
+        if (var == NULL)
+            var = db.createVar(e.name.c_str());
+
+        var->Unbind();
+        var->PageOut(map, e.at, e.rows, e.cols);
+        var->Invalidate();
+    }
+    return count;
+}
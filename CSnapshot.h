@@ -0,0 +1,41 @@
+#ifndef CSNAPSHOT_H
+#define CSNAPSHOT_H
+
+#include <string>
+#include "CVarDB.h"
+
+#define SNAP_MAGIC      "PCALCSNP"  //The first 8 bytes of a snapshot file
+#define SNAP_VERSION    1
+
+//////////////////////////////////////////////////
+//      Class CSnapshot                         //
+//////////////////////////////////////////////////
+
+/* Saves the whole variable database to one binary file, and restores it from one. The file is laid out as:
+
+        header  ::: SNAP_MAGIC, then the format version and the number of variables as 4-byte integers, then the
+                    byte offset of the index as an 8-byte integer.
+        data    ::: The elements of every variable, row after row, as 8-byte doubles. Each variable starts at a multiple
+                    of 8 bytes, so they can be used straight from a mapping of the file.
+        index   ::: For every variable, the offset of its data (8 bytes), its rows and columns (4 bytes each), the type
+                    of its elements (1 byte, 0 for doubles, the only one so far), the length of its name (2 bytes),
+                    and the name itself, without a terminator.
+
+   Numbers are in the byte order of the machine which wrote the file. Bound variables are saved as their values.
+
+   restore() maps the file and reads only the index: every variable in it is paged out to the mapping (see
+   CVariable::PageOut), and its data is only read the first time it is used. Restoring takes the same time however
+   big the variables are. Variables which aren't in the file are left alone; the ones which are lose their bindings.
+
+   save() writes to a new file which then takes the place of the old one, so variables still paged out to the old
+   file keep working.
+*/
+class CSnapshot
+{
+public:
+        // Both return the number of variables saved or restored, or -1 with the reason in err.
+        static int      save(CVarDB& db, const std::string& path, std::string& err);
+        static int      restore(CVarDB& db, const std::string& path, std::string& err);
+};
+
+#endif // CSNAPSHOT_H
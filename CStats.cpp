@@ -0,0 +1,81 @@
+#include "CStats.h"
+#include "CKernel.h"
+#include <chrono>
+#include <iomanip>
+
+using namespace std;
+
+static const char* s_StageNames[NSTAGES] = {"Read", "Partition", "Convert", "Command", "Interpret", "Echo", "Loop",
+                                            "Statement"};
+
+uint64_t CStats::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CStats::Timer::start(CHistogram* hist)
+{
+    m_pHist = hist;
+    m_nTimedAtStart = m_pStats->m_nTimed;
+    m_nStart = now();
+}
+
+// Whatever the Timers inside us recorded moved m_nTimed on, and none of that is ours.
+void CStats::Timer::stop()
+{
+    uint64_t all = now() - m_nStart;
+    uint64_t inner = m_pStats->m_nTimed - m_nTimedAtStart;
+    m_pHist->record(all > inner ? all - inner : 0);
+    m_pStats->m_nTimed = m_nTimedAtStart + all;
+}
+
+void CStats::merge(const CStats& other)
+{
+    for (int s = 0; s < NSTAGES; ++s)
+        m_Stages[s].merge(other.m_Stages[s]);
+    for (int op = 0; op < NULLOP; ++op)
+        m_Ops[op].merge(other.m_Ops[op]);
+    m_nStatements += other.m_nStatements;
+    m_nSampled += other.m_nSampled;
+}
+
+void CStats::reset()
+{
+    for (int s = 0; s < NSTAGES; ++s)
+        m_Stages[s].reset();
+    for (int op = 0; op < NULLOP; ++op)
+        m_Ops[op].reset();
+    m_nStatements = m_nSampled = 0;
+}
+
+static void row(ostream& out, const string& name, const CHistogram& h)
+{
+    if (h.count() == 0)
+        return;
+    out << '\t' << left << setw(14) << name << right << setw(10) << h.count();
+    double p[] = {50, 90, 99};
+    for (double pct : p)
+        out << setw(11) << h.percentile(pct) / 1000.0;
+    out << setw(11) << h.max() / 1000.0 << '\n';
+}
+
+void CStats::report(ostream& out) const
+{
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed << setprecision(2);
+
+    out << "\t" << m_nStatements << " statements, " << m_nSampled << " of them timed (the first " << STATS_ALWAYS
+        << ", then 1 in " << STATS_SAMPLE << ")" << (m_bOn ? "" : ", and paused") << ".\n";
+
+    out << "\t" << left << setw(14) << "Time (us)" << right << setw(10) << "count" << setw(11) << "p50" << setw(11)
+        << "p90" << setw(11) << "p99" << setw(11) << "max" << '\n';
+    for (int s = 0; s < NSTAGES; ++s)
+        row(out, s_StageNames[s], m_Stages[s]);
+    for (int op = 0; op < NULLOP; ++op)
+        row(out, string("Operator ") + CKernel::symbol(OP(op)), m_Ops[op]);
+    out << '\n';
+
+    out.flags(flags);
+    out.precision(precision);
+}
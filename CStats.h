@@ -0,0 +1,110 @@
+#ifndef CSTATS_H
+#define CSTATS_H
+
+#include <cstdint>
+#include <iostream>
+#include "CHistogram.h"
+#include "CExpr.h"
+
+#define STATS_ALWAYS    1024    //Statements timed before sampling starts
+#define STATS_SAMPLE    64      //After that, 1 in this many statements is timed, at random. A power of two.
+
+enum STAGE {SREAD, SPARTITION, SCONVERT, SCOMMAND, SINTERPRET, SECHO, SLOOP, SSTATEMENT, NSTAGES};
+
+//////////////////////////////////////////////////
+//      Class CStats                            //
+//////////////////////////////////////////////////
+
+/* Where the time of a calculator goes: a CHistogram of nanoseconds for every stage a statement goes through, and one
+   for every binary operator, filled in by Timers. The stages are
+
+        SREAD       ::: Reading the line (Calc::run, when the source is a file rather than the keyboard).
+        SPARTITION  ::: The Partitioner.
+        SCONVERT    ::: The Converter.
+        SCOMMAND    ::: Looking for and running a command (who, memory, ...).
+        SINTERPRET  ::: The Interpreter: compiling the expression and evaluating it, apart from the operators.
+        SECHO       ::: Printing the result.
+        SLOOP       ::: Compiling and running a loop, apart from its operators.
+        SSTATEMENT  ::: The whole statement, from the Partitioner to the end of any spilling or publishing.
+
+   A Timer doesn't count the time of the Timers started while it runs, so the time of an operator isn't in the
+   Interpreter's as well, and the stages of a statement add up to about SSTATEMENT.
+
+   Looking at the clock takes about as long as the operator of a small statement, so timing every stage of every
+   statement would slow a script of small statements down by half. Only the first STATS_ALWAYS statements are timed,
+   and after that one in STATS_SAMPLE, chosen at random so that a script which repeats itself can't always hide the
+   same statement. sample() says whether to time the next one. The percentiles are then those of the sample, and the
+   other statements cost a random number.
+
+   A calculator without stats has no CStats at all, and its Timers don't look at the clock. Nor do they while the
+   stats are paused, which keeps what has been recorded. Not thread-safe: each
+   worker of a calculator running on several threads has its own, and merge() adds them up.
+*/
+class CStats
+{
+        CHistogram      m_Stages[NSTAGES];
+        CHistogram      m_Ops[NULLOP];      // by OP
+        uint64_t        m_nTimed;           // nanoseconds recorded by Timers so far, inner ones included
+        uint64_t        m_nStatements;      // statements sample() was asked about
+        uint64_t        m_nSampled;         // and how many of them it said to time
+        uint64_t        m_nRandom;          // xorshift state
+        bool            m_bOn;              // false while paused
+
+public:
+        CStats() : m_nTimed{0}, m_nStatements{0}, m_nSampled{0}, m_nRandom{88172645463325252ull}, m_bOn{true} {};
+
+        // Whether to time the statement about to run (see above).
+        bool    sample()
+        {
+            if (!m_bOn)
+                return false;
+            ++m_nStatements;
+            m_nRandom ^= m_nRandom << 13;
+            m_nRandom ^= m_nRandom >> 7;
+            m_nRandom ^= m_nRandom << 17;
+            if (m_nStatements > STATS_ALWAYS && (m_nRandom & (STATS_SAMPLE - 1)) != 0)
+                return false;
+            ++m_nSampled;
+            return true;
+        };
+
+        // Nanoseconds on a monotonic clock.
+        static uint64_t now();
+
+        class Timer
+        {
+                CStats*     m_pStats;       // NULL if there are no stats to keep
+                CHistogram* m_pHist;
+                uint64_t    m_nStart;
+                uint64_t    m_nTimedAtStart;
+        public:
+                Timer(CStats* stats, STAGE s) : m_pStats{stats}
+                {
+                    if (stats != NULL)
+                        start(&stats->m_Stages[s]);
+                };
+                Timer(CStats* stats, OP op) : m_pStats{stats}
+                {
+                    if (stats != NULL)
+                        start(&stats->m_Ops[op]);
+                };
+                ~Timer() { if (m_pStats != NULL) stop(); };
+                Timer(const Timer&) = delete;
+                Timer& operator=(const Timer&) = delete;
+        private:
+                void    start(CHistogram* hist);
+                void    stop();
+        };
+
+        // Records a time taken without a Timer. It counts in full, whatever was timed in the meantime.
+        void    record(STAGE s, uint64_t ns) { m_Stages[s].record(ns); };
+        void    pause(bool paused) { m_bOn = !paused; };
+        bool    isOn() const { return m_bOn; };
+        void    merge(const CStats& other);
+        void    reset();
+
+        // Prints the count, p50, p90, p99 and maximum in microseconds of every stage and operator which has any.
+        void    report(std::ostream& out) const;
+};
+
+#endif // CSTATS_H
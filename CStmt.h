@@ -0,0 +1,55 @@
+#ifndef CSTMT_H
+#define CSTMT_H
+
+#include <vector>
+#include "CExpr.h"
+
+class CVariable;
+
+enum STMTTYPE {SASSIGN, SINCDEC, SEXPR, SFOR, SWHILE};
+
+//////////////////////////////////////////////////
+//      Struct CStmt                            //
+//////////////////////////////////////////////////
+
+/* A compiled statement of a loop. Calc compiles a whole loop into a tree of these before running it, so the lines of
+   its body are only read once however many times they run.
+
+        SASSIGN ::: var = expr, or var op= expr when op is ASNADD, ASNSUB, ASNMULT or ASNDIV.
+        SINCDEC ::: var++ or var-- (op is INC or DEC).
+        SEXPR   ::: ans = expr.
+        SFOR    ::: for var = expr:last, or expr:step:last, running body for every value. Without last, var takes the
+                    value of every element of expr in turn.
+        SWHILE  ::: while expr, running body for as long as every element of expr is nonzero.
+
+   Variables are looked up when compiling, so the loop variable is just a pointer when it runs. line is the line of
+   the loop the statement came from, counting the for or while as 1, for error messages. A statement owns its
+   expressions and its body.
+*/
+struct CStmt
+{
+    STMTTYPE            type;
+    OP                  op;
+    CVariable*          var;
+    CExpr*              expr;
+    CExpr*              step;
+    CExpr*              last;
+    std::vector<CStmt*> body;
+    int                 line;
+
+    CStmt(STMTTYPE t, int l) : type{t}, op{NULLOP}, var{0}, expr{0}, step{0}, last{0}, line{l} {};
+
+    ~CStmt()
+    {
+        delete expr;
+        delete step;
+        delete last;
+        for (size_t i = 0; i < body.size(); ++i)
+            delete body[i];
+    }
+
+    CStmt(const CStmt&) = delete;
+    CStmt& operator=(const CStmt&) = delete;
+};
+
+#endif // CSTMT_H
@@ -0,0 +1,65 @@
+#include "CThreadPool.h"
+
+using namespace std;
+
+CThreadPool::CThreadPool(int nThreads) : m_nPending{0}, m_bStop{false}
+{
+    if (nThreads < 1)
+        nThreads = 1;
+
+    for (int i = 0; i < nThreads; ++i)
+        m_Workers.emplace_back(&CThreadPool::work, this);
+}
+
+CThreadPool::~CThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m_Lock);
+        m_bStop = true;
+    }
+    m_JobReady.notify_all();
+
+    for (size_t i = 0; i < m_Workers.size(); ++i)
+        m_Workers[i].join();
+}
+
+void CThreadPool::submit(function<void()> job)
+{
+    {
+        lock_guard<mutex> lock(m_Lock);
+        m_Jobs.push_back(move(job));
+        ++m_nPending;
+    }
+    m_JobReady.notify_one();
+}
+
+void CThreadPool::wait()
+{
+    unique_lock<mutex> lock(m_Lock);
+    m_AllDone.wait(lock, [this]{ return m_nPending == 0; });
+}
+
+void CThreadPool::work()
+{
+    while (true)
+    {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(m_Lock);
+            m_JobReady.wait(lock, [this]{ return m_bStop || !m_Jobs.empty(); });
+
+            //Only stop once the queue has been emptied.
+            if (m_Jobs.empty())
+                return;
+
+            job = move(m_Jobs.front());
+            m_Jobs.pop_front();
+        }
+
+        job();
+
+        lock_guard<mutex> lock(m_Lock);
+        if (--m_nPending == 0)
+            m_AllDone.notify_all();
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef CTHREADPOOL_H
+#define CTHREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////
+//      Class CThreadPool                       //
+//////////////////////////////////////////////////
+
+/* A fixed set of worker threads which run submitted jobs in the order they were submitted. Jobs may submit more jobs.
+   wait() blocks until every job submitted so far has finished. The destructor finishes the queued jobs and joins the
+   workers. submit() and wait() may be called from any thread.
+*/
+class CThreadPool
+{
+        std::vector<std::thread>            m_Workers;
+        std::deque<std::function<void()>>   m_Jobs;
+        std::mutex                          m_Lock;
+        std::condition_variable             m_JobReady;    // signalled when a job is queued or we are stopping
+        std::condition_variable             m_AllDone;     // signalled when the last outstanding job finishes
+        int                                 m_nPending;    // jobs queued or running
+        bool                                m_bStop;
+
+        void    work();                     // the loop each worker runs
+
+public:
+        CThreadPool(int nThreads);
+        ~CThreadPool();
+
+        CThreadPool(const CThreadPool&) = delete;
+        CThreadPool& operator=(const CThreadPool&) = delete;
+
+        void    submit(std::function<void()> job);
+        void    wait();
+        int     size() const { return m_Workers.size(); };
+};
+
+#endif // CTHREADPOOL_H
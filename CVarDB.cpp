@@ -1,26 +1,134 @@
 #include "CVarDB.h"
+#include "CMapping.h"
 #include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
 
-CVarDB::CVarDB() : m_nSize{1}
+CVarDB::CVarDB() : m_Table(DB_MIN_SLOTS, Slot{0, EMPTY}), m_nHoles{0}, m_bVersioned{false}, m_pRoot{NULL}, m_nEpoch{1},
+    m_nBudget{0}, m_nSpillEnd{0}, m_bSpillMade{false}, m_nSpilled{0}, m_nReloaded{0}, m_nBytesOut{0}, m_nBytesIn{0}
 {
+    for (int i = 0; i < DB_READERS; ++i)
+        m_Readers[i] = 0;
+
     //ctor
 
     //Create default ans variable
-    if (m_pDB[0].SetName("ans"))
-        m_pDB[0] = 0;
-    else
-        throw "Bad Allocation of ans";
+    createVar("ans", 0.0);
 }
 
-CVariable* CVarDB::search(const char* name)
+CVarDB::~CVarDB()
 {
-    //search the database for the variable name
-    for (int i = 0; i < m_nSize; ++i)
+    for (size_t i = 0; i < m_Vars.size(); ++i)
+        delete m_Vars[i];
+
+    // What was replaced and what is still in the latest version are all there is.
+    for (size_t i = 0; i < m_Retired.size(); ++i)
+        delete m_Retired[i].second;
+
+    const Root* root = m_pRoot.load();
+    if (root != NULL)
     {
-        if (strcmp(m_pDB[i].Name(), name) == 0)
-            return &m_pDB[i];
+        for (size_t i = 0; i < root->pages.size(); ++i)
+        {
+            for (int k = 0; root->pages[i] != NULL && k < DB_PAGE; ++k)
+                delete root->pages[i]->at[k];
+            delete root->pages[i];
+        }
+        delete root->names;
+        delete root;
     }
-    return NULL; //Return null if we can't find the name.
+
+    if (m_bSpillMade)
+        std::remove(m_sSpillPath.c_str());
+}
+
+// FNV-1a
+uint32_t CVarDB::hash(const char* name)
+{
+    uint32_t h = 2166136261u;
+    for (; *name; ++name)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+size_t CVarDB::find(const char* name, uint32_t h) const
+{
+    size_t mask = m_Table.size() - 1;
+    for (size_t i = h & mask; ; i = (i + 1) & mask)
+    {
+        const Slot& slot = m_Table[i];
+        if (slot.sym == EMPTY || (slot.hash == h && m_Names[slot.sym] == name))
+            return i;
+    }
+}
+
+int CVarDB::symbol(const char* name) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_Lock);
+    return m_Table[find(name, hash(name))].sym;
+}
+
+int CVarDB::intern(const char* name)
+{
+    uint32_t h = hash(name);
+    {
+        std::shared_lock<std::shared_mutex> lock(m_Lock);
+        int sym = m_Table[find(name, h)].sym;
+        if (sym != EMPTY)
+            return sym;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_Lock);
+
+    // Somebody else may have made it in the meantime.
+    size_t at = find(name, h);
+    if (m_Table[at].sym != EMPTY)
+        return m_Table[at].sym;
+
+    int sym = m_Names.size();
+    m_Names.push_back(name);
+    m_BySym.push_back(NULL);
+    m_Pos.push_back(-1);
+    m_Table[at] = Slot{h, sym};
+
+    // Keep the table at most 70% full.
+    if (m_Names.size() * 10 > m_Table.size() * 7)
+    {
+        std::vector<Slot> old(m_Table.size() * 2, Slot{0, EMPTY});
+        old.swap(m_Table);
+        for (size_t i = 0; i < old.size(); ++i)
+        {
+            if (old[i].sym != EMPTY)
+                m_Table[find(m_Names[old[i].sym].c_str(), old[i].hash)] = old[i];
+        }
+    }
+    return sym;
+}
+
+void CVarDB::compact()
+{
+    size_t n = 0;
+    for (size_t i = 0; i < m_Vars.size(); ++i)
+    {
+        if (m_Vars[i] != NULL)
+        {
+            m_Pos[m_Vars[i]->Symbol()] = n;
+            m_Vars[n++] = m_Vars[i];
+        }
+    }
+    m_Vars.resize(n);
+    m_nHoles = 0;
+}
+
+CVariable* CVarDB::insert(int sym, CVariable* var)
+{
+    var->m_nSym = sym;
+    m_BySym[sym] = var;
+    m_Pos[sym] = m_Vars.size();
+    m_Vars.push_back(var);
+    return var;
 }
 
 CMatrix      CVarDB::getVal(const char*name)
@@ -28,6 +136,11 @@ CMatrix      CVarDB::getVal(const char*name)
     return search(name)->Value();
 }
 
+CVariable* CVarDB::createVar(int sym)
+{
+    return insert(sym, new CVariable(m_Names[sym].c_str(), 0.0));
+}
+
 CVariable* CVarDB::createVar(const char* name)
 {
     //Actually just create a new variable of the same name with value 0.
@@ -36,38 +149,262 @@ CVariable* CVarDB::createVar(const char* name)
 
 CVariable* CVarDB::createVar(const char* name, const double& d)
 {
-    if (m_nSize < SIZE_DB) //if we have room
+    return insert(intern(name), new CVariable(name, d));
+}
+
+CVariable* CVarDB::createVar(const char* name, const CMatrix& m)
+{
+    return insert(intern(name), new CVariable(name, m));
+}
+
+bool CVarDB::remove(const char* name)
+{
+    int sym = symbol(name);
+    CVariable* var = search(sym);
+    if (var == NULL || var == getAns())
+        return false;
+
+    m_Vars[m_Pos[sym]] = NULL;
+    m_BySym[sym] = NULL;
+    delete var;
+
+    // Once half of m_Vars is holes, close them up.
+    if (++m_nHoles * 2 > (int)m_Vars.size())
+        compact();
+    return true;
+}
+
+void CVarDB::dump() //Clears the contents of the DB
+{
+    //Set the ans variable to zero.
+    *m_Vars[0] = 0;
+
+    for (size_t i = 1; i < m_Vars.size(); ++i)
     {
-        m_pDB[m_nSize].SetName(name);
-        m_pDB[m_nSize].SetValue(d);
-        return &m_pDB[m_nSize++];
+        if (m_Vars[i] != NULL)
+            m_BySym[m_Vars[i]->Symbol()] = NULL;
+        delete m_Vars[i];
     }
-    else
-        return NULL;
+    m_Vars.resize(1);
+    m_nHoles = 0;
 }
 
-CVariable* CVarDB::createVar(const char* name, const CMatrix& m)
+/*** Versions ***/
+
+void CVarDB::commit()
 {
-    if (m_nSize < SIZE_DB) //if we have room
+    const Root* old = m_pRoot.load(std::memory_order_relaxed);  // we are the only writer
+    size_t nSyms = m_Names.size();
+    size_t nPages = (nSyms + DB_PAGE - 1) / DB_PAGE;
+    m_Published.resize(nSyms, 0);
+
+    Root* root = NULL;                  // made when the first change turns up
+    std::vector<bool> copied(nPages);   // pages of root made in this commit, which can still be written
+    std::vector<const Published*> replaced;
+    bool renamed = false;               // whether the set of names has changed
+
+    // Variables never have a version of 0, so a symbol without one matches until a variable is made for it.
+    for (size_t sym = 0; sym < nSyms; ++sym)
     {
-        m_pDB[m_nSize].SetName(name);
-        m_pDB[m_nSize].SetValue(m);
-        return &m_pDB[m_nSize++];
+        CVariable* var = m_BySym[sym];
+        unsigned long long version = (var != NULL) ? var->Version() : 0;
+        if (version == m_Published[sym])
+            continue;
+
+        if (root == NULL)
+        {
+            root = new Root;
+            root->number = (old != NULL) ? old->number + 1 : 1;
+            if (old != NULL)
+                root->pages = old->pages;
+            root->pages.resize(nPages, NULL);
+            root->names = (old != NULL) ? old->names : NULL;
+        }
+
+        size_t p = sym / DB_PAGE;
+        if (!copied[p])
+        {
+            Page* page = new Page;
+            if (root->pages[p] != NULL)
+            {
+                *page = *root->pages[p];
+                replaced.push_back(root->pages[p]);
+            }
+            else
+                memset(page->at, 0, sizeof(page->at));
+            root->pages[p] = page;
+            copied[p] = true;
+        }
+
+        const Entry*& slot = const_cast<Page*>(root->pages[p])->at[sym % DB_PAGE];
+        if (slot != NULL)
+            replaced.push_back(slot);
+        renamed |= ((slot != NULL) != (var != NULL));
+
+        Entry* entry = NULL;
+        if (var != NULL)
+        {
+            entry = new Entry;
+            entry->name = m_Names[sym];
+            if (!var->Paged(entry->paged, entry->pagedAt, entry->pagedRows, entry->pagedCols))
+                entry->value = var->Value();
+        }
+        slot = entry;
+        m_Published[sym] = version;
     }
-    else
-        return NULL;
+
+    if (root == NULL)
+        return;
+
+    if (renamed || root->names == NULL)
+    {
+        Names* names = new Names;
+        for (size_t p = 0; p < root->pages.size(); ++p)
+        {
+            for (int k = 0; root->pages[p] != NULL && k < DB_PAGE; ++k)
+            {
+                if (root->pages[p]->at[k] != NULL)
+                    names->syms[root->pages[p]->at[k]->name] = p * DB_PAGE + k;
+            }
+        }
+        if (root->names != NULL)
+            replaced.push_back(root->names);
+        root->names = names;
+    }
+
+    m_pRoot.store(root);
+    if (old != NULL)
+        replaced.push_back(old);
+
+    // Views which started before this may still be reading what was replaced, and they pinned an epoch no later
+    // than this one.
+    uint64_t epoch = m_nEpoch.fetch_add(1);
+    for (size_t i = 0; i < replaced.size(); ++i)
+        m_Retired.push_back(std::make_pair(epoch, replaced[i]));
+    reclaim();
 }
 
-void CVarDB::dump() //Essentially clears the contents of the DB
+//Several views may read a paged out entry at once; whichever gets here first copies it in.
+const CMatrix& CVarDB::Entry::Value() const
 {
-    //Set the ans variable to zero.
-    m_pDB[0] = 0;
+    if (paged != NULL)
+    {
+        std::call_once(loaded, [this]
+        {
+            value.reshape(pagedRows, pagedCols);
+            if (!value.IsNull())
+                memcpy(value.data(), paged->data() + pagedAt, sizeof(double) * value.Size());
+        });
+    }
+    return value;
+}
+
+void CVarDB::reclaim()
+{
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < DB_READERS; ++i)
+    {
+        uint64_t pinned = m_Readers[i].load();
+        if (pinned != 0 && pinned < oldest)
+            oldest = pinned;
+    }
 
-    for (int i = 1; i < SIZE_DB; ++i)
+    size_t kept = 0;
+    for (size_t i = 0; i < m_Retired.size(); ++i)
     {
-        m_pDB[0].Clear();
+        if (m_Retired[i].first < oldest)
+            delete m_Retired[i].second;
+        else
+            m_Retired[kept++] = m_Retired[i];
     }
+    m_Retired.resize(kept);
+}
 
-    //Move the counter for the number of elements back to the beginning, so we write over the old variables.
-    m_nSize = 1;
+/*** Spilling ***/
+
+void CVarDB::setBudget(long long bytes, const std::string& path)
+{
+    m_nBudget = (bytes > 0) ? bytes : 0;
+    if (path != m_sSpillPath && m_bSpillMade)
+    {
+        std::remove(m_sSpillPath.c_str());
+        m_bSpillMade = false;
+    }
+    m_sSpillPath = path;
+    m_nSpillEnd = 0;
+}
+
+bool CVarDB::trim(std::string& err)
+{
+    if (m_nBudget <= 0)
+        return true;
+
+    // Once nothing holds a mapping of the file, every value in it has been read back or replaced, so it starts over.
+    m_Spills.erase(std::remove_if(m_Spills.begin(), m_Spills.end(),
+                                  [](const std::weak_ptr<const CMapping>& map) { return map.expired(); }),
+                   m_Spills.end());
+    if (m_Spills.empty())
+        m_nSpillEnd = 0;
+
+    long long held = 0;
+    std::vector<CVariable*> cold;
+    for (size_t i = 0; i < m_Vars.size(); ++i)
+    {
+        CVariable* var = m_Vars[i];
+        if (var == NULL || var->isPaged())
+            continue;
+        long long bytes = var->m_xValue.Size() * sizeof(double);
+        held += bytes;
+        if (bytes >= DB_SPILL_MIN)
+            cold.push_back(var);
+    }
+    if (held <= m_nBudget)
+        return true;
+
+    std::sort(cold.begin(), cold.end(),
+              [](const CVariable* a, const CVariable* b) { return a->LastUsed() < b->LastUsed(); });
+
+    // A round which failed may have left something past m_nSpillEnd, which is written over.
+    std::ios::openmode mode = std::ios::binary | std::ios::out | ((m_nSpillEnd > 0) ? std::ios::in : std::ios::trunc);
+    std::ofstream out(m_sSpillPath, mode);
+    if (!out)
+    {
+        err = "Cannot write " + m_sSpillPath + ".";
+        return false;
+    }
+    m_bSpillMade = true;
+    out.seekp(m_nSpillEnd);
+
+    std::vector<std::pair<CVariable*, uint64_t>> spilled;
+    uint64_t at = m_nSpillEnd;
+    for (size_t i = 0; i < cold.size() && held > m_nBudget; ++i)
+    {
+        const CMatrix& value = cold[i]->m_xValue;
+        size_t bytes = value.Size() * sizeof(double);
+        out.write(reinterpret_cast<const char*>(value.data()), bytes);
+        spilled.push_back(std::make_pair(cold[i], at));
+        at += bytes;
+        held -= bytes;
+    }
+    out.close();
+    if (!out)
+    {
+        err = "Cannot write " + m_sSpillPath + ".";
+        return false;
+    }
+
+    std::shared_ptr<const CMapping> map = CMapping::open(m_sSpillPath, err);
+    if (map == NULL)
+        return false;
+
+    m_nSpillEnd = at;
+    m_Spills.push_back(map);
+    for (size_t i = 0; i < spilled.size(); ++i)
+    {
+        CVariable* var = spilled[i].first;
+        m_nBytesOut += var->m_xValue.Size() * sizeof(double);
+        ++m_nSpilled;
+        var->Spill(map, spilled[i].second, this);
+    }
+    return true;
 }
@@ -1,43 +1,198 @@
 #include "CVariable.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #ifndef CVARDB_H
 #define CVARDB_H
 
-#define SIZE_DB 20 //Max size of the database
+#define DB_MIN_SLOTS 32 //Slots in an empty hash table. Always a power of two.
+#define DB_PAGE      64 //Variables in a page of a published version
+#define DB_READERS   64 //Views which can be open at once without waiting
+#define DB_SPILL_MIN 4096 //Bytes a value must hold before it is worth spilling to disk
 
 //////////////////////////////////////////////////
 //      Class CVarDB                            //
 //////////////////////////////////////////////////
 
+/* The variable database. There is no limit to the number of variables. Each one is allocated on its own and never
+   moves, so the pointers handed out stay good until that variable is removed.
+
+   Every name is interned: the Converter turns each word into a symbol, a small integer which stays the same for as
+   long as the database lives, whether or not a variable of that name exists yet. The variable of a symbol is then
+   found by indexing an array, so statements can be parsed once and looked up without touching the name again, and
+   creating other variables doesn't change anything they found.
+
+   Names are interned through an open-addressing hash table with linear probing, which holds the hash of every name so
+   that probes rarely need to compare strings, and is doubled whenever it is more than 70% full. Symbols are never
+   removed, only their variables. m_Vars keeps the variables in the order they were made (for who); removing one
+   leaves a hole in it, and the holes are closed up once they make up half of it, so search, create and remove all
+   take constant time on average.
+
+   Interning takes a lock, since statements are parsed on several threads at once in parallel batch mode. Nothing
+   else does: variables are only made and removed while nobody else is using the database.
+
+   ans is always first and can't be removed.
+
+   Versions. With setVersioned(true), commit() publishes the values of all variables as they are now, as a new
+   version which never changes afterwards, so other threads can read a consistent set of values through a CVarView
+   while the calculator carries on. Calc commits after every statement. A version is a root pointing to pages of
+   DB_PAGE entries by symbol, and each entry holds a copy of one variable's value. Committing copies only the
+   variables whose version has moved on since the last commit, and the pages they are in; everything else is shared
+   with the previous version. The new root is published with a single atomic store. A variable which is paged out (by
+   restore or spilling) isn't read in to be committed; its entry keeps the mapping until a view reads it.
+
+   Replaced roots, pages and entries can't be freed while a view may still be reading them. Views pin the epoch they
+   start in (see CVarView), and commit() frees what was replaced in an epoch earlier than any pinned one. Only one
+   thread may commit; any number may read.
+
+   Spilling. With a budget (setBudget), trim() keeps the values held in memory within it between statements: the least
+   recently used ones are written to the end of a spill file and paged out to a mapping of it, the same way restore
+   pages out a snapshot, so they come back the first time they are read again. search() marks a variable as used, and
+   so does changing it. A spilled value keeps its version, so versions and the memo cache don't see a change. The file
+   is started over once every value in it has been read back or replaced, and removed with the database.
+*/
 class CVarDB
 {
-        CVariable       m_pDB[SIZE_DB];
-        int             m_nSize;    // size of the database
+        struct Slot
+        {
+            uint32_t    hash;
+            int         sym;    // EMPTY if unused
+        };
+        enum { EMPTY = -1 };
+
+        std::vector<Slot>           m_Table;
+        std::vector<std::string>    m_Names;    // by symbol
+        std::vector<CVariable*>     m_BySym;    // the variable of each symbol, or NULL
+        std::vector<int>            m_Pos;      // where it is in m_Vars
+        std::vector<CVariable*>     m_Vars;     // in the order they were made, with NULL holes for removed ones
+        int                         m_nHoles;   // NULLs in m_Vars
+        mutable std::shared_mutex   m_Lock;     // guards the symbols
+
+        // Published versions, which nothing changes once they are published.
+        struct Published
+        {
+            virtual ~Published() {}
+        };
+        struct Entry : Published
+        {
+            std::string     name;
+            mutable CMatrix value;
+            // A variable which was paged out when it was committed stays in its file: the entry shares the mapping,
+            // and the value is copied out of it the first time a view reads it.
+            std::shared_ptr<const CMapping> paged;
+            size_t          pagedAt;
+            int             pagedRows, pagedCols;
+            mutable std::once_flag  loaded;
+
+            Entry() : pagedAt{0}, pagedRows{0}, pagedCols{0} {};
+            const CMatrix&  Value() const;
+        };
+        struct Page : Published
+        {
+            const Entry*    at[DB_PAGE];    // by symbol % DB_PAGE, NULL where there is no variable
+        };
+        struct Names : Published
+        {
+            std::unordered_map<std::string, int>    syms;   // the symbol of every name with an entry
+        };
+        struct Root : Published
+        {
+            unsigned long long          number;     // counts commits
+            std::vector<const Page*>    pages;      // by symbol / DB_PAGE, NULL where there are no variables
+            const Names*                names;
+        };
+
+        bool                        m_bVersioned;
+        std::atomic<const Root*>    m_pRoot;        // the latest version, or NULL before the first commit
+        std::atomic<uint64_t>       m_nEpoch;
+        mutable std::atomic<uint64_t>   m_Readers[DB_READERS];  // the epoch each view pinned, or 0 for a free slot
+        std::vector<unsigned long long> m_Published;            // by symbol, the version of the variable in m_pRoot
+        std::vector<std::pair<uint64_t, const Published*>>  m_Retired; // replaced, with the epoch they were replaced in
+        friend class CVarView;
+
+        // Spilling (see above)
+        long long                   m_nBudget;      // bytes the values may hold between statements, or 0 for no limit
+        std::string                 m_sSpillPath;
+        uint64_t                    m_nSpillEnd;    // bytes written to the spill file
+        bool                        m_bSpillMade;   // trim() has written the spill file, so it is ours to remove
+        std::vector<std::weak_ptr<const CMapping>>  m_Spills;   // a mapping for every round of spilling in the file
+        std::atomic<long long>      m_nSpilled, m_nReloaded, m_nBytesOut, m_nBytesIn;
+        friend class CVariable;
+
+        void            reloaded(long long bytes) { ++m_nReloaded; m_nBytesIn += bytes; };  // a spilled value was read back
+
+        static uint32_t hash(const char* name);
+        size_t          find(const char* name, uint32_t h) const;   // the slot holding name, or the empty one where it would go
+        void            compact();                                  // closes the holes in m_Vars
+        CVariable*      insert(int sym, CVariable* var);
+        void            reclaim();                                  // frees what no view can be reading any more
+
 public:
         CVarDB();
-        ~CVarDB(){};
+        ~CVarDB();
 
-        void            Init();
+        CVarDB(const CVarDB&) = delete;
+        CVarDB& operator=(const CVarDB&) = delete;
+
+        // The symbol of name, made if needed.
+        int             intern(const char* name);
+        // The symbol of name, or -1 if it has none.
+        int             symbol(const char* name) const;
 
         // return a valid ptr if found, else a NULL
-        CVariable*      search(const char*name);
+        CVariable*      search(int sym)
+        {
+            CVariable* var = (sym >= 0 && sym < (int)m_BySym.size()) ? m_BySym[sym] : NULL;
+            if (var != NULL && m_nBudget > 0)
+                var->Used();
+            return var;
+        };
+        CVariable*      search(const char*name) { return search(symbol(name)); };
         CMatrix          getVal(const char*name);
 
-        // return a ptr of the new one, else a NULL
+        // return a ptr of the new one
+        CVariable*      createVar(int sym);
         CVariable*      createVar(const char*name);
         CVariable*      createVar(const char*name, const double& d);
         CVariable*      createVar(const char*name, const CMatrix& d);
 
-        CVariable*      getAns() { return &m_pDB[0]; };
+        // Deletes the variable, freeing its value. False if there is none by that name, or if it is ans.
+        bool            remove(const char* name);
+
+        CVariable*      getAns() { return m_Vars[0]; };
+        // The variables in the order they were made. May return NULL for one which was removed.
         CVariable*      at(int i)
         {
-            if (i < m_nSize)
-                return &m_pDB[i];
+            if (i < size())
+                return m_Vars[i];
             else
                 return 0;
         };
-        int             size()   { return m_nSize; };
+        int             size()   { return m_Vars.size(); };
 
         void    dump();
+
+        // Versions (see above). No view may be open when the database goes away.
+        void            setVersioned(bool on) { m_bVersioned = on; };
+        bool            isVersioned() const { return m_bVersioned; };
+        void            commit();
+
+        // Spilling (see above). The values may hold bytes in memory between statements (0 for no limit), and the rest
+        // go to the file at path, which is overwritten once something is spilled, and removed with the database. A file
+        // which was never spilled to is left alone. Set before anything is spilled.
+        void            setBudget(long long bytes, const std::string& path);
+        long long       budget() const { return m_nBudget; };
+        // Spills the least recently used values until the rest fit in the budget. False, with the reason in err and
+        // nothing spilled, if the spill file can't be written. Nobody else may be using the database.
+        bool            trim(std::string& err);
+        long long       spills() const { return m_nSpilled; };
+        long long       reloads() const { return m_nReloaded; };
+        long long       bytesOut() const { return m_nBytesOut; };
+        long long       bytesIn() const { return m_nBytesIn; };
 };
 #endif // CVARDB_H
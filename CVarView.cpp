@@ -0,0 +1,55 @@
+#include "CVarView.h"
+#include <thread>
+
+CVarView::CVarView(const CVarDB& db) : m_pDB{&db}, m_nSlot{-1}, m_pRoot{NULL}
+{
+    // Pin the epoch first and load the root after, so that whatever the root points to was replaced in this epoch or
+    // later, and commit() keeps it.
+    while (true)
+    {
+        for (int i = 0; i < DB_READERS; ++i)
+        {
+            uint64_t free = 0;
+            if (db.m_Readers[i].load(std::memory_order_relaxed) == 0
+             && db.m_Readers[i].compare_exchange_strong(free, db.m_nEpoch.load()))
+            {
+                m_nSlot = i;
+                m_pRoot = db.m_pRoot.load();
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+CVarView::~CVarView()
+{
+    m_pDB->m_Readers[m_nSlot].store(0, std::memory_order_release);
+}
+
+const CMatrix* CVarView::find(const std::string& name) const
+{
+    if (m_pRoot == NULL)
+        return NULL;
+
+    auto it = m_pRoot->names->syms.find(name);
+    return (it != m_pRoot->names->syms.end()) ? value(it->second) : NULL;
+}
+
+const char* CVarView::name(int sym) const
+{
+    if (sym < 0 || sym >= symbols() || m_pRoot->pages[sym / DB_PAGE] == NULL)
+        return NULL;
+
+    const CVarDB::Entry* entry = m_pRoot->pages[sym / DB_PAGE]->at[sym % DB_PAGE];
+    return (entry != NULL) ? entry->name.c_str() : NULL;
+}
+
+const CMatrix* CVarView::value(int sym) const
+{
+    if (sym < 0 || sym >= symbols() || m_pRoot->pages[sym / DB_PAGE] == NULL)
+        return NULL;
+
+    const CVarDB::Entry* entry = m_pRoot->pages[sym / DB_PAGE]->at[sym % DB_PAGE];
+    return (entry != NULL) ? &entry->Value() : NULL;
+}
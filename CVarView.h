@@ -0,0 +1,49 @@
+#ifndef CVARVIEW_H
+#define CVARVIEW_H
+
+#include <string>
+#include "CVarDB.h"
+
+//////////////////////////////////////////////////
+//      Class CVarView                          //
+//////////////////////////////////////////////////
+
+/* A consistent view of the variables of a CVarDB, as of its latest commit, for reading from any thread while the
+   calculator carries on. Every value in a view comes from the same commit, and none of them changes for as long as
+   the view is open, however many statements run in the meantime. A view of a database which has never committed is
+   empty.
+
+   Opening, reading and closing a view never take a lock or wait for the calculator. The one exception is a value
+   which was paged out when it was committed (see CVarDB): the first view to read it copies it in from its file, and
+   any other reading it at that moment waits for that. A view pins the epoch it starts
+   in, which keeps what it reads from being freed; keep views short-lived, since nothing replaced after that epoch can
+   be freed until it closes. Up to DB_READERS views can be open at once, and any more wait for one to close.
+
+   A view is for one thread.
+*/
+class CVarView
+{
+        const CVarDB*           m_pDB;
+        int                     m_nSlot;    // in m_pDB->m_Readers
+        const CVarDB::Root*     m_pRoot;
+
+public:
+        explicit CVarView(const CVarDB& db);
+        ~CVarView();
+
+        CVarView(const CVarView&) = delete;
+        CVarView& operator=(const CVarView&) = delete;
+
+        // Which commit this is a view of, counting from 1, or 0 if there has been none.
+        unsigned long long  number() const { return (m_pRoot != NULL) ? m_pRoot->number : 0; };
+
+        // The value of the variable called name, or NULL if it didn't exist.
+        const CMatrix*  find(const std::string& name) const;
+
+        // Every variable, by symbol: name(sym) and value(sym) are NULL where there was no variable.
+        int             symbols() const { return (m_pRoot != NULL) ? m_pRoot->pages.size() * DB_PAGE : 0; };
+        const char*     name(int sym) const;
+        const CMatrix*  value(int sym) const;
+};
+
+#endif // CVARVIEW_H
@@ -1,17 +1,27 @@
 #include "CVariable.h"
+#include "CExpr.h"
 #include <cstring>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "CMapping.h"
+#include "CVarDB.h"
 
-CVariable::CVariable() : m_xValue{}, m_sName{NULL}
+//Every version handed out is new, so a (variable, version) pair can never come back with a different value, even if
+//the variable is cleared and another takes its place.
+static std::atomic<unsigned long long> s_nVersions{0};
+
+CVariable::CVariable() : m_xValue{}, m_sName{NULL}, m_nVersion{++s_nVersions}, m_nSym{-1}, m_pBind{NULL}, m_bDirty{false}, m_nPagedAt{0}, m_nPagedRows{0}, m_nPagedCols{0}, m_bPaged{false}, m_pSpilledBy{NULL}, m_nUsed{0}
 {}
 
-CVariable::CVariable(const char* name, const CMatrix& v) : m_xValue{v}, m_sName{NULL}
+CVariable::CVariable(const char* name, const CMatrix& v) : m_xValue{v}, m_sName{NULL}, m_nVersion{++s_nVersions}, m_nSym{-1}, m_pBind{NULL}, m_bDirty{false}, m_nPagedAt{0}, m_nPagedRows{0}, m_nPagedCols{0}, m_bPaged{false}, m_pSpilledBy{NULL}, m_nUsed{0}
 {
     //Set the name
     SetName(name);
 }
 
-CVariable::CVariable(const char*name, const double& d) : m_xValue{d}, m_sName{NULL}
+CVariable::CVariable(const char*name, const double& d) : m_xValue{d}, m_sName{NULL}, m_nVersion{++s_nVersions}, m_nSym{-1}, m_pBind{NULL}, m_bDirty{false}, m_nPagedAt{0}, m_nPagedRows{0}, m_nPagedCols{0}, m_bPaged{false}, m_pSpilledBy{NULL}, m_nUsed{0}
 {
     //Set the name
     SetName(name);
@@ -19,6 +29,7 @@ CVariable::CVariable(const char*name, const double& d) : m_xValue{d}, m_sName{NU
 
 CVariable::~CVariable()
 {
+   Detach();
    if (m_sName != NULL)
    {
        delete [] m_sName;
@@ -26,11 +37,11 @@ CVariable::~CVariable()
    }
 }
 
-CVariable::CVariable(const CVariable& var) : m_sName{NULL}
+CVariable::CVariable(const CVariable& var) : m_sName{NULL}, m_nVersion{++s_nVersions}, m_nSym{-1}, m_pBind{NULL}, m_bDirty{false}, m_nPagedAt{0}, m_nPagedRows{0}, m_nPagedCols{0}, m_bPaged{false}, m_pSpilledBy{NULL}, m_nUsed{0}
 {
     SetName(var.m_sName);
     //Copy the value
-    m_xValue = var.m_xValue;
+    m_xValue = var.Value();
 }
 
 const CVariable& CVariable::operator=(CVariable&& var) //overload = for other variables
@@ -41,7 +52,9 @@ const CVariable& CVariable::operator=(CVariable&& var) //overload = for other va
         return *this;
     }
 
-    m_xValue = var.m_xValue;
+    Unpage();
+    m_xValue = var.Value();
+    Changed();
 
     if (m_sName == NULL && var.m_sName != NULL)
     {
@@ -61,7 +74,9 @@ const CVariable& CVariable::operator=(const CVariable& var) //overload = for oth
     }
 
     //Set the value of the variable.
-    m_xValue = var.m_xValue;
+    Unpage();
+    m_xValue = var.Value();
+    Changed();
 
     //If I don't have a name already, give me the one in the other object.
     if (m_sName == NULL)
@@ -73,19 +88,99 @@ const CVariable& CVariable::operator=(const CVariable& var) //overload = for oth
 
 const CVariable& CVariable::operator=(const CMatrix& m)
 {
+    Unpage();
     m_xValue = m;
+    Changed();
     return *this;
 }
 const CVariable& CVariable::operator=(const double& m)
 {
+    Unpage();
     m_xValue = m;
+    Changed();
     return *this;
 }
 
+void CVariable::Changed()
+{
+    m_nVersion = ++s_nVersions;
+}
+
+//Values are only paged in once, by whichever thread gets here first.
+static std::mutex s_PageLock;
+
+void CVariable::PageIn() const
+{
+    std::lock_guard<std::mutex> lock(s_PageLock);
+    if (!m_bPaged.load(std::memory_order_relaxed))
+        return;
+
+    m_xValue.reshape(m_nPagedRows, m_nPagedCols);
+    if (!m_xValue.IsNull())
+        memcpy(m_xValue.data(), m_pPaged->data() + m_nPagedAt, sizeof(double) * m_xValue.Size());
+    if (m_pSpilledBy != NULL)
+        m_pSpilledBy->reloaded(sizeof(double) * m_xValue.Size());
+    m_pSpilledBy = NULL;
+    m_pPaged.reset();
+    m_bPaged.store(false, std::memory_order_release);
+}
+
+bool CVariable::Paged(std::shared_ptr<const CMapping>& map, size_t& at, int& rows, int& cols) const
+{
+    std::lock_guard<std::mutex> lock(s_PageLock);
+    if (!m_bPaged.load(std::memory_order_relaxed))
+        return false;
+    map = m_pPaged;
+    at = m_nPagedAt;
+    rows = m_nPagedRows;
+    cols = m_nPagedCols;
+    return true;
+}
+
+void CVariable::Unpage()
+{
+    if (isPaged())
+    {
+        m_pPaged.reset();
+        m_pSpilledBy = NULL;
+        m_bPaged.store(false, std::memory_order_release);
+    }
+}
+
+void CVariable::PageOut(std::shared_ptr<const CMapping> map, size_t at, int rows, int cols)
+{
+    m_xValue = CMatrix();
+    m_pPaged = map;
+    m_nPagedAt = at;
+    m_nPagedRows = rows;
+    m_nPagedCols = cols;
+    m_pSpilledBy = NULL;
+    m_bPaged.store(true, std::memory_order_release);
+    Changed();
+}
+
+//The value read back is the one we had, so nothing which remembers our version needs to know.
+void CVariable::Spill(std::shared_ptr<const CMapping> map, size_t at, CVarDB* db)
+{
+    m_nPagedRows = m_xValue.getNRow();
+    m_nPagedCols = m_xValue.getNCol();
+    m_xValue = CMatrix();
+    m_pPaged = map;
+    m_nPagedAt = at;
+    m_pSpilledBy = db;
+    m_bPaged.store(true, std::memory_order_release);
+}
+
+//Versions come from one clock, so the last time we were used and the last time we changed can be compared.
+void CVariable::Used() const
+{
+    m_nUsed.store(s_nVersions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
 bool CVariable::SetName(const char* name)
 {
-        //Allocate enough memory for this new name.
-        char* newname = new char [strlen(name)];
+        //Allocate enough memory for this new name, and its terminating null.
+        char* newname = new char [strlen(name) + 1];
 
         //Check for a failure to allocate
         if (newname == NULL)
@@ -105,7 +200,73 @@ bool CVariable::SetName(const char* name)
 
 void CVariable::Clear()
 {
+    Detach();
     delete [] m_sName;
     m_sName = NULL;
+    Unpage();
     m_xValue.resize(0,0); //Set my matrix to null.
+    Changed();
+}
+
+bool CVariable::DependsOn(const CVariable* var) const
+{
+    for (size_t i = 0; i < m_Deps.size(); ++i)
+    {
+        if (m_Deps[i] == var || m_Deps[i]->DependsOn(var))
+            return true;
+    }
+    return false;
+}
+
+void CVariable::Bind(CExpr* expr)
+{
+    Unbind();
+
+    m_pBind = expr;
+    m_pBind->variables(m_Deps);
+    for (size_t i = 0; i < m_Deps.size(); ++i)
+        m_Deps[i]->m_Users.push_back(this);
+
+    //Nothing is computed until somebody reads us.
+    m_bDirty = true;
+    Invalidate();
+}
+
+void CVariable::Unbind()
+{
+    if (m_pBind == NULL)
+        return;
+
+    //Stop our dependencies from telling us about their changes.
+    for (size_t i = 0; i < m_Deps.size(); ++i)
+    {
+        std::vector<CVariable*>& users = m_Deps[i]->m_Users;
+        users.erase(std::remove(users.begin(), users.end(), this), users.end());
+    }
+
+    delete m_pBind;
+    m_pBind = NULL;
+    m_Deps.clear();
+    m_bDirty = false;
+}
+
+//Drops our binding and the bindings of everything which reads us, before we go away.
+void CVariable::Detach()
+{
+    Unbind();
+    while (!m_Users.empty())
+        m_Users.back()->Unbind();
+}
+
+void CVariable::Invalidate()
+{
+    //A variable which is already out of date has already passed that on to its own users.
+    for (size_t i = 0; i < m_Users.size(); ++i)
+    {
+        if (!m_Users[i]->m_bDirty)
+        {
+            m_Users[i]->m_bDirty = true;
+            m_Users[i]->Invalidate();
+        }
+    }
 }
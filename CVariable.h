@@ -2,6 +2,14 @@
 #define CVARIABLE_H
 
 #include <CMatrix.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+struct CExpr;
+class CMapping;
+class CVarDB;
 
 //////////////////////////////////////////////////
 //      Class CVariable                         //
@@ -9,8 +17,37 @@
 
 class CVariable
 {
-        CMatrix  m_xValue;
+        mutable CMatrix  m_xValue;      // mutable so a paged out value can be brought back by const readers
         char*   m_sName;
+        unsigned long long m_nVersion;  // changes every time m_xValue is set; never repeats, even across variables
+        int     m_nSym;                 // the symbol of m_sName in the CVarDB which made us, or -1
+        friend class CVarDB;
+
+        // Bindings (c := a*b + d). A bound variable keeps its expression and is recomputed from it the next time it is
+        // read after one of its dependencies changed.
+        CExpr*                  m_pBind;    // the expression this variable is bound to, or NULL
+        std::vector<CVariable*> m_Deps;     // the variables m_pBind reads
+        std::vector<CVariable*> m_Users;    // the bound variables which read this one
+        bool                    m_bDirty;   // m_xValue is out of date with m_pBind
+
+        // A paged out value is still in a file (see PageOut): m_xValue is empty until the value is first read, when
+        // it is copied in from the file's mapping.
+        mutable std::shared_ptr<const CMapping> m_pPaged;
+        size_t                  m_nPagedAt;     // where the elements are in the mapping
+        int                     m_nPagedRows, m_nPagedCols;
+        mutable std::atomic<bool> m_bPaged;
+        mutable CVarDB*         m_pSpilledBy;   // the database which spilled the value (see CVarDB::trim), or NULL
+        mutable std::atomic<unsigned long long> m_nUsed;    // the version clock when the database last handed us out
+
+        void    Detach();
+        void    Changed();                  // gives us a new version
+        void    PageIn() const;
+        void    Unpage();                   // forgets the paged out value, which is about to be replaced
+        void    Spill(std::shared_ptr<const CMapping> map, size_t at, CVarDB* db);   // PageOut, keeping the version
+        bool    Paged(std::shared_ptr<const CMapping>& map, size_t& at, int& rows, int& cols) const;  // where the value is, if it is paged out
+        void    Used() const;
+        unsigned long long LastUsed() const { return std::max(m_nUsed.load(std::memory_order_relaxed), m_nVersion); };
+
 public:
         // constructors and destructors
         CVariable();
@@ -24,16 +61,38 @@ public:
         const CVariable& operator=(const double& d);
 
 
-        operator double() const { return m_xValue(0,0); }; //returns the first value of the matrix
+        operator double() const { return Value()(0,0); }; //returns the first value of the matrix
 
         // getting and setting
-        CMatrix& Value() { return m_xValue; };   // reference return creates a lvalue
-        const CMatrix&   Value() const { return m_xValue; }; // const ref reture creates a rvalue
+        // Anyone who changes the value through Value() has to call Touch() afterwards, so the version moves on.
+        CMatrix& Value() { if (isPaged()) PageIn(); return m_xValue; };   // reference return creates a lvalue
+        const CMatrix&   Value() const { if (isPaged()) PageIn(); return m_xValue; }; // const ref reture creates a rvalue
         char*   Name() const { return m_sName; };
-        void    SetValue(const CMatrix& v) { m_xValue = v; };
-        void    SetValue(CMatrix&& v) { m_xValue = v; }; //setValue for rvalues
+        void    SetValue(const CMatrix& v) { Unpage(); m_xValue = v; Changed(); };
+        void    SetValue(CMatrix&& v) { Unpage(); m_xValue = std::move(v); Changed(); }; //setValue for rvalues
+        unsigned long long Version() const { return m_nVersion; };
+        int     Symbol() const { return m_nSym; };
+        void    Touch() { Changed(); };
         bool    SetName(const char* name);
         void    Clear();
+
+        // Paging. PageOut frees the value and takes the rows x cols elements at byte at of map instead, which are read
+        // back in the first time Value() is called. Reading back is safe from several threads at once.
+        void    PageOut(std::shared_ptr<const CMapping> map, size_t at, int rows, int cols);
+        bool    isPaged() const { return m_bPaged.load(std::memory_order_acquire); };
+
+        // Bindings
+        bool            isBound() const { return m_pBind != 0; };
+        bool            isDirty() const { return m_bDirty; };
+        bool            hasUsers() const { return !m_Users.empty(); };
+        const CExpr*    Binding() const { return m_pBind; };
+        const std::vector<CVariable*>& Deps() const { return m_Deps; };
+        const std::vector<CVariable*>& Users() const { return m_Users; };
+        bool            DependsOn(const CVariable* var) const;  // whether var is one of our dependencies, directly or not
+        void            Bind(CExpr* expr);  // takes ownership of expr and marks us (and our users) out of date
+        void            Unbind();
+        void            SetClean() { m_bDirty = false; };
+        void            Invalidate();       // marks every variable bound to us, directly or not, out of date
 };
 
 typedef CVariable CVar;
@@ -1,28 +1,47 @@
 #include "Calc.h"
 #include <math.h>
 #include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include "CThreadPool.h"
+#include "CMathLib.h"
+#include "CKernel.h"
+#include "CSnapshot.h"
 
-#define OPLEVELRANGE 3 //How many op levels there are in the basic operators we have. Moving into a parenthesized expression increases the opLevel by at least this much
+// Defines a macro which allows cleaner access to parts at an offset of (a) from the part pointed to by e_st.
+#define PRTOFST(a) (*(e_st+a))
+
+#define OPLEVELRANGE 3 //Value stored for an opening parenthesis (a closing one gets the negative), so that summing them checks that they match
 
 /****************** Calculator Definition *******************
 
-This file defines all the functions used directly by the Calc object. It consists of 5 main functions:
+This file defines all the functions used directly by the Calc object. It consists of 6 main functions:
 
     - Run           :: The main loop of the Calculator. This calls all the other functions below and prompts the user.
     - Partitioner   :: Separates the input string into "parts" which are stored in a private vector of part objects.
     - Converter     :: Reads through the part vector and converts the data stored in the string for each part to the
                        appropriate form (double, operator, matrix, string, etc.).
-    - Interpreter   :: Interprets the parts in the part vector and calls the calculator on the appropriate sections,
-                       and searches the variable database for the right variable to store the result in. The Interpreter
-                       also sets OpLevels (levels of recursion) on each of the parts, allowing the calculator to perform
-                       proper order of operations following the rules of mathematics.
-    - Calculator    :: A recursive calculator which loops through each "calculation" level (OpLevel) of the parts vector
-                       and accumulates a result, which it returns to the Interpreter.
+    - Interpreter   :: Interprets the parts in the part vector and calls the compiler and evaluator on the appropriate
+                       sections, and searches the variable database for the right variable to store the result in.
+    - Compiler      :: Turns the parts of an expression into a tree of CExpr nodes, following the rules of mathematics
+                       for the order of operations.
+    - Evaluator     :: A recursive calculator which walks a CExpr tree and returns its value to the Interpreter.
 
 Several smaller functions which act as aids and building blocks are also defined, most of them at the end of the file.*/
 
 using namespace std;
 
+//Constants used by the Evaluator. Made before any calculator runs, so they aren't charged to one (see CMemory).
+static const CMatrix s_One{1.0};
+static const CMatrix s_Zero{0.0};
+
 //A string copy function that allows concatenation of a substring with either a string or a character array.
 void substr_cpy(string&, strItr, strItr);
 void substr_cpy(char*, strItr, strItr);
@@ -42,12 +61,15 @@ void Calc::run()
     {
         ++num_case; // Increment the prompt counter
 
-        // Reset the part vector and the error members
-        m_Expr.clear();
-        isErr = false;
-
-        cout << "#" << num_case << " Input an expression to calculate: ";
-        if (!ReadInput())
+        // The prompt has to be on the screen before we wait for input.
+        *Sink << "#" << num_case << " Input an expression to calculate: " << flush;
+        bool read;
+        {
+            // Reading from the keyboard would time the user.
+            CStats::Timer timer((Source != &cin) ? m_pStats : NULL, SREAD);
+            read = ReadInput();
+        }
+        if (!read)
         {
             // Check whether we have reached an end of a file
             if (Source != &cin) // If we're not reading from user input
@@ -55,7 +77,7 @@ void Calc::run()
                 if (Source->eof()) // If we reached the end of the file on the last read
                 {
                     //Set the source to cin
-                    cout << "Reached EOF" << endl << endl;
+                    *Sink << "Reached EOF\n\n";
                     setSource(cin);
                     continue;
                 }
@@ -63,836 +85,2890 @@ void Calc::run()
             else
             {
                 // There was a reading error, so stop execution.
-                cout << endl << endl << "\tSorry, I cannot read the input." << endl;
+                *Sink << "\n\n\tSorry, I cannot read the input." << endl;
                 break;
             }
         }
 
         // We only echo input to the command line if we are not reading from cin.
-        if (*Source != cin)
+        if (Source != &cin)
         {
             //string echo = Input;
-            cout << Input << endl;
+            *Sink << Input << '\n';
         }
 
         // Add a line break after input
-        cout << endl;
+        *Sink << '\n';
 
-        // Call the Partitioner
-        Partition();
-        if (isErr)
-        {
-            printError();
-            cout << "\tPartition Error" << endl << endl;
-            continue;
-        }
+        // Partition, convert and interpret the line.
+        Process();
 
-        // Call the Converter
-        Convert();
-        if (isErr)
-        {
-            printError();
-            cout << "\tConvert Error" << endl << endl;
-            continue;
-        }
+        //Rinse and Repeat
 
-        // If the user inputs a special command, this will catch and execute it.
-        if (CommandCheck())
-            continue;
+    } //End while
+}
 
-        // Call the Interpreter
-        Interpret();
-        if (isErr)
+/**************** Batch *****************
+
+runBatch() is the non-interactive counterpart of run(), meant for feeding whole script files to the calculator. The
+source is read in blocks of BATCH_BLOCK bytes and split into lines here rather than through getline, no prompts are
+printed and the input is not echoed. Results and errors go to Sink through a CSink, so they are only written out when
+a whole block of output has been collected. Reading stops at the end of the source or at "quit".
+
+If setThreads() asked for more than one thread, lines are collected into a read-ahead window and run through
+RunPending() (see Parallel below) instead of one at a time.
+
+*/
+long Calc::runBatch()
+{
+    long            num_stmt = 0;           // Number of statements processed
+    vector<char>    block(BATCH_BLOCK);     // The block we read the source into
+    string          carry;                  // Part of a line left over at the end of the previous block
+    ostream*        realSink = Sink;
+
+    // Buffer everything we print until the end of the run (or until the buffer fills).
+    CSink   sinkBuf(*realSink);
+    ostream batchOut(&sinkBuf);
+    Sink = &batchOut;
+
+    quitNext = false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    while (!quitNext && *Source)
+    {
+        Source->read(block.data(), block.size());
+        streamsize got = Source->gcount();
+        if (got <= 0)
+            break;
+
+        const char* chr = block.data();
+        const char* end = chr + got;
+
+        while (!quitNext && chr < end)
         {
-            printError();
-            cout << "\tInterpret Error" << endl << endl;
-            continue;
+            const char* eol = static_cast<const char*>(memchr(chr, '\n', end - chr));
+
+            // No newline in the rest of the block, so save it for the next block.
+            if (eol == NULL)
+            {
+                carry.append(chr, end);
+                break;
+            }
+
+            // Build the line in Input, joining it to the leftovers from the last block if there are any.
+            if (carry.empty())
+                Input.assign(chr, eol);
+            else
+            {
+                Input.swap(carry);
+                Input.append(chr, eol);
+                carry.clear();
+            }
+            chr = eol + 1;
+
+            if (!Input.empty() && Input.back() == '\r')
+                Input.pop_back();
+
+            num_stmt += Submit();
         }
+    }
 
-        //Rinse and Repeat
+    // The last line may not have ended in a newline.
+    if (!quitNext && !carry.empty())
+    {
+        Input.swap(carry);
+        if (Input.back() == '\r')
+            Input.pop_back();
+        num_stmt += Submit();
+    }
 
-    } //End while
+    // Run whatever is still waiting in the read-ahead window.
+    num_stmt += RunPending();
+
+    // A loop which never reached its end isn't run.
+    if (m_nDepth > 0)
+    {
+        lastErr = "Missing end of loop.";
+        printError();
+        *Sink << "\tInterpret Error\n\n";
+        m_Block.clear();
+        m_nDepth = 0;
+    }
+
+    batchOut.flush();
+    Sink = realSink;
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    *ErrSink << "Processed " << num_stmt << " statements in " << secs << " s ("
+         << (secs > 0 ? num_stmt / secs : 0) << " statements/sec)" << endl;
+
+    return num_stmt;
 }
 
-// Reads input from Source into Input
-bool Calc::ReadInput()
+bool Calc::runLine(const string& line)
 {
-    //Get a line from my source and store it in Input
-    return getline(*Source,Input, '\n');
+    if (quitNext)
+        return false;
+
+    Input = line;
+    if (!Input.empty() && Input.back() == '\r')
+        Input.pop_back();
+    Process();
+    return !quitNext;
 }
 
-// List all the variables in the database. Called when the user types "who".
-void Calc::enumerateVars()
+// Process() prints any error after lastErr is set, and nothing after that (not even Publish) changes it.
+bool Calc::evaluate(const string& line, string& name, CMatrix& value, string& err)
 {
-    for (int i = 0; i < m_db->size(); ++i)
+    name.clear();
+    err.clear();
+    if (quitNext)
     {
-        cout << left << "\t" << setw(4) << m_db->at(i)->Name() << " =  ";
-        PrintMatrix(m_db->at(i)->Value(), cout, "\t\t ");
-        cout << endl << endl;
+        err = "The calculator has quit.";
+        return FAILURE;
     }
+
+    Input = line;
+    if (!Input.empty() && Input.back() == '\r')
+        Input.pop_back();
+
+    m_pName  = &name;
+    m_pValue = &value;
+    bool ok = Process();
+    m_pName  = NULL;
+    m_pValue = NULL;
+
+    if (!ok)
+        err = lastErr;
+    return ok;
 }
 
-// Checks whether the user has typed a special command. Commands will consist of 1 or 2 word parts.
-// the first being the name of the command and the second being an optional argument (not actually needed now)
-bool Calc::CommandCheck()
+// Runs the line in Input straight away, or queues it for the read-ahead window when running on several threads. Returns the
+// number of statements which were run.
+long Calc::Submit()
 {
-    prtItr command = m_Expr.begin();
-    short  ExprLen = m_Expr.size();
-    string cmdstr, args;
+    if (m_nThreads <= 1)
+    {
+        Process();
+        return 1;
+    }
 
-    if (ExprLen <= 2 && command->type == WORD) // Is this a single-word command?
+    // Loops and file commands are barriers: everything before them finishes first, and they run on their own.
+    size_t rest;
+    string word = Keyword(Input, rest);
+    if (m_nDepth > 0 || LoopDepth(Input) > 0 || word == "snapshot" || word == "restore")
     {
-        cmdstr = command->wdata;
-        if (cmdstr == "who")
-            enumerateVars();
-        else if (cmdstr == "quit")
+        string line;
+        line.swap(Input);
+        long n = RunPending();
+        if (quitNext)
+            return n;
+        Input.swap(line);
+        Process();
+        return n + 1;
+    }
+
+    m_Pending.push_back(Input);
+    if ((int)m_Pending.size() < m_nWindow)
+        return 0;
+
+    return RunPending();
+}
+
+// Partitions, converts and interprets the statement held in Input, printing any errors. Returns FAILURE if the statement had an error.
+bool Calc::Process()
+{
+    CMemory::Scope scope(m_pMem);
+    m_pTimed = (m_pStats != NULL && m_pStats->sample()) ? m_pStats : NULL;
+    uint64_t start = (m_pTimed != NULL) ? CStats::now() : 0;
+    m_pProfiling = (m_pProfile != NULL && m_pProfile->isOn()) ? m_pProfile : NULL;
+    CProfile::Scope profile(m_pProfiling);
+    if (m_pProfiling != NULL)
+        m_pProfiling->begin();
+    string stmt;    // what the profile counts the statement as
+    bool ok;
+
+    // The lines of a loop are collected until its end, and then run together.
+    int depth = LoopDepth(Input);
+    if (m_nDepth > 0 || depth > 0)
+    {
+        m_Block.push_back(Input);
+        m_nDepth += depth;
+        if (m_pProfiling != NULL && m_nDepth == 0)
+            stmt = m_Block.front() + " ... end";
+        ok = (m_nDepth > 0) ? SUCCESS : RunLoop();
+    }
+    else
+    {
+        // File names don't partition, so these are handled before the Partitioner sees them.
+        isErr = false;
+        bool isFile;
+        try
         {
-            cout << "\tGoodbye!" << endl;
-            quitNext = true;
+            isFile = FileCommand();
         }
-        else if (ExprLen == 2 && (command+1)->type == WORD) //Is this a double-word command.
+        catch (const CError& e)
         {
-            args = (command+1)->wdata;
-            if (cmdstr == "open")
+            isFile = isErr = true;
+            lastErr = e.get();
+        }
+
+        if (isFile)
+        {
+            ok = !isErr;
+            if (isErr)
             {
-                //open a file (not implemented)
-                //Source = new ifstream(args);
+                printError();
+                *Sink << "\tCommand Error\n\n";
             }
-            else
-                return false;
         }
-        else if (cmdstr == "open the doors") // special case of open
-            cout << "\tI'm sorry, Dave. I can't do that. \n\n";
-        else return false;
+        else
+            ok = Parse() && Execute();
+        if (m_pProfiling != NULL)
+            stmt = Input;
     }
-    else
-        return false;
 
-    return true;
+    if (m_bOwnsDB && m_db->isVersioned())
+        Publish();
+    if (m_bOwnsDB && m_db->budget() > 0)
+        Spill();
+    if (m_pTimed != NULL)
+        m_pTimed->record(SSTATEMENT, CStats::now() - start);
+    m_pTimed = NULL;
+    // The lines of a loop only count once it has run.
+    if (m_pProfiling != NULL && m_nDepth == 0)
+        m_pProfiling->end(stmt);
+    m_pProfiling = NULL;
+    return ok;
 }
 
-/*********** Partitioner *************
+// Commits the variables as they are now, for anyone reading them through a CVarView. Bound variables are brought up
+// to date first, so that a view never holds a value which is out of date with the rest.
+void Calc::Publish()
+{
+    bool err = isErr;
+    string msg = lastErr;
+    try
+    {
+        CMemory::Scope scope(m_pMem);
+        for (int i = 0; i < m_db->size(); ++i)
+        {
+            if (m_db->at(i) != NULL)
+                Resolve(m_db->at(i));
+        }
+    }
+    catch (const CError&)
+    {
+        // Whatever couldn't be brought up to date is published as it was.
+    }
+    isErr = err;
+    lastErr = msg;
 
-The Partitioner separates the Input string into segments based on word/number/matrix/operator boundaries and fills the vector
-m_Expr with part objects. The partitioner does not convert strings to doubles or operators, it simply stores start and end
-iterators in each part object so that the converter can go back later and convert things.
+    // Versions belong to the database rather than the session, so they aren't charged to it.
+    CMemory::Scope none(NULL);
+    m_db->commit();
+}
 
-Accepted signatures:
-    - Double   (any digit 0-9 and the decimal point "."; truncated at first non-digit.)
-    - Word     (any character A-Z and a-z as well as "_" and any digits not in the first position.)
-    - Operator (any single operator +, -, *, /, ^, %, =, or the double operators +=, -=, *=, /=, ++, --.)
-    - Paren    (any close or open parenthesis.)
-    - Matrix   (any sequence between two square brackets [ and ]; partitioner does not check the validity of the matrix, but it does check for invalid characters. )
-*/
-bool Calc::Partition()
+void Calc::Spill()
 {
-    strItr curChr   = Input.begin();    // Tracks the current position
-    strItr startChr = curChr;           // Tracks the start position of the current part we're reading
-    PARTTYPE curType;                   // The current part type to add to the vector
-    strItr endChr   = Input.end();      // The end position of the input string
+    string err;
+    if (!m_db->trim(err))
+        *ErrSink << "Cannot spill variables: " << err << endl;
+}
 
-    strItr startErr = curChr;           // Tracks the beginning of a lexical segment which is used for nice error reporting
+// Empties m_Expr. When profiling, what the parts free is counted against the tokenizer, which allocated it.
+void Calc::ClearParts()
+{
+    CProfile::Area area(m_pProfiling, PTOKENS);
+    for (size_t i = 0; m_pProfiling != NULL && i < m_Expr.size(); ++i)
+    {
+        if (m_Expr[i].type == WORD && m_Expr[i].wdata != 0)
+            m_pProfiling->freed(strlen(m_Expr[i].wdata) + 1);
+        else if (m_Expr[i].type == MATRIX && m_Expr[i].mdata != 0)
+            m_pProfiling->freed(sizeof(CMatrix));
+    }
+    m_Expr.clear();
+}
 
-    // Loop through the whole string
-    while(curChr < endChr)
+// The Partitioner and the Converter on their own, for calc_bench. Nothing is printed.
+bool Calc::partition(const string& line)
+{
+    Input = line;
+    ClearParts();
+    isErr = false;
+    Partition();
+    return !isErr;
+}
+
+bool Calc::convert()
+{
+    if (isErr)
+        return FAILURE;
+    try
     {
-        startChr = curChr; // Update the start tracker to the current position, which is always at the beginning of a part.
+        Convert();
+    }
+    catch (const CError& e)
+    {
+        isErr = true;
+        lastErr = e.get();
+    }
+    return !isErr;
+}
 
-        // Check for spaces between parts and skip over them.
-        if (*curChr == ' ')
+// Partitions and converts the statement held in Input into m_Expr, printing any errors.
+bool Calc::Parse()
+{
+    // Reset the part vector and the error members
+    ClearParts();
+    isErr = false;
+
+    // Call the Partitioner
+    Partition();
+    if (isErr)
+    {
+        printError();
+        *Sink << "\tPartition Error\n\n";
+        return FAILURE;
+    }
+
+    // Blank lines are not statements.
+    if (m_Expr.empty())
+        return SUCCESS;
+
+    // Call the Converter. Matrices are made here, so it can run out of memory.
+    try
+    {
+        Convert();
+    }
+    catch (const CError& e)
+    {
+        isErr = true;
+        lastErr = e.get();
+    }
+    if (isErr)
+    {
+        printError();
+        *Sink << "\tConvert Error\n\n";
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Runs the statement Parse() left in m_Expr, either as a command or through the Interpreter, printing any errors.
+bool Calc::Execute()
+{
+    if (m_Expr.empty())
+        return SUCCESS;
+
+    // If the user inputs a special command, this will catch and execute it. Anything which runs out of memory stops
+    // where it is, with an error.
+    bool isCommand;
+    try
+    {
+        isCommand = CommandCheck();
+    }
+    catch (const CError& e)
+    {
+        isCommand = isErr = true;
+        lastErr = e.get();
+    }
+
+    if (isCommand)
+    {
+        if (isErr)
         {
-            ++curChr;           // Move to the next spot
-            startErr = curChr;  // Move the error tracker up as well.
-            continue;           // Start over
+            printError();
+            *Sink << "\tCommand Error\n\n";
+            return FAILURE;
         }
+        return SUCCESS;
+    }
 
-        // Look for a number
-        if (isDigit(*curChr))
+    // Call the Interpreter
+    try
+    {
+        Interpret();
+    }
+    catch (const CError& e)
+    {
+        isErr = true;
+        lastErr = e.get();
+    }
+    if (isErr)
+    {
+        printError();
+        *Sink << "\tInterpret Error\n\n";
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/**************** Parallel *****************
+
+When setThreads() gives the calculator more than one thread, runBatch() hands lines to RunPending() a window at a time.
+The window is run in three steps:
+
+    - Parse     :: Every line is partitioned and converted by its own worker Calc, all at once on the thread pool.
+    - Analyze   :: In program order, the parts of each statement give the variables it reads and writes (the
+                   assignment target, the incremented variable, or ans, along with anything bound to them, and any
+                   bound variables it reads, which it may recompute). A statement waits for the last earlier
+                   statement which wrote anything it reads or writes, and for every earlier statement since then which
+                   read what it writes. New assignment targets are created in the database here, in program order, so
+                   no worker ever adds to the database while the others are searching it.
+    - Run       :: Statements which are not waiting on anything go to the thread pool, and each one releases the ones
+                   waiting on it when it finishes. Output is collected per statement and written to Sink strictly in
+                   program order, so it is the same as a sequential run.
+
+Commands, lone words, bindings, and statements reading a variable which does not exist yet are barriers: everything before them
+finishes first, they are run on their own by this Calc through Process(), and analysis starts again after them.
+
+*/
+
+struct ParStmt
+{
+    Calc                calc;       // Worker which parses and runs the statement
+    ostringstream       out;        // Its output, held until it is committed
+    bool                parsed;     // Whether Parse() succeeded
+    uint64_t            parseNs;    // How long it took, if the worker keeps stats
+    vector<long>        next;       // Statements waiting for this one
+    atomic<int>         waitingOn;  // Unfinished statements this one is waiting for
+    bool                done;       // Guarded by ParWindow::lock
+
+    ParStmt(const Calc* parent) : calc{parent}, parsed{false}, parseNs{0}, waitingOn{0}, done{false} { calc.setSink(out); }
+};
+
+struct ParWindow
+{
+    vector<unique_ptr<ParStmt>> stmts;
+    mutex                       lock;
+    condition_variable          finished;   // Signalled whenever a statement finishes
+    CThreadPool                 pool;       // Last, so its threads are joined before anything they use goes away
+
+    ParWindow(int nThreads) : pool{nThreads} {}
+};
+
+Calc::Calc(const Calc* parent) : Source(parent->Source), Sink(parent->Sink), ErrSink(parent->ErrSink), m_db(parent->m_db), m_funcs(parent->m_funcs),
+    m_ans(parent->m_ans), quitNext{false}, m_pMemo(parent->m_pMemo), m_pMem(parent->m_pMem),
+    m_pStats{(parent->m_pStats != NULL) ? new CStats : NULL}, m_pTimed{NULL},
+    m_pProfile{(parent->m_pProfile != NULL) ? new CProfile : NULL}, m_pProfiling{NULL}, m_bTiming{false}, m_pName{NULL}, m_pValue{NULL}, m_bOwnsDB{false}, m_nThreads{1}, m_nWindow{PAR_WINDOW},
+    m_pPar{NULL}, m_pParams{NULL}, m_pFrame{NULL}, m_nDepth{0}, isErr{false}
+{}
+
+void Calc::setThreads(int nThreads, int window)
+{
+    m_nThreads = nThreads;
+    m_nWindow  = (window > 0) ? window : 1;
+    delete m_pPar;
+    m_pPar = (nThreads > 1) ? new ParWindow(nThreads) : NULL;
+}
+
+// Runs every line in m_Pending, returning how many were run (fewer than all of them if one was "quit").
+long Calc::RunPending()
+{
+    long n = m_Pending.size();
+    if (n == 0)
+        return 0;
+
+    ParWindow& win = *m_pPar;
+    while ((long)win.stmts.size() < n)
+        win.stmts.emplace_back(new ParStmt(this));
+
+    // Parse every line at once. Nothing here looks at the variables.
+    for (long k = 0; k < n; ++k)
+    {
+        ParStmt& st = *win.stmts[k];
+        st.calc.Input.swap(m_Pending[k]);
+        st.calc.Follow(*this);
+        st.out.str("");
+        st.next.clear();
+        st.done = false;
+        win.pool.submit([&st]
         {
-            curType = DOUBLE;
-            // Continue through the string until we reach a non-digit or the end.
-            while (curChr < endChr)
-            {
-                if (isDigit(*curChr))
-                    ++curChr; //Move forward
-                else
-                    break; //Continue in the main loop. We've reached the edge of this number.
-            }
-        }
-        // Look for a word
-        else if (isChar(*curChr))
+            CMemory::Scope scope(st.calc.m_pMem);
+            CStats* stats = st.calc.m_pStats;
+            st.calc.m_pTimed = (stats != NULL && stats->sample()) ? stats : NULL;
+            uint64_t start = (st.calc.m_pTimed != NULL) ? CStats::now() : 0;
+            CProfile* profile = st.calc.m_pProfile;
+            st.calc.m_pProfiling = (profile != NULL && profile->isOn()) ? profile : NULL;
+            CProfile::Scope profiling(st.calc.m_pProfiling);
+            if (st.calc.m_pProfiling != NULL)
+                st.calc.m_pProfiling->begin();
+            st.parsed = st.calc.Parse();
+            if (st.calc.m_pTimed != NULL)
+                st.parseNs = CStats::now() - start;
+        });
+    }
+    win.pool.wait();
+    m_Pending.clear();
+
+    long k = 0;
+    while (k < n && !quitNext)
+    {
+        // Statements [k, end) can be run together. If end is inside the window, it is a barrier.
+        long end = Analyze(k, n);
+        RunSegment(k, end);
+
+        if (end < n)
         {
-            curType = WORD;
-            // Continue through the string until we reach a non-word character or the end.
-            while (curChr < endChr)
+            Input.swap(win.stmts[end]->calc.Input);
+            Process();
+            ++end;
+
+            // The barrier may have been format, stats or profile, which the statements after it have to see. Ones
+            // which were parsed without stats or a profile which are now on are counted from when they run.
+            for (long j = end; j < n; ++j)
             {
-                if ((isChar(*curChr) || isDigit(*curChr)) && *curChr != '.')
-                    ++curChr;
-                else
-                    break;
+                Calc& w = win.stmts[j]->calc;
+                bool timing = (w.m_pStats != NULL && w.m_pStats->isOn());
+                bool profiling = (w.m_pProfile != NULL && w.m_pProfile->isOn());
+                w.Follow(*this);
+                if (w.m_pStats == NULL || !w.m_pStats->isOn())
+                    w.m_pTimed = NULL;
+                else if (!timing)
+                {
+                    w.m_pTimed = w.m_pStats->sample() ? w.m_pStats : NULL;
+                    win.stmts[j]->parseNs = 0;
+                }
+                if (w.m_pProfile == NULL || !w.m_pProfile->isOn())
+                    w.m_pProfiling = NULL;
+                else if (!profiling)
+                {
+                    w.m_pProfiling = w.m_pProfile;
+                    w.m_pProfiling->begin();
+                }
             }
         }
-        //Look for an operator
-        else if (isOp(*curChr))
-        {
-            curType = OPERATOR;
+        k = end;
+    }
 
-            // Stop if we've reached the end, there are no more characters.
-            if (curChr+1 == endChr)
-                break;
+    if (m_db->isVersioned())
+        Publish();
+    if (m_db->budget() > 0)
+        Spill();
+    return k;
+}
 
-            strItr nextChr = curChr + 1;
+// Works out the order statements first, first+1, ... have to run in, stopping at the first barrier. Returns the index of
+// the barrier, or n if there is none.
+long Calc::Analyze(long first, long n)
+{
+    // Who last wrote a variable, and who has read it since.
+    struct NameUse
+    {
+        long            lastWriter = -1;
+        vector<long>    readers;
+    };
+
+    ParWindow&                      win = *m_pPar;
+    unordered_map<int, NameUse>     uses;       // by symbol
+    vector<int>                     reads;
+    vector<int>                     writes;
+    vector<int>                     creates;
+    long                            k;
+
+    for (k = first; k < n; ++k)
+    {
+        ParStmt& st = *win.stmts[k];
+        st.waitingOn = 0;
 
-            switch (*curChr)
+        // Statements which did not parse only print their error, so they can go whenever.
+        if (!st.parsed || st.calc.m_Expr.empty())
+            continue;
+
+        if (!st.calc.Accesses(reads, writes))
+            break;
+
+        // Reading a variable nobody has made yet is an error, unless a later statement makes it first. Run it alone.
+        bool unknown = false;
+        for (size_t i = 0; i < reads.size() && !unknown; ++i)
+        {
+            unordered_map<int, NameUse>::iterator it = uses.find(reads[i]);
+            if ((it == uses.end() || it->second.lastWriter < 0) && m_db->search(reads[i]) == NULL)
+                unknown = true;
+        }
+        if (unknown)
+            break;
+
+        // Make k wait for statement pred.
+        auto after = [&](long pred)
+        {
+            vector<long>& next = win.stmts[pred]->next;
+            if (pred != k && (next.empty() || next.back() != k))
             {
-            case '+':
-                if (*nextChr == '+' || *nextChr == '=' ) // If this is a ++ or a +=
-                    ++curChr;
-                break;
-            case '-':
-                if (*nextChr == '-' || *nextChr == '=' ) // If this is a ++ or a +=)
-                    ++curChr;
-                break;
-            case '*':
-            case '/':
-                if (*nextChr == '=') // If this is a ++ or a +=)
-                    ++curChr;
-                break;
+                next.push_back(k);
+                ++st.waitingOn;
             }
+        };
 
-            // Whether a double op or not, we need to move to the next element in the string:
-            ++curChr;
+        for (size_t i = 0; i < reads.size(); ++i)
+        {
+            NameUse& use = uses[reads[i]];
+            if (use.lastWriter >= 0)
+                after(use.lastWriter);
+            use.readers.push_back(k);
         }
-        // Look for a parenthesis
-        else if (isParen(*curChr))
+
+        for (size_t i = 0; i < writes.size(); ++i)
         {
-            curType = BRACKET;
-            curChr++;
+            NameUse& use = uses[writes[i]];
+            if (use.lastWriter >= 0)
+                after(use.lastWriter);
+            else if (m_db->search(writes[i]) == NULL)
+                creates.push_back(writes[i]);
+
+            for (size_t i = 0; i < use.readers.size(); ++i)
+                after(use.readers[i]);
+            use.readers.clear();
+            use.lastWriter = k;
         }
-        // Look for a matrix
-        else if (*curChr == '[')
+    }
+
+    // Make the new variables now, in the order the statements would have made them.
+    for (size_t i = 0; i < creates.size(); ++i)
+        m_db->createVar(creates[i]);
+
+    return k;
+}
+
+void Calc::Follow(const Calc& parent)
+{
+    m_fmt.setSummary(parent.m_fmt.summaryAt(), parent.m_fmt.edge());
+    setStats(parent.m_pStats != NULL && parent.m_pStats->isOn());
+    setProfile(parent.m_pProfile != NULL && parent.m_pProfile->isOn());
+}
+
+// Runs statements [first, end) on the thread pool and commits their output in order.
+void Calc::RunSegment(long first, long end)
+{
+    ParWindow&   win = *m_pPar;
+    vector<long> ready;
+
+    // Find everything which can start before starting any of it, since finished statements release others.
+    for (long k = first; k < end; ++k)
+    {
+        if (win.stmts[k]->waitingOn == 0)
+            ready.push_back(k);
+    }
+    for (size_t i = 0; i < ready.size(); ++i)
+    {
+        long k = ready[i];
+        win.pool.submit([this, k]{ RunStmt(k); });
+    }
+
+    for (long k = first; k < end; ++k)
+    {
+        ParStmt& st = *win.stmts[k];
         {
-            curType = MATRIX;
-            ++curChr; // Move inside the bracket.
+            unique_lock<mutex> lock(win.lock);
+            win.finished.wait(lock, [&st]{ return st.done; });
+        }
 
-            // Loop through the parts inside the matrix
-            while (curChr < endChr)
+        string text = st.out.str();
+        Sink->write(text.data(), text.size());
+    }
+}
+
+// Runs statement k of the window on a pool thread, then releases the statements waiting for it.
+void Calc::RunStmt(long k)
+{
+    ParWindow& win = *m_pPar;
+    ParStmt&   st  = *win.stmts[k];
+
+    if (st.parsed)
+    {
+        CMemory::Scope scope(m_pMem);
+        CProfile::Scope profiling(st.calc.m_pProfiling);
+        uint64_t start = (st.calc.m_pTimed != NULL) ? CStats::now() : 0;
+        st.calc.Execute();
+        if (st.calc.m_pTimed != NULL)
+            st.calc.m_pTimed->record(SSTATEMENT, st.parseNs + CStats::now() - start);
+    }
+    // Its parse was counted on the thread which did it, so a statement which didn't parse still ends here.
+    if (st.calc.m_pProfiling != NULL)
+        st.calc.m_pProfiling->end(st.calc.Input);
+    st.calc.m_pProfiling = NULL;
+
+    for (size_t i = 0; i < st.next.size(); ++i)
+    {
+        long nx = st.next[i];
+        if (--win.stmts[nx]->waitingOn == 0)
+            win.pool.submit([this, nx]{ RunStmt(nx); });
+    }
+
+    {
+        lock_guard<mutex> lock(win.lock);
+        st.done = true;
+    }
+    win.finished.notify_all();
+}
+
+// Lists the variables the statement in m_Expr reads and the ones it writes, the same way Interpret() would find them.
+// Statements the Interpreter rejects before looking at any variable read and write nothing. Returns false for
+// commands, lone words and bindings, which have to run as barriers.
+bool Calc::Accesses(vector<int>& reads, vector<int>& writes)
+{
+    prtItr e_st = m_Expr.begin();
+    prtItr e_ed = m_Expr.end();
+    size_t ExprLen = e_ed - e_st;
+    prtItr nxtop = FindNextOp(e_st, e_ed);
+
+    reads.clear();
+    writes.clear();
+
+    if (ExprLen <= 2 && PRTOFST(0).type == WORD && (ExprLen == 1 || PRTOFST(1).type == WORD))
+        return false;
+    if (ExprLen > 2 && PRTOFST(0).type == WORD && PRTOFST(1).type == DOUBLE && strcmp(PRTOFST(0).wdata, "time") == 0)
+        return false;
+    if (PRTOFST(0).type == WORD && strcmp(PRTOFST(0).wdata, "function") == 0)
+        return false;
+
+    // Increments and decrements read and write their variable.
+    if (nxtop != e_ed && (nxtop->odata == INC || nxtop->odata == DEC) && ExprLen == 2)
+    {
+        if (PRTOFST(0).type == WORD)
+            writes.push_back(PRTOFST(0).sym);
+        else if (PRTOFST(1).type == WORD)
+            writes.push_back(PRTOFST(1).sym);
+        reads = writes;
+    }
+    else
+    {
+        // Leading or trailing operators and unmatched parentheses are rejected straight away.
+        if (PRTOFST(0).type == OPERATOR || (e_ed-1)->type == OPERATOR)
+            return true;
+
+        int baseOp = 0;
+        for (prtItr p = e_st; p < e_ed; ++p)
+        {
+            if (p->type == BRACKET && (baseOp += p->bdata) < 0)
+                return true;
+        }
+        if (baseOp != 0)
+            return true;
+
+        if (ExprLen > 2 && isAssign(PRTOFST(1)))
+        {
+            if (PRTOFST(1).odata == BIND)
+                return false;
+            if (PRTOFST(0).type != WORD)
+                return true;
+
+            writes.push_back(PRTOFST(0).sym);
+            if (AssignOpToOp(PRTOFST(1).odata) != ASN)
+                reads.push_back(PRTOFST(0).sym);
+            e_st += 2;
+        }
+        else
+            writes.push_back(m_db->getAns()->Symbol());
+
+        // Function bodies only use their arguments, so the names of calls aren't variables.
+        for (; e_st < e_ed; ++e_st)
+        {
+            bool call = (e_st+1 < e_ed && (e_st+1)->type == BRACKET && (e_st+1)->bdata > 0);
+            if (e_st->type == WORD && !(call && isFunction(e_st->wdata)))
+                reads.push_back(e_st->sym);
+        }
+    }
+
+    // Reading a bound variable may recompute it, which reads everything it depends on. Writing a variable marks
+    // everything bound to it out of date.
+    for (size_t i = 0; i < reads.size(); ++i)
+    {
+        CVariable* var = m_db->search(reads[i]);
+        if (var != NULL && var->isBound())
+        {
+            writes.push_back(var->Symbol());
+            for (size_t j = 0; j < var->Deps().size(); ++j)
+                reads.push_back(var->Deps()[j]->Symbol());
+        }
+    }
+    for (size_t i = 0; i < writes.size(); ++i)
+    {
+        CVariable* var = m_db->search(writes[i]);
+        for (size_t j = 0; var != NULL && j < var->Users().size(); ++j)
+            writes.push_back(var->Users()[j]->Symbol());
+    }
+    return true;
+}
+
+// Reads input from Source into Input
+bool Calc::ReadInput()
+{
+    //Get a line from my source and store it in Input
+    return bool(getline(*Source,Input, '\n'));
+}
+
+// List all the variables and functions. Called when the user types "who".
+void Calc::enumerateVars()
+{
+    for (int i = 0; i < m_db->size(); ++i)
+    {
+        CVariable* var = m_db->at(i);
+        if (var == NULL) // cleared
+            continue;
+
+        // Show bound variables as they are now. If one can't be computed, show what it was.
+        if (!Resolve(var))
+            isErr = false;
+
+        const char* name = var->Name();
+        m_fmt.add('\t').add(name);
+        for (size_t pad = strlen(name); pad < 4; ++pad)
+            m_fmt.add(' ');
+        m_fmt.add(" =  ").addPrinted(var->Value(), "\t\t ");
+        m_fmt.add("\t\t(").add(to_string(var->Value().Size() * sizeof(double))).add(" bytes)\n\n");
+    }
+
+    for (int i = 0; i < m_funcs->size(); ++i)
+        m_fmt.add("\tfunction ").add(m_funcs->at(i)->Signature()).add(" = ").add(m_funcs->at(i)->Text()).add("\n\n");
+    m_fmt.write(*Sink);
+}
+
+// Called when the user types "memory".
+void Calc::reportMemory()
+{
+    m_fmt.add("\tMemory: ").add(to_string(m_pMem->live())).add(" bytes now, ").add(to_string(m_pMem->peak()))
+         .add(" at most, in ").add(to_string(m_pMem->allocs())).add(" allocations. ");
+    if (m_pMem->quota() > 0)
+        m_fmt.add("The quota is ").add(to_string(m_pMem->quota())).add(" bytes.\n\n");
+    else
+        m_fmt.add("There is no quota.\n\n");
+    if (m_db->budget() > 0)
+        m_fmt.add("\tSpilled: ").add(to_string(m_db->spills())).add(" values (").add(to_string(m_db->bytesOut()))
+             .add(" bytes) to disk, ").add(to_string(m_db->reloads())).add(" (").add(to_string(m_db->bytesIn()))
+             .add(" bytes) read back. The budget is ").add(to_string(m_db->budget())).add(" bytes.\n\n");
+    m_fmt.write(*Sink);
+}
+
+// The statement turning stats off may be timing itself with them, so they are only paused.
+void Calc::setStats(bool on)
+{
+    if (on && m_pStats == NULL)
+        m_pStats = new CStats;
+    else if (m_pStats != NULL)
+        m_pStats->pause(!on);
+}
+
+// As with the stats, the statement turning the profile off is still counting with it.
+void Calc::setProfile(bool on)
+{
+    if (on && m_pProfile == NULL)
+        m_pProfile = new CProfile;
+    else if (m_pProfile != NULL)
+        m_pProfile->pause(!on);
+}
+
+// Called when the user types "profile". Workers of the parallel batch mode keep their own, which are added in.
+void Calc::reportProfile()
+{
+    if (m_pProfile == NULL)
+    {
+        *Sink << "\tProfiling is off. Type \"profile on\" to start counting allocations.\n\n";
+        return;
+    }
+
+    CProfile all;
+    all.merge(*m_pProfile);
+    all.pause(!m_pProfile->isOn());
+    for (size_t i = 0; m_pPar != NULL && i < m_pPar->stmts.size(); ++i)
+    {
+        if (m_pPar->stmts[i]->calc.m_pProfile != NULL)
+            all.merge(*m_pPar->stmts[i]->calc.m_pProfile);
+    }
+    all.report(*Sink);
+}
+
+// Called when the user types "stats". Workers of the parallel batch mode keep their own, which are added in.
+void Calc::reportStats()
+{
+    if (m_pStats == NULL)
+    {
+        *Sink << "\tStats are off. Type \"stats on\" to start keeping them.\n\n";
+        return;
+    }
+
+    CStats all;
+    all.merge(*m_pStats);
+    all.pause(!m_pStats->isOn());
+    for (size_t i = 0; m_pPar != NULL && i < m_pPar->stmts.size(); ++i)
+    {
+        if (m_pPar->stmts[i]->calc.m_pStats != NULL)
+            all.merge(*m_pPar->stmts[i]->calc.m_pStats);
+    }
+    all.report(*Sink);
+}
+
+// Checks whether the user has typed a special command. Commands will consist of 1 or 2 word parts.
+// the first being the name of the command and the second being an optional argument (not actually needed now)
+bool Calc::CommandCheck()
+{
+    CStats::Timer timer(m_pTimed, SCOMMAND);
+    prtItr command = m_Expr.begin();
+    short  ExprLen = m_Expr.size();
+    string cmdstr, args;
+
+    //time N expr runs expr N times and reports how long it took.
+    if (ExprLen > 2 && command->type == WORD && (command+1)->type == DOUBLE && strcmp(command->wdata, "time") == 0)
+    {
+        TimeExpr();
+        return true;
+    }
+
+    if (ExprLen <= 2 && command->type == WORD) // Is this a single-word command?
+    {
+        cmdstr = command->wdata;
+        if (cmdstr == "who")
+            enumerateVars();
+        else if (cmdstr == "memo" && ExprLen == 1)
+            m_pMemo->report(*Sink);
+        else if (cmdstr == "memory" && ExprLen == 1)
+            reportMemory();
+        else if (cmdstr == "stats" && ExprLen == 1)
+            reportStats();
+        else if (cmdstr == "profile" && ExprLen == 1)
+            reportProfile();
+        else if (cmdstr == "quit")
+        {
+            *Sink << "\tGoodbye!\n";
+            quitNext = true;
+        }
+        else if (ExprLen == 2 && (command+1)->type == WORD) //Is this a double-word command.
+        {
+            args = (command+1)->wdata;
+            if (cmdstr == "memo")
             {
-                // Check for the end of the matrix
-                if (*curChr == ']')
+                //memo clear empties the memo cache and resets its counters.
+                if (args == "clear")
+                    m_pMemo->clear();
+                else
+                    return false;
+            }
+            else if (cmdstr == "clear")
+            {
+                //clear x deletes the variable x.
+                CVariable* var = m_db->search(args.c_str());
+                isErr = true;
+                if (var == NULL)
+                    lastErr = "Unknown variable: " + args;
+                else if (var == m_db->getAns())
+                    lastErr = "ans cannot be cleared.";
+                else if (var->hasUsers())
+                    lastErr = "Cannot clear " + args + ", since " + var->Users()[0]->Name() + " is bound to it.";
+                else
                 {
-                    ++curChr; // Move outside the matrix
-                    break;
+                    isErr = false;
+                    m_db->remove(args.c_str());
+                }
+            }
+            else if (cmdstr == "memory")
+            {
+                //memory reset starts the peak over from what is held now.
+                if (args == "reset")
+                    m_pMem->resetPeak();
+                else
+                    return false;
+            }
+            else if (cmdstr == "stats")
+            {
+                //stats reset empties the histograms, and stats on and stats off start and stop keeping them.
+                if (args == "reset")
+                {
+                    if (m_pStats != NULL)
+                        m_pStats->reset();
+                    for (size_t i = 0; m_pPar != NULL && i < m_pPar->stmts.size(); ++i)
+                    {
+                        if (m_pPar->stmts[i]->calc.m_pStats != NULL)
+                            m_pPar->stmts[i]->calc.m_pStats->reset();
+                    }
+                }
+                else if (args == "on" || args == "off")
+                    setStats(args == "on");
+                else
+                    return false;
+            }
+            else if (cmdstr == "profile")
+            {
+                //profile reset forgets what has been counted, and profile on and profile off start and stop counting.
+                if (args == "reset")
+                {
+                    if (m_pProfile != NULL)
+                        m_pProfile->reset();
+                    for (size_t i = 0; m_pPar != NULL && i < m_pPar->stmts.size(); ++i)
+                    {
+                        if (m_pPar->stmts[i]->calc.m_pProfile != NULL)
+                            m_pPar->stmts[i]->calc.m_pProfile->reset();
+                    }
                 }
+                else if (args == "on" || args == "off")
+                    setProfile(args == "on");
+                else
+                    return false;
+            }
+            else if (cmdstr == "format")
+            {
+                //format short summarizes big matrices, format long prints them in full.
+                if (args == "short")
+                    m_fmt.setSummary(FMT_SUMMARY_AT);
+                else if (args == "long")
+                    m_fmt.setSummary(0);
+                else
+                    return false;
+            }
+            else if (cmdstr == "open")
+            {
+                //open a file (not implemented)
+                //Source = new ifstream(args);
+            }
+            else
+                return false;
+        }
+        else if (cmdstr == "open the doors") // special case of open
+            *Sink << "\tI'm sorry, Dave. I can't do that. \n\n";
+        else return false;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+// time N expr compiles expr once and evaluates it N times, with no echo, reporting the wall time of the runs and the
+// matrices each one allocated. Nothing is stored until the last run, whose result goes to ans. The memo cache is left
+// out, so every run does all of the work. Statements which change variables can't be timed.
+void Calc::TimeExpr()
+{
+    prtItr e_st = m_Expr.begin() + 2;
+    prtItr e_ed = m_Expr.end();
+    double runs = (m_Expr.begin()+1)->ndata;
+
+    isErr = true;
+    if (runs < 1 || runs > TIME_MAX || runs != (long)runs)
+    {
+        lastErr = "time needs a whole number of runs from 1 to " + to_string(TIME_MAX) + ".";
+        return;
+    }
+    for (prtItr p = e_st; p < e_ed; ++p)
+    {
+        if (p->type == OPERATOR && (isAssign(*p) || p->odata == INC || p->odata == DEC))
+        {
+            lastErr = "time only runs expressions. Assignments and increments would change the variables.";
+            return;
+        }
+    }
+    if (e_st->type == OPERATOR || (e_ed-1)->type == OPERATOR)
+    {
+        lastErr = "Invalid Syntax. An expression can't start or end with an operator.";
+        return;
+    }
+    int baseOp = 0;
+    for (prtItr p = e_st; p < e_ed && baseOp >= 0; ++p)
+    {
+        if (p->type == BRACKET)
+            baseOp += p->bdata;
+    }
+    if (baseOp != 0)
+    {
+        lastErr = "Unmatched parentheses. Cannot parse.";
+        return;
+    }
+    isErr = false;
+
+    unique_ptr<CExpr> expr(CompileAll(e_st, e_ed));
+    if (isErr || !Infer(expr.get()))
+        return;
+
+    long n = (long)runs;
+    vector<uint64_t> ns(n);
+    long long allocs = m_pMem->allocs();
+    m_bTiming = true;
+    try
+    {
+        for (long i = 0; i < n && !isErr; ++i)
+        {
+            CMatrix tmp;
+            uint64_t start = CStats::now();
+            const CMatrix& result = Eval(expr.get(), tmp);
+            ns[i] = CStats::now() - start;
+            if (!isErr && i == n - 1)
+            {
+                allocs = m_pMem->allocs() - allocs;
+                Assign(m_db->getAns(), result);
+            }
+        }
+    }
+    catch (const CError&)
+    {
+        m_bTiming = false;
+        throw;
+    }
+    m_bTiming = false;
+    if (isErr)
+        return;
+
+    double mean = 0, var = 0;
+    for (long i = 0; i < n; ++i)
+        mean += ns[i];
+    mean /= n;
+    for (long i = 0; i < n; ++i)
+        var += (ns[i] - mean) * (ns[i] - mean);
+    double stddev = (n > 1) ? sqrt(var / (n - 1)) : 0;
+    sort(ns.begin(), ns.end());
+    double median = (n % 2 == 1) ? ns[n / 2] : (ns[n / 2 - 1] + ns[n / 2]) / 2.0;
+
+    ostringstream out;
+    out << fixed << setprecision(3) << '\t' << n << (n == 1 ? " run" : " runs") << " (us): min " << ns[0] / 1000.0
+        << ", median " << median / 1000.0 << ", mean " << mean / 1000.0 << ", stddev " << stddev / 1000.0
+        << "\n\tAllocations per run: " << setprecision(1) << double(allocs) / n << "\n\n";
+    *Sink << out.str();
+}
+
+// snapshot file saves every variable to file, and restore file brings them back (see CSnapshot). The file name is the
+// rest of the line.
+bool Calc::FileCommand()
+{
+    size_t rest;
+    string cmdstr = Keyword(Input, rest);
+    if (cmdstr != "snapshot" && cmdstr != "restore")
+        return false;
+
+    // Anything else after the word is an expression using a variable of that name (snapshot * 2), unless it's a path.
+    size_t ed = Input.find_last_not_of(" \t");
+    if (rest >= Input.size() || (isOp(Input[rest]) && Input[rest] != '/') || Input[rest] == '(')
+        return false;
+    string path = Input.substr(rest, ed + 1 - rest);
+
+    int count;
+    if (cmdstr == "snapshot")
+    {
+        // Bound variables are saved as their values, so they have to be up to date.
+        for (int i = 0; i < m_db->size(); ++i)
+        {
+            if (m_db->at(i) != NULL && !Resolve(m_db->at(i)))
+                return true;
+        }
+        count = CSnapshot::save(*m_db, path, lastErr);
+    }
+    else
+        count = CSnapshot::restore(*m_db, path, lastErr);
+
+    if (count < 0)
+    {
+        isErr = true;
+        return true;
+    }
+
+    *Sink << '\t' << (cmdstr == "snapshot" ? "Saved " : "Restored ") << count << (count == 1 ? " variable" : " variables")
+          << (cmdstr == "snapshot" ? " to " : " from ") << path << "\n\n";
+    return true;
+}
+
+/*********** Partitioner *************
+
+The Partitioner separates the Input string into segments based on word/number/matrix/operator boundaries and fills the vector
+m_Expr with part objects. The partitioner does not convert strings to doubles or operators, it simply stores start and end
+iterators in each part object so that the converter can go back later and convert things.
+
+Accepted signatures:
+    - Double   (any digit 0-9 and the decimal point "."; truncated at first non-digit.)
+    - Word     (any character A-Z and a-z as well as "_" and any digits not in the first position.)
+    - Operator (any single operator +, -, *, /, ^, %, =, <, >, or the double operators +=, -=, *=, /=, ++, --, :=, ==, !=, <=, >=.)
+    - Paren    (any close or open parenthesis.)
+    - Comma    (separates the arguments of a function.)
+    - Matrix   (any sequence between two square brackets [ and ]; partitioner does not check the validity of the matrix, but it does check for invalid characters. )
+*/
+bool Calc::Partition()
+{
+    CStats::Timer timer(m_pTimed, SPARTITION);
+    CProfile::Area area(m_pProfiling, PTOKENS);
+    strItr curChr   = Input.begin();    // Tracks the current position
+    strItr startChr = curChr;           // Tracks the start position of the current part we're reading
+    PARTTYPE curType;                   // The current part type to add to the vector
+    strItr endChr   = Input.end();      // The end position of the input string
+
+    strItr startErr = curChr;           // Tracks the beginning of a lexical segment which is used for nice error reporting
+
+    // Loop through the whole string
+    while(curChr < endChr)
+    {
+        startChr = curChr; // Update the start tracker to the current position, which is always at the beginning of a part.
+
+        // Check for spaces between parts and skip over them.
+        if (*curChr == ' ')
+        {
+            ++curChr;           // Move to the next spot
+            startErr = curChr;  // Move the error tracker up as well.
+            continue;           // Start over
+        }
+
+        // Look for a number
+        if (isDigit(*curChr))
+        {
+            curType = DOUBLE;
+            // Continue through the string until we reach a non-digit or the end.
+            while (curChr < endChr)
+            {
+                if (isDigit(*curChr))
+                    ++curChr; //Move forward
+                else
+                    break; //Continue in the main loop. We've reached the edge of this number.
+            }
+        }
+        // Look for a word
+        else if (isChar(*curChr))
+        {
+            curType = WORD;
+            // Continue through the string until we reach a non-word character or the end.
+            while (curChr < endChr)
+            {
+                if ((isChar(*curChr) || isDigit(*curChr)) && *curChr != '.')
+                    ++curChr;
+                else
+                    break;
+            }
+        }
+        //Look for an operator
+        else if (isOp(*curChr))
+        {
+            curType = OPERATOR;
+
+            // Stop if we've reached the end, there are no more characters.
+            if (curChr+1 == endChr)
+                break;
+
+            strItr nextChr = curChr + 1;
+
+            switch (*curChr)
+            {
+            case '+':
+                if (*nextChr == '+' || *nextChr == '=' ) // If this is a ++ or a +=
+                    ++curChr;
+                break;
+            case '-':
+                if (*nextChr == '-' || *nextChr == '=' ) // If this is a ++ or a +=)
+                    ++curChr;
+                break;
+            case '*':
+            case '/':
+            case ':':
+            case '=':
+            case '<':
+            case '>':
+            case '!':
+                if (*nextChr == '=') // If this is a *=, /=, :=, ==, <=, >= or !=
+                    ++curChr;
+                break;
+            }
+
+            // Whether a double op or not, we need to move to the next element in the string:
+            ++curChr;
+        }
+        // Look for a parenthesis
+        else if (isParen(*curChr))
+        {
+            curType = BRACKET;
+            curChr++;
+        }
+        // Look for a comma between function arguments
+        else if (*curChr == ',')
+        {
+            curType = COMMA;
+            curChr++;
+        }
+        // Look for a matrix
+        else if (*curChr == '[')
+        {
+            curType = MATRIX;
+            ++curChr; // Move inside the bracket.
+
+            // Loop through the parts inside the matrix
+            while (curChr < endChr)
+            {
+                // Check for the end of the matrix
+                if (*curChr == ']')
+                {
+                    ++curChr; // Move outside the matrix
+                    break;
+                }
+
+                // Check for spaces.
+                if (*curChr == ' ' || *curChr == '\t')
+                {
+                    ++curChr;
+
+                    // Skip remaining whitespace
+                    while (*curChr == ' ' || *curChr == '\t')
+                        ++curChr;
+
+                    continue; // Restart the main matrix loop.
+                }
+
+                // Check whether this is a digit element or a semicolon or a comma (we accept spaces, but the above 'if' throws extras out.
+                if (isDigit(*curChr) || *curChr == ';' || *curChr == ',')
+                {
+                    ++curChr;
+                }
+                else if (curChr >= endChr) // If we reach the end of the line prematurely
+                {
+                    // Create the error message and return a fail.
+                    isErr = true;
+                    lastErr = "Unexpected End-of-expression in matrix.";
+                    substr_cpy(lastErr, startErr, curChr+1); //Append descriptor
+
+                    return FAILURE;
+                }
+                else
+                {
+                    // Create the error message and return a fail.
+                    isErr = true;
+                    lastErr = "Invalid matrix element: ";
+                    substr_cpy(lastErr, startErr, curChr+1); //Append descriptor
+
+                    return FAILURE; //FAIL! AN ERROR!
+                }
+            } // End of matrix loop
+        } // End of matrix test
+        // If the character is invalid in the whole expression
+        else
+        {
+            //Create the error message and return a fail.
+            isErr = true;
+            lastErr = "Invalid syntax or character: ";
+            lastErr += *curChr;
+
+            return FAILURE; //FAIL! OH NO!
+        }
+
+        // Now curChr is at the end of the current part, and startChr is at the beginning.
+        // Add the part to the expression vector
+        size_t capacity = m_Expr.capacity();
+        m_Expr.push_back(part{curType, startChr, curChr});
+        if (m_pProfiling != NULL && m_Expr.capacity() != capacity)
+        {
+            m_pProfiling->allocated(m_Expr.capacity() * sizeof(part));
+            if (capacity > 0)
+                m_pProfiling->freed(capacity * sizeof(part));
+        }
+
+    } //End of main while
+    return SUCCESS;
+}
+
+
+/*********** Converter *************
+
+The Converter takes the part objects in m_Expr and looks at the portion of the input string between the start and end
+iterators for each part. Based on the type of the part, it converts the data in the string to a valid computer
+representation. It then adds this data to the data union in the part object.
+
+- For string->double conversion, I loop through the digits and add on each successive digit to 10 times the sum of the previous digits.
+  When I reach a decimal point, I begin counting until the end of the loop. Then I divide the entire sum by 10^(decimal_count) to get
+  final double.
+
+- Strings are copied directly as character arrays into a dynamic array whose pointer is given to the part object. They are
+  also interned in the variable database, and everything after this refers to the variable by its symbol.
+
+- Parentheses are converted into a signed value (+- OPLEVELRANGE) which the Interpreter adds up to check that they match.
+
+- Matrices are created by calling their string constructor on a temporary character array which has had the matrix string from Input copied into it.
+
+- Operators are encoded via the EncodeOp() function.
+
+*/
+bool Calc::Convert()
+{
+    CStats::Timer timer(m_pTimed, SCONVERT);
+    CProfile::Area area(m_pProfiling, PTOKENS);
+    prtItr e_st = m_Expr.begin();
+    prtItr e_ed = m_Expr.end();
+
+    // First go through and convert all the data to the appropriate forms.
+    for(; e_st < e_ed; ++e_st)
+    {
+        switch(e_st->type)
+        {
+        case DOUBLE:
+        {
+            // Convert the data to a double
+            int decpwr = 0;
+            strItr chr = e_st->st;
+
+            // Set ndata to zero
+            e_st->ndata = 0.0;
+
+            // Here we read in the string characters and convert them to a double.
+            do
+            {
+                //If we have reached or passed the decimal point, keep counting up.
+                if (*chr =='.')
+                {
+                    decpwr = 1;
+                    chr++;
+                    continue;
+                }
+                if (decpwr > 0.0)
+                    decpwr *= 10;
+
+                // Multiply whatever is in the element by 10 and add in the current value as a ones place.
+                e_st->ndata *= 10;
+                e_st->ndata  += *chr - '0';
+                // Move forward in the string
+                ++chr;
+            } while(chr < e_st->ed );
+
+            // Divide by the proper power.
+            if (decpwr > 0.0)
+                e_st->ndata  /= decpwr;
+        break; } //End of DOUBLE
+        case WORD: {
+            // Allocate new memory for storing a copy of just this word
+            size_t strlen = std::distance(e_st->st, e_st->ed);
+            e_st->wdata = new char [strlen+1]; //Make a new wordstring
+            if (m_pProfiling != NULL)
+                m_pProfiling->allocated(strlen + 1);
+            substr_cpy(e_st->wdata, e_st->st, e_st->ed); //Copy the characters from Input
+            e_st->wdata[strlen] = 0; //Append null char
+            e_st->sym = m_db->intern(e_st->wdata); //Look the name up once, here
+
+            break; }
+        case OPERATOR: {
+            // Set the op type to be right
+            e_st->odata = EncodeOP(e_st->st);
+            break; }
+        case MATRIX: {
+            // Create a new matrix object from a copy of its characters, which frees itself even if there isn't the
+            // memory for the matrix.
+            string tmpstr(e_st->st, e_st->ed);
+            e_st->mdata = new CMatrix{&tmpstr[0]}; // Create a new matrix.
+            if (m_pProfiling != NULL)
+                m_pProfiling->allocated(sizeof(CMatrix));
+            break; }
+        case BRACKET:
+                // Set to +OPLEVELRANGE if left bracket, -OPLEVELRANGE if right bracket.
+                e_st->bdata = OPLEVELRANGE;
+                if (*e_st->st == ')') {e_st->bdata *= -1;}
+                break;
+        case COMMA:
+        case END:
+            break;
+        } // End of switch
+    } // End of for
+    return SUCCESS;
+}
+
+/*********** Interpreter *************
+
+The Interpreter reads the parts in m_Expr and figures out whether an increment, assignment, and/or calculations
+is being expressed. It then performs the appropriate actions.
+
+- If there is an increment or decrement operator and the expression is exactly two parts long,
+  the interpreter searches the variable database for a variable to increment or decrement. If
+  it cannot find one, it returns an error, otherwise it performs the operation.
+
+- If there is an assignment (=, +=, -=, *=, /=), the expression after it is compiled and evaluated and the result is
+  stored in the variable before it, which is created if needed. A binding (:=) keeps the compiled expression in the
+  variable instead, which recomputes itself from it whenever it is read after something it depends on has changed.
+
+- If there is no equals sign, the expression is compiled and evaluated and the result is stored in ans.
+
+- If it starts with "function", it is a function definition, which is handed to Define().
+
+
+Accepted signatures:
+    - Double   (any digit 0-9 and the decimal point "."; truncated at first non-digit.)
+    - Word     (any character A-Z and a-z as well as "_" and any digits not in the first position.)
+    - Operator (any single operator +, -, *, /, ^, %, =, <, >, or the double operators +=, -=, *=, /=, ++, --, :=, ==, !=, <=, >=.)
+    - Paren    (any close or open parenthesis.)
+    - Matrix   (any sequence between two square brackets [ and ]; partitioner does not check the validity of the matrix, but it does check for invalid characters. )
+*/
+bool Calc::Interpret()
+{
+    CStats::Timer timer(m_pTimed, SINTERPRET);
+    prtItr e_st = m_Expr.begin();
+    prtItr e_ed = m_Expr.end();
+    size_t ExprLen = e_ed - e_st;
+    CVariable* asnTo;
+    CMatrix calcValue{0.0}; //Holds temporary calculation variable so we can check for errors.
+
+    if (PRTOFST(0).type == WORD && strcmp(PRTOFST(0).wdata, "function") == 0)
+        return Define();
+
+    //Find the next operator for later on.
+    prtItr nxtPart = FindNextOp(e_st,e_ed);
+    OP nxtop = (nxtPart != e_ed) ? nxtPart->odata : NULLOP;
+
+    // Check whether this is a basic increment or decrement.
+    if ((nxtop == INC || nxtop == DEC ) && ExprLen == 2)
+    {
+        // We only handle increments or decrement in 2-part expressions: OP + WORD or WORD + OP.
+        if (PRTOFST(0).type == WORD)
+            asnTo = m_db->search(PRTOFST(0).sym);
+        else if (PRTOFST(1).type == WORD)
+            asnTo = m_db->search(PRTOFST(1).sym);
+        else
+        {
+            isErr = true;
+            lastErr = "Expected variable expression. Cannot ";
+            lastErr += (nxtop == INC) ? "increment" : "decrement";
+            lastErr += " numbers or matrices.";
+            return FAILURE;
+        }
+
+        // Check whether the variable existed
+        if (asnTo == 0)
+        {
+            isErr = true;
+            lastErr = "Could not find varaible for ";
+            lastErr += (nxtop == INC) ? "increment" : "decrement";
+            lastErr += ". Please use an existing variable.";
+            return FAILURE;
+        }
+
+        // Add or take away one, from every element of a matrix.
+        if (!Resolve(asnTo) || !Update(asnTo, (nxtop == INC) ? ADD : SUB, s_One))
+            return FAILURE;
+
+    }
+    else
+    {
+        // The first element can't be an operator.
+        if (e_st->type == OPERATOR)
+        {
+            isErr = true;
+            lastErr = "Invalid Syntax. Must have non-operator element in first position.";
+            return FAILURE;
+        }
+        // The last element can't be an operator.
+        if ((e_ed-1)->type == OPERATOR)
+        {
+            isErr = true;
+            lastErr = "Invalid Syntax. Must have non-operator element in last position.";
+            return FAILURE;
+        }
+
+        // Check that every parenthesis is matched before compiling anything.
+        int baseOp = 0;
+        for (; e_st < e_ed; ++e_st)
+        {
+            if (e_st->type == BRACKET)
+            {
+                baseOp += e_st->bdata;
+                if (baseOp < 0)
+                    break;
+            }
+        }
+
+        if (baseOp != 0)
+        {
+            isErr = true;
+            lastErr = "Unmatched parentheses. Cannot parse.";
+            return FAILURE;
+        }
+
+        // Move the start iterator back to the beginning
+        e_st = m_Expr.begin();
+
+        // Check for just a word. If it is an existing variable, echo the value of that variable.
+        if (PRTOFST(0).type == WORD && ExprLen == 1)
+        {
+            // Look for the variable in the database
+            asnTo = m_db->search(PRTOFST(0).sym);
+
+            // If the Interpreter cannot find the variable, then return an error.
+            if (asnTo == 0)
+            {
+                isErr = true;
+                lastErr = "Unknown command or variable: ";
+                substr_cpy(lastErr, PRTOFST(0).st, PRTOFST(0).ed);
+
+                return FAILURE;
+            }
+
+        }
+        // Check for an assignment to a variable explicitly.
+        else if (ExprLen > 2 && isAssign(PRTOFST(1)))
+        {
+            // Are we trying to assign to something other than a word? This is an error.
+            if (PRTOFST(0).type != WORD)
+            {
+                isErr = true;
+                lastErr = "Cannot assign to non-variable type. That would break math.";
+                return FAILURE;
+            }
+
+            // See if the variable is already in the database and if not, create it.
+            asnTo = m_db->search(PRTOFST(0).sym);
+            if (asnTo == 0)
+                asnTo = m_db->createVar(PRTOFST(0).sym);
+
+            // Get the type of assignment (=, +=, :=, etc.)
+            OP asnOp = PRTOFST(1).odata;
+            OP asnType = AssignOpToOp(asnOp);
+
+            // Compile whatever is beyond the equals sign. The sizes a binding will see aren't known yet.
+            e_st += 2;
+            unique_ptr<CExpr> expr(CompileAll(e_st, e_ed));
+            if (isErr || !Infer(expr.get(), asnOp != BIND))
+                return FAILURE;
+
+            // Is it a binding, which keeps the expression...
+            if (asnOp == BIND)
+            {
+                if (!Bind(asnTo, expr.release()))
+                    return FAILURE;
+            }
+            // ...plain old assignment...
+            else if (asnType == ASN)
+            {
+                if (!Store(asnTo, expr.get(), calcValue))
+                    return FAILURE;
+            }
+            // ...or a fancy one?
+            else
+            {
+                const CMatrix& result = Eval(expr.get(), calcValue);
+
+                //If there is no error in the calculation, then perform the fancy assignment.
+                if (isErr || !Resolve(asnTo) || !Update(asnTo, asnType, result))
+                    return FAILURE;
+            }
+        }
+        // Handle non-assignments (i.e. assign to "ans")
+        else
+        {
+            asnTo = m_db->getAns();
+
+            // Call the calculator on the entire expression (there is no equals sign, it is implied).
+            unique_ptr<CExpr> expr(CompileAll(e_st, e_ed));
+            if (isErr || !Infer(expr.get()))
+                return FAILURE;
+
+            const CMatrix& result = Eval(expr.get(), calcValue);
+
+            // If there is no error, then actually assign the returned value.
+            if (!isErr)
+                Assign(asnTo, result);
+            else
+                return FAILURE;
+        }
+    }
+
+    // Bound variables are only computed when somebody looks at them, and this is one of those times.
+    if (!Resolve(asnTo))
+        return FAILURE;
+
+    //Echo the variable onto the screen
+    Echo(asnTo);
+
+    return SUCCESS;
+}
+
+// Defines a function: function y = f(a, b) = a*b + 1. The result name (y =) is optional. The body is compiled here,
+// once, with its arguments turned into slots.
+bool Calc::Define()
+{
+    prtItr e_st = m_Expr.begin() + 1;
+    prtItr e_ed = m_Expr.end();
+    string out;
+    vector<string> params;
+
+    auto syntaxError = [this]()
+    {
+        isErr = true;
+        lastErr = "Invalid function definition. Expected: function y = f(a, b) = expression";
+        return FAILURE;
+    };
+
+    // The result name
+    if (e_ed - e_st > 2 && PRTOFST(0).type == WORD && PRTOFST(1).type == OPERATOR && PRTOFST(1).odata == ASN)
+    {
+        out = PRTOFST(0).wdata;
+        e_st += 2;
+    }
+
+    // The function name and its opening parenthesis
+    if (e_ed - e_st < 2 || PRTOFST(0).type != WORD || PRTOFST(1).type != BRACKET || PRTOFST(1).bdata < 0)
+        return syntaxError();
+    string name = PRTOFST(0).wdata;
+    e_st += 2;
+
+    if (CMathLib::find(name.c_str()) != NULL)
+    {
+        isErr = true;
+        lastErr = "\"" + name + "\" is a built-in function.";
+        return FAILURE;
+    }
+
+    // The arguments, up to the closing parenthesis
+    if (e_st < e_ed && e_st->type == BRACKET && e_st->bdata < 0)
+        ++e_st;
+    else
+    {
+        while (true)
+        {
+            if (e_ed - e_st < 2 || PRTOFST(0).type != WORD)
+                return syntaxError();
+            if (find(params.begin(), params.end(), PRTOFST(0).wdata) != params.end())
+            {
+                isErr = true;
+                lastErr = "Argument \"";
+                lastErr += PRTOFST(0).wdata;
+                lastErr += "\" is given twice.";
+                return FAILURE;
+            }
+            params.push_back(PRTOFST(0).wdata);
+
+            if (PRTOFST(1).type == COMMA)
+                e_st += 2;
+            else if (PRTOFST(1).type == BRACKET && PRTOFST(1).bdata < 0)
+            {
+                e_st += 2;
+                break;
+            }
+            else
+                return syntaxError();
+        }
+    }
+
+    if (params.size() > FUNC_MAX_ARGS)
+    {
+        isErr = true;
+        lastErr = "Functions can take at most " + to_string(FUNC_MAX_ARGS) + " arguments.";
+        return FAILURE;
+    }
+
+    // And the body
+    if (e_ed - e_st < 2 || PRTOFST(0).type != OPERATOR || PRTOFST(0).odata != ASN)
+        return syntaxError();
+    ++e_st;
+
+    m_pParams = &params;
+    unique_ptr<CExpr> body(CompileAll(e_st, e_ed));
+    m_pParams = NULL;
+    if (isErr)
+        return FAILURE;
+
+    // Without conditionals, a function which calls itself would never finish.
+    CFunction* func = m_funcs->search(name.c_str());
+    if (func != NULL && body->calls(func))
+    {
+        isErr = true;
+        lastErr = "Function \"" + name + "\" cannot call itself.";
+        return FAILURE;
+    }
+
+    func = m_funcs->define(name, out, params, body.release(), string(e_st->st, (e_ed-1)->ed));
+
+    m_fmt.add("\tfunction ").add(func->Signature()).add(" = ").add(func->Text()).add("\n\n");
+    m_fmt.write(*Sink);
+    return SUCCESS;
+}
+
+// Echos a variable to the terminal.
+void Calc::Echo(CVariable* var)
+{
+    CStats::Timer timer(m_pTimed, SECHO);
+    // The copy belongs to whoever asked, so it isn't charged to the session (though paging the variable in is).
+    if (m_pValue != NULL)
+    {
+        const CMatrix& value = var->Value();
+        CMemory::Scope none(NULL);
+        *m_pName  = var->Name();
+        *m_pValue = value;
+        return;
+    }
+    m_fmt.add('\t').add(var->Name()).add(" = ").addMatrix(var->Value()).add("\n\n");
+    m_fmt.write(*Sink);
+}
+
+// Stores value in var. A plain assignment replaces any binding var had, and the variables bound to var are only told
+// about it if the value really changed.
+void Calc::Assign(CVariable* var, const CMatrix& value)
+{
+    var->Unbind();
+
+    if (var->hasUsers())
+    {
+        if (var->Value() == value)
+            return;
+        *var = value;
+        var->Invalidate();
+    }
+    else
+        *var = value;
+}
+
+// Stores the value of expr in var. When expr ends in an operator, Eval is handed var's own storage instead of tmp, so
+// the last kernel writes the result straight into it, with no copy and, if the size hasn't changed, no new matrix. The
+// operands are all calculated before that kernel writes anything, and Eval falls back on a temporary if the kernel
+// can't write over an operand which is var itself (x = A*x), so var is never changed by a statement which fails.
+bool Calc::Store(CVariable* var, const CExpr* expr, CMatrix& tmp)
+{
+    if (expr->type != XOP)
+    {
+        const CMatrix& result = Eval(expr, tmp);
+        if (isErr)
+            return FAILURE;
+        Assign(var, result);
+        return SUCCESS;
+    }
+
+    Eval(expr, var->Value());
+    if (isErr)
+        return FAILURE;
+
+    // The old value is gone, so there's no telling whether it changed.
+    var->Unbind();
+    var->Touch();
+    var->Invalidate();
+    return SUCCESS;
+}
+
+// Applies var op= value for an arithmetic op. Element-wise updates are done in the variable's own storage in a single
+// pass, with no new matrix, and value may be the variable itself (a += a). Matrix products, and updates which change
+// the size of var, calculate a new matrix first, as they can't overwrite an element while it is still needed. On errors
+// var is left as it was.
+bool Calc::Update(CVariable* var, OP op, const CMatrix& value)
+{
+    CMatrix& own = var->Value();
+    int rows, cols;
+    OPKERNEL kernel = CKernel::plan(op, own.getNRow(), own.getNCol(), value.getNRow(), value.getNCol(), rows, cols, lastErr);
+    if (kernel == KNONE)
+    {
+        isErr = true;
+        return FAILURE;
+    }
+
+    bool done;
+    if (kernel == KSCALAR || kernel == KMATSCALAR || kernel == KELEMENT)
+        done = CKernel::update(kernel, op, own, value);
+    else
+    {
+        CMatrix result;
+        done = CKernel::run(kernel, op, own, value, result);
+        if (done)
+            own.swap(result);
+    }
+
+    if (!done)
+    {
+        isErr = true;
+        lastErr = "Friends don't let friends divide by zero. Are you my friend?";
+        return FAILURE;
+    }
+
+    var->Unbind();
+    var->Touch();
+    var->Invalidate();
+    return SUCCESS;
+}
+
+// Binds var to expr (c := a*b + d), taking ownership of expr. The value is not computed until var is read.
+bool Calc::Bind(CVariable* var, CExpr* expr)
+{
+    vector<CVariable*> deps;
+    expr->variables(deps);
+
+    // A variable can't be computed from itself.
+    for (size_t i = 0; i < deps.size(); ++i)
+    {
+        if (deps[i] == var || deps[i]->DependsOn(var))
+        {
+            delete expr;
+            isErr = true;
+            lastErr = "Cannot bind \"";
+            lastErr += var->Name();
+            lastErr += "\" to an expression which depends on it.";
+            return FAILURE;
+        }
+    }
+
+    var->Bind(expr);
+    return SUCCESS;
+}
+
+// Brings a bound variable up to date if anything it depends on has changed since it was last computed. Anything it
+// depends on is brought up to date first, by Eval. Clean variables are left alone.
+bool Calc::Resolve(CVariable* var)
+{
+    if (!var->isDirty())
+        return SUCCESS;
+
+    CMatrix tmp;
+    const CMatrix& value = Eval(var->Binding(), tmp);
+    if (isErr)
+        return FAILURE;
+
+    // Anything bound to var was marked out of date along with it, so there's nobody else to tell.
+    *var = value;
+    var->SetClean();
+    return SUCCESS;
+}
+
+/*********** Loops *************
+
+A line starting with "for" or "while" opens a loop, and Process() collects it and the lines after it in m_Block
+instead of running them, until an "end" closes it. Loops can be nested, and m_nDepth counts how many are still open.
+
+    for i = 1:10        ::: i takes every value from 1 to 10. for i = 10:-2:1 counts down in steps of 2, and
+        ...                 for i = [3 1 4] takes every element of the matrix in turn, row after row.
+    end
+    while x < 100       ::: Runs for as long as every element of the condition is nonzero.
+        ...
+    end
 
-                // Check for spaces.
-                if (*curChr == ' ' || *curChr == '\t')
-                {
-                    ++curChr;
+Once the loop is complete it is compiled as a whole by CompileLoop(): every line of the body is partitioned,
+converted and compiled exactly once into a CStmt, with the variables it uses already looked up, and the loop then runs
+the compiled statements without going back to the text. A range is calculated once, before the first iteration, and
+the loop variable is set in place each time around. Nothing is echoed while a loop runs; the variables keep their
+last values afterwards and can be looked at then.
 
-                    // Skip remaining whitespace
-                    while (*curChr == ' ' || *curChr == '\t')
-                        ++curChr;
+The body may hold assignments, increments, expressions and other loops. Commands, bindings and function definitions
+have to go outside. The first error in any line stops the whole loop, naming the line it was in.
 
-                    continue; // Restart the main matrix loop.
-                }
+*/
+// The first word of line, with rest set to where what follows it starts (or the end of the line). Empty if the line
+// doesn't start with a word, or if the word is a variable being assigned to (for = 4, restore += 1). Lets loops and
+// file commands be found before anything is partitioned.
+string Calc::Keyword(const string& line, size_t& rest)
+{
+    rest = line.size();
+    size_t st = line.find_first_not_of(" \t");
+    if (st == string::npos)
+        return "";
 
-                // Check whether this is a digit element or a semicolon or a comma (we accept spaces, but the above 'if' throws extras out.
-                if (isDigit(*curChr) || *curChr == ';' || *curChr == ',')
-                {
-                    ++curChr;
-                }
-                else if (curChr >= endChr) // If we reach the end of the line prematurely
-                {
-                    // Create the error message and return a fail.
-                    isErr = true;
-                    lastErr = "Unexpected End-of-expression in matrix.";
-                    substr_cpy(lastErr, startErr, curChr+1); //Append descriptor
+    size_t ed = st;
+    while (ed < line.size() && (isChar(line[ed]) || isDigit(line[ed])))
+        ++ed;
 
-                    return FAILURE;
-                }
-                else
-                {
-                    // Create the error message and return a fail.
-                    isErr = true;
-                    lastErr = "Invalid matrix element: ";
-                    substr_cpy(lastErr, startErr, curChr+1); //Append descriptor
+    size_t nx = line.find_first_not_of(" \t", ed);
+    if (nx != string::npos)
+    {
+        rest = nx;
+        char c = line[nx];
+        char d = (nx + 1 < line.size()) ? line[nx+1] : 0;
+        if ((c == '=' && d != '=') || (d == '=' && strchr("+-*/:", c)) || ((c == '+' || c == '-') && d == c))
+            return "";
+    }
+    return line.substr(st, ed - st);
+}
 
-                    return FAILURE; //FAIL! AN ERROR!
-                }
-            } // End of matrix loop
-        } // End of matrix test
-        // If the character is invalid in the whole expression
-        else
-        {
-            //Create the error message and return a fail.
-            isErr = true;
-            lastErr = "Invalid syntax or character: ";
-            lastErr += *curChr;
+int Calc::LoopDepth(const string& line)
+{
+    size_t rest;
+    string word = Keyword(line, rest);
+    if (word == "for" || word == "while")
+        return (rest < line.size()) ? 1 : 0;
+    if (word == "end")
+        return (rest == line.size()) ? -1 : 0;
+    return 0;
+}
 
-            return FAILURE; //FAIL! OH NO!
-        }
+bool Calc::RunLoop()
+{
+    CStats::Timer timer(m_pTimed, SLOOP);
+    isErr = false;
+    size_t at = 0;
+    unique_ptr<CStmt> loop;
+    try
+    {
+        loop.reset(CompileLoop(at));
+    }
+    catch (const CError& e)
+    {
+        isErr = true;
+        lastErr = e.get();
+    }
+    m_Block.clear();
 
-        // Now curChr is at the end of the current part, and startChr is at the beginning.
-        // Add the part to the expression vector
-        m_Expr.push_back(part{curType, startChr, curChr});
+    // Running out of memory stops the loop where it is, like any other error.
+    try
+    {
+        if (loop && !Exec(loop.get()))
+            isErr = true;
+    }
+    catch (const CError& e)
+    {
+        isErr = true;
+        lastErr = e.get();
+    }
 
-    } //End of main while
+    if (isErr)
+    {
+        printError();
+        *Sink << "\tInterpret Error\n\n";
+        return FAILURE;
+    }
     return SUCCESS;
 }
 
+bool Calc::ParseLine(size_t at)
+{
+    Input = m_Block[at];
+    ClearParts();
+    isErr = false;
 
-/*********** Converter *************
+    Partition();
+    if (!isErr && !m_Expr.empty())
+        Convert();
+    return !isErr;
+}
 
-The Converter takes the part objects in m_Expr and looks at the portion of the input string between the start and end
-iterators for each part. Based on the type of the part, it converts the data in the string to a valid computer
-representation. It then adds this data to the data union in the part object.
+CStmt* Calc::CompileLoop(size_t& at)
+{
+    int line = at + 1;
+    auto inLine = [this, &line]()
+    {
+        lastErr = "Line " + to_string(line) + " of the loop: " + lastErr;
+        return (CStmt*)NULL;
+    };
 
-- For string->double conversion, I loop through the digits and add on each successive digit to 10 times the sum of the previous digits.
-  When I reach a decimal point, I begin counting until the end of the loop. Then I divide the entire sum by 10^(decimal_count) to get
-  final double.
+    if (!ParseLine(at))
+        return inLine();
 
-- Strings are copied directly as character arrays into a dynamic array whose pointer is given to the part object.
+    prtItr e_st = m_Expr.begin() + 1;
+    prtItr e_ed = m_Expr.end();
+    unique_ptr<CStmt> loop;
 
-- Parentheses are converted into a signed value (+- OPLEVELRANGE) which is later used in opLevel calculations to ensure that recursion levels don't overlap.
+    if (strcmp(m_Expr[0].wdata, "while") == 0)
+    {
+        loop.reset(new CStmt(SWHILE, line));
+        loop->expr = CompileAll(e_st, e_ed);
+        if (isErr)
+            return inLine();
+        Infer(loop->expr, false);
+    }
+    else
+    {
+        // for <variable> = <range>
+        if (e_ed - e_st < 3 || PRTOFST(0).type != WORD || PRTOFST(1).type != OPERATOR || PRTOFST(1).odata != ASN)
+        {
+            isErr = true;
+            lastErr = "Expected: for i = first:last";
+            return inLine();
+        }
 
-- Matrices are created by calling their string constructor on a temporary character array which has had the matrix string from Input copied into it.
+        loop.reset(new CStmt(SFOR, line));
+        loop->var = m_db->search(PRTOFST(0).sym);
+        if (loop->var == NULL)
+            loop->var = m_db->createVar(PRTOFST(0).sym);
+        e_st += 2;
 
-- Operators are encoded via the EncodeOp() function.
+        // Up to three expressions, separated by colons: first, first:last or first:step:last.
+        CExpr* range[3];
+        int nRange = 0;
+        while (true)
+        {
+            range[nRange++] = Compile(e_st, e_ed);
+            if (isErr)
+                break;
+            if (e_st == e_ed)
+                break;
+            if (e_st->type != OPERATOR || e_st->odata != RANGE || nRange == 3)
+            {
+                isErr = true;
+                lastErr = "Unexpected ";
+                substr_cpy(lastErr, e_st->st, e_st->ed);
+                lastErr += " in loop range.";
+                break;
+            }
+            ++e_st;
+        }
 
-*/
-bool Calc::Convert()
+        loop->expr = range[0];
+        if (nRange == 2)
+            loop->last = range[1];
+        else if (nRange == 3)
+        {
+            loop->step = range[1];
+            loop->last = range[2];
+        }
+        if (isErr)
+            return inLine();
+    }
+
+    // The body, up to the matching end
+    for (++at; at < m_Block.size(); )
+    {
+        int depth = LoopDepth(m_Block[at]);
+        if (depth < 0)
+        {
+            ++at;
+            return loop.release();
+        }
+        if (depth > 0)
+        {
+            CStmt* inner = CompileLoop(at);
+            if (inner == NULL)
+                return NULL;
+            loop->body.push_back(inner);
+            continue;
+        }
+
+        line = at + 1;
+        if (!ParseLine(at))
+            return inLine();
+        ++at;
+
+        if (m_Expr.empty())
+            continue;
+
+        CStmt* s = CompileStmt(line);
+        if (isErr)
+            return inLine();
+        if (s != NULL)
+            loop->body.push_back(s);
+    }
+
+    // Process() only hands over loops which were closed.
+    isErr = true;
+    lastErr = "Missing end.";
+    return inLine();
+}
+
+// Like Interpret(), but compiles the statement instead of running it. A lone variable, which would only be echoed,
+// compiles to nothing.
+CStmt* Calc::CompileStmt(int line)
 {
     prtItr e_st = m_Expr.begin();
     prtItr e_ed = m_Expr.end();
+    size_t ExprLen = e_ed - e_st;
 
-    // First go through and convert all the data to the appropriate forms.
-    for(; e_st < e_ed; ++e_st)
+    auto notHere = [this](const char* what)
     {
-        switch(e_st->type)
+        isErr = true;
+        lastErr = what;
+        lastErr += " cannot be used inside a loop.";
+        return (CStmt*)NULL;
+    };
+
+    if (PRTOFST(0).type == WORD)
+    {
+        const char* word = PRTOFST(0).wdata;
+        if (strcmp(word, "function") == 0)
+            return notHere("Function definitions");
+        if (ExprLen == 1 && m_db->search(PRTOFST(0).sym) == NULL)
         {
-        case DOUBLE:
+            isErr = true;
+            lastErr = "Unknown command or variable: ";
+            lastErr += word;
+            lastErr += ". Commands cannot be used inside a loop.";
+            return NULL;
+        }
+    }
+
+    prtItr nxtPart = FindNextOp(e_st, e_ed);
+    OP nxtop = (nxtPart != e_ed) ? nxtPart->odata : NULLOP;
+
+    if ((nxtop == INC || nxtop == DEC) && ExprLen == 2)
+    {
+        prtItr name = (PRTOFST(0).type == WORD) ? e_st : e_st + 1;
+        CVariable* var = (name->type == WORD) ? m_db->search(name->sym) : NULL;
+        if (var == NULL)
         {
-            // Convert the data to a double
-            int decpwr = 0;
-            strItr chr = e_st->st;
+            isErr = true;
+            lastErr = "Could not find varaible for ";
+            lastErr += (nxtop == INC) ? "increment" : "decrement";
+            lastErr += ". Please use an existing variable.";
+            return NULL;
+        }
 
-            // Set ndata to zero
-            e_st->ndata = 0.0;
+        CStmt* s = new CStmt(SINCDEC, line);
+        s->op = nxtop;
+        s->var = var;
+        return s;
+    }
 
-            // Here we read in the string characters and convert them to a double.
-            do
-            {
-                //If we have reached or passed the decimal point, keep counting up.
-                if (*chr =='.')
-                {
-                    decpwr = 1;
-                    chr++;
-                    continue;
-                }
-                if (decpwr > 0.0)
-                    decpwr *= 10;
+    if (e_st->type == OPERATOR || (e_ed-1)->type == OPERATOR)
+    {
+        isErr = true;
+        lastErr = "Invalid Syntax. Must have non-operator element in first and last position.";
+        return NULL;
+    }
 
-                // Multiply whatever is in the element by 10 and add in the current value as a ones place.
-                e_st->ndata *= 10;
-                e_st->ndata  += *chr - '0';
-                // Move forward in the string
-                ++chr;
-            } while(chr < e_st->ed );
+    if (ExprLen > 2 && isAssign(PRTOFST(1)))
+    {
+        if (PRTOFST(1).odata == BIND)
+            return notHere("Bindings");
+        if (PRTOFST(0).type != WORD)
+        {
+            isErr = true;
+            lastErr = "Cannot assign to non-variable type. That would break math.";
+            return NULL;
+        }
 
-            // Divide by the proper power.
-            if (decpwr > 0.0)
-                e_st->ndata  /= decpwr;
-        break; } //End of DOUBLE
-        case WORD: {
-            // Allocate new memory for storing a copy of just this word
-            size_t strlen = std::distance(e_st->st, e_st->ed);
-            e_st->wdata = new char [strlen+1]; //Make a new wordstring
-            substr_cpy(e_st->wdata, e_st->st, e_st->ed); //Copy the characters from Input
-            e_st->wdata[strlen] = 0; //Append null char
+        CVariable* var = m_db->search(PRTOFST(0).sym);
+        if (var == NULL)
+            var = m_db->createVar(PRTOFST(0).sym);
 
-            break; }
-        case OPERATOR: {
-            // Set the op type to be right
-            e_st->odata = EncodeOP(e_st->st);
-            break; }
-        case MATRIX: {
-            // Create a new matrix object
-            size_t strlen = std::distance(e_st->st, e_st->ed);
-            char* tmpstr = new char [strlen+1]; // Make a new temporary string to hold the data to go into the matrix.
-            substr_cpy(tmpstr, e_st->st, e_st->ed); // Copy the characters from Input
-            tmpstr[strlen] = 0; // Append null char
+        unique_ptr<CStmt> s(new CStmt(SASSIGN, line));
+        s->op = PRTOFST(1).odata;
+        s->var = var;
+        s->expr = CompileAll(e_st + 2, e_ed);
+        if (isErr)
+            return NULL;
+        // Sizes can change from one time around the loop to the next, so they're checked as it runs.
+        Infer(s->expr, false);
+        return s.release();
+    }
 
-            e_st->mdata = new CMatrix{tmpstr}; // Create a new matrix.
-            break; }
-        case BRACKET:
-                // Set to +OPLEVELRANGE if left bracket, -OPLEVELRANGE if right bracket.
-                e_st->bdata = OPLEVELRANGE;
-                if (*e_st->st == ')') {e_st->bdata *= -1;}
-                break;
-        case END:
-            break;
-        } // End of switch
-    } // End of for
+    unique_ptr<CExpr> expr(CompileAll(e_st, e_ed));
+    if (isErr || ExprLen == 1)
+        return NULL;
+    Infer(expr.get(), false);
+
+    CStmt* s = new CStmt(SEXPR, line);
+    s->expr = expr.release();
+    return s;
+}
+
+// Sets the loop variable. It is written in place when nothing is bound to it, which saves an allocation every time
+// around the loop.
+void Calc::SetLoopVar(CVariable* var, double value)
+{
+    if (var->Value().IsSingle() && !var->isBound() && !var->hasUsers())
+    {
+        var->Value()(0,0) = value;
+        var->Touch();
+    }
+    else
+        Assign(var, CMatrix(value));
+}
+
+bool Calc::ExecBody(const CStmt* s)
+{
+    for (size_t i = 0; i < s->body.size(); ++i)
+    {
+        if (!Exec(s->body[i]))
+            return FAILURE;
+    }
     return SUCCESS;
 }
 
-// Defines a macro which allows cleaner access to parts at an offset of (a) from the part pointed to by e_st.
-#define PRTOFST(a) (*(e_st+a))
+bool Calc::Exec(const CStmt* s)
+{
+    CMatrix tmp;
 
-/*********** Interpreter *************
+    auto fail = [this, s]()
+    {
+        isErr = true;
+        lastErr = "Line " + to_string(s->line) + " of the loop: " + lastErr;
+        return FAILURE;
+    };
 
-The Interpreter reads the parts in m_Expr and figures out whether an increment, assignment, and/or calculations
-is being expressed. It then performs the appropriate actions.
+    switch (s->type)
+    {
+    case SASSIGN: {
+        if (s->op == ASN)
+            return Store(s->var, s->expr, tmp) ? SUCCESS : fail();
+
+        const CMatrix& result = Eval(s->expr, tmp);
+        if (isErr || !Resolve(s->var) || !Update(s->var, AssignOpToOp(s->op), result))
+            return fail();
+        return SUCCESS;
+    }
+    case SINCDEC: {
+        if (!Resolve(s->var) || !Update(s->var, (s->op == INC) ? ADD : SUB, s_One))
+            return fail();
+        return SUCCESS;
+    }
+    case SEXPR: {
+        const CMatrix& result = Eval(s->expr, tmp);
+        if (isErr)
+            return fail();
+        Assign(m_db->getAns(), result);
+        return SUCCESS;
+    }
+    case SWHILE:
+        while (true)
+        {
+            const CMatrix& cond = Eval(s->expr, tmp);
+            if (isErr)
+                return fail();
+            // Empty conditions are false, as are any with a zero in them.
+            double zero = 0;
+            size_t n = cond.Size();
+            if (n == 0 || CMathLib::count(EQ, cond.data(), false, &zero, true, n) > 0)
+                return SUCCESS;
+            if (!ExecBody(s))
+                return FAILURE;
+        }
+    case SFOR:
+        break;
+    }
 
-- If there is an increment or decrement operator and the expression is exactly two parts long,
-  the interpreter searches the variable database for a variable to increment or decrement. If
-  it cannot find one, it returns an error, otherwise it performs the operation.
+    // for i = first:step:last. The range is worked out before the body first runs.
+    const CMatrix& first = Eval(s->expr, tmp);
+    if (isErr)
+        return fail();
 
-- If there is no equals sign
+    if (s->last == NULL)
+    {
+        // Every element of a matrix. The body may change the variable it came from, so work on a copy.
+        CMatrix values(first);
+        for (int i = 0; i < values.Size(); ++i)
+        {
+            SetLoopVar(s->var, values.data()[i]);
+            if (!ExecBody(s))
+                return FAILURE;
+        }
+        return SUCCESS;
+    }
 
+    double from, step = 1, to;
+    CMatrix tmp2;
+    from = first.IsSingle() ? first(0,0) : NAN;
+    if (s->step != NULL)
+    {
+        const CMatrix& v = Eval(s->step, tmp2);
+        if (isErr)
+            return fail();
+        step = v.IsSingle() ? v(0,0) : NAN;
+    }
+    const CMatrix& v = Eval(s->last, tmp2);
+    if (isErr)
+        return fail();
+    to = v.IsSingle() ? v(0,0) : NAN;
 
-Accepted signatures:
-    - Double   (any digit 0-9 and the decimal point "."; truncated at first non-digit.)
-    - Word     (any character A-Z and a-z as well as "_" and any digits not in the first position.)
-    - Operator (any single operator +, -, *, /, ^, %, =, or the double operators +=, -=, *=, /=, ++, --.)
-    - Paren    (any close or open parenthesis.)
-    - Matrix   (any sequence between two square brackets [ and ]; partitioner does not check the validity of the matrix, but it does check for invalid characters. )
-*/
-bool Calc::Interpret()
-{
-    prtItr e_st = m_Expr.begin();
-    prtItr e_ed = m_Expr.end();
-    size_t ExprLen = e_ed - e_st;
-    CVariable* asnTo;
-    CMatrix calcValue{0.0}; //Holds temporary calculation variable so we can check for errors.
+    if (std::isnan(from) || std::isnan(step) || std::isnan(to) || step == 0 || std::isinf(from) || std::isinf(to))
+    {
+        lastErr = "A loop range must be made of finite numbers, with a step other than 0.";
+        return fail();
+    }
+
+    // Counting the iterations first keeps rounding in the step from adding up, and from adding an extra one at the end.
+    double count = floor((to - from) / step + 1e-10) + 1;
+    for (double k = 0; k < count; ++k)
+    {
+        SetLoopVar(s->var, from + k*step);
+        if (!ExecBody(s))
+            return FAILURE;
+    }
+    return SUCCESS;
+}
 
-    //Find the next operator for later on.
-    OP nxtop = FindNextOp(e_st,e_ed)->odata;
+/*********** Compiler *************
 
-    // Check whether this is a basic increment or decrement.
-    if ((nxtop == INC || nxtop == DEC ) && ExprLen == 2)
+The Compiler turns the parts of an expression into a tree of CExpr nodes, which the Evaluator can then run as often as
+needed. It follows the order of operations by precedence climbing: an operator only takes the operand on its right
+as far as the next operator of the same or lower precedence (GetOpPrec), so operators of higher precedence bind
+tighter, and operators of equal precedence go left to right. Parentheses are compiled as a whole new expression.
+
+Variables and functions are looked up in the databases while compiling, so an unknown name is reported before anything
+is calculated. In a function body, names are looked up in the function's arguments instead, and compile to slots.
+
+Infer() then goes over the tree with the sizes the variables have now, and chooses the kernel of every operator whose
+operand sizes it can tell (see CKernel), so that sizes which don't fit are reported before anything is calculated,
+and the Evaluator only has to check that the sizes are still the ones planned for. Function arguments, calls,
+selections and bound variables which are out of date have sizes which are only known once they are calculated.
+
+*/
+CExpr* Calc::Compile(prtItr& st, prtItr ed, int minPrec)
+{
+    unique_ptr<CExpr> lhs(CompileValue(st, ed));
+    if (!lhs)
+        return NULL;
+
+    // Keep going until the end of the expression, of this set of parentheses, of this function argument, or of this
+    // part of a loop range.
+    while (st != ed && !(st->type == BRACKET && st->bdata < 0) && st->type != COMMA
+           && !(st->type == OPERATOR && st->odata == RANGE))
     {
-        // We only handle increments or decrement in 2-part expressions: OP + WORD or WORD + OP.
-        if (PRTOFST(0).type == WORD)
-            asnTo = m_db->search(PRTOFST(0).wdata);
-        else if (PRTOFST(1).type == WORD)
-            asnTo = m_db->search(PRTOFST(1).wdata);
-        else
+        if (st->type != OPERATOR)
         {
             isErr = true;
-            lastErr = "Expected variable expression. Cannot ";
-            lastErr += (nxtop == INC) ? "increment" : "decrement";
-            lastErr += " numbers or matrices.";
-            return FAILURE;
+            lastErr = "Expected operator at ";
+            lastErr += *(st->st);
+            return NULL;
         }
 
-        // Check whether the variable existed
-        if (asnTo == 0)
+        if (isAssign(*st))
         {
             isErr = true;
-            lastErr = "Could not find varaible for ";
-            lastErr += (nxtop == INC) ? "increment" : "decrement";
-            lastErr += ". Please use an existing variable.";
-            return FAILURE;
+            lastErr = "Cannot perform assignment within an expression.";
+            return NULL;
         }
 
-        // Calculate using the value of nxt
-        *asnTo = CalcOP(asnTo->Value(),nxtop);
+        // A lower precedence operator belongs to whoever called us.
+        int prec = GetOpPrec(st->odata);
+        if (prec < minPrec)
+            break;
+
+        prtItr op = st++;
+        CExpr* rhs = Compile(st, ed, prec + 1);
+        if (rhs == NULL)
+            return NULL;
 
+        string sym;
+        substr_cpy(sym, op->st, op->ed);
+        lhs.reset(new CExpr(op->odata, lhs.release(), rhs, sym));
     }
-    else
-    {
-        // The first element can't be an operator.
-        if (e_st->type == OPERATOR)
-        {
-            isErr = true;
-            lastErr = "Invalid Syntax. Must have non-operator element in first position.";
-            return FAILURE;
-        }
-        // The last element can't be an operator.
-        if ((e_ed-1)->type == OPERATOR)
-        {
-            isErr = true;
-            lastErr = "Invalid Syntax. Must have non-operator element in last position.";
-            return FAILURE;
-        }
 
-        // Calculate opLevels -- This is used for correctly recursing through the mathematical order of operations.
-        int baseOp = 0; // base opLevel, so we can add opLevels for bracketing.
-        bool firstelem = true; // Retrieving the opLevel of the previous element should not happen the first time.
+    return lhs.release();
+}
+
+// Compiles a single operand: a number, a matrix, a variable, or a parenthesized expression.
+CExpr* Calc::CompileValue(prtItr& st, prtItr ed)
+{
+    if (st == ed)
+    {
+        isErr = true;
+        lastErr = "Unexpected end of expression.";
+        return NULL;
+    }
 
-        // Loop through the part array
-        for (; e_st < e_ed; ++e_st, firstelem = false)
+    switch (st->type)
+    {
+    case DOUBLE:
+        return new CExpr((st++)->ndata);
+    case MATRIX:
+        // The part has no more use for its matrix, so the node can have it.
+        return new CExpr(move(*(st++)->mdata));
+    case WORD: {
+        // A word followed by parentheses is a function call, or a selection from a variable.
+        bool paren = (st+1 != ed && (st+1)->type == BRACKET && (st+1)->bdata > 0);
+        if (paren && isFunction(st->wdata))
+            return CompileCall(st, ed);
+
+        unique_ptr<CExpr> x;
+
+        // In a function body, the only names are the arguments.
+        if (m_pParams != NULL)
         {
-            // If this is an operator, it has its own opLevel
-            if (e_st->type == OPERATOR)
+            vector<string>::const_iterator arg = find(m_pParams->begin(), m_pParams->end(), st->wdata);
+            if (arg == m_pParams->end())
             {
-                int myOpLevel = baseOp + GetOpPrec(e_st->odata);
-                // Give me my own opLevel
-                e_st->opLevel = myOpLevel;
-
-                // The elements on either side of me should be numbers. If they are not operators then give them the maximum of my opLevel and their opLevel.
-                if (PRTOFST(-1).type != OPERATOR && PRTOFST(-1).opLevel < myOpLevel)
-                    PRTOFST(-1).opLevel = myOpLevel;
+                isErr = true;
+                lastErr = "Unknown quantity \"";
+                substr_cpy(lastErr, st->st, st->ed);
+                lastErr += "\". Functions can only use their arguments.";
+                return NULL;
             }
-            // If the current part is a bracket, we need to step into or out of another level of recursion.
-            else if (e_st->type == BRACKET)
-            {
-                // Increment or decrement baseOp by OPLEVELRANGE
-                baseOp += e_st->bdata;
-                if (baseOp < 0)
-                {
-                    isErr = true;
-                    lastErr = "Unmatched parentheses. Cannot parse.";
-                    return FAILURE;
-                }
-                e_st->opLevel = baseOp;
+            x.reset(new CExpr(st->wdata, int(arg - m_pParams->begin())));
+        }
+        else
+        {
+            CVariable* thisVar = m_db->search(st->sym);
 
-            }
-            // If the part is something else and it's not the first element
-            else if (!firstelem)
+            // Check whether this variable actually exists in the database.
+            if (thisVar == NULL)
             {
-                // Everything else always associates right, unless it associates left (because some operator sets it to do so).
-                e_st->opLevel = PRTOFST(-1).opLevel;
+                isErr = true;
+                lastErr = paren ? "Unknown function \"" : "Unknown quantity \"";
+                substr_cpy(lastErr, st->st, st->ed);
+                lastErr += paren ? "\"." : "\". Type \"who\" to list variables.";
+                return NULL;
             }
+            x.reset(new CExpr(thisVar, st->wdata));
         }
+        ++st;
 
-        // When we finish, we should be back at the recursion level we started at.
-        // If we're not, the user forgot a parenthesis somewhere.
-        if (baseOp != 0)
+        // a(mask): the parenthesized expression picks the elements.
+        if (paren)
         {
-            isErr = true;
-            lastErr = "Unmatched parentheses. Cannot parse.";
-            return FAILURE;
+            string name = x->text;
+            CExpr* mask = CompileValue(st, ed);
+            if (mask == NULL)
+                return NULL;
+            x.reset(new CExpr(x.release(), mask, name));
         }
-
-        //********** We could compress the op levels in the future here to reduce recursion times.************
-
-        // Move the start iterator back to the beginning
-        e_st = m_Expr.begin();
-
-        // Check for just a word. If it is an existing variable, echo the value of that variable.
-        if (PRTOFST(0).type == WORD && ExprLen == 1)
+        return x.release(); }
+    case BRACKET:
+        if (st->bdata > 0)
         {
-            // Look for the variable in the database
-            asnTo = m_db->search(PRTOFST(0).wdata);
-
-            // If the Interpreter cannot find the variable, then return an error.
-            if (asnTo == 0)
+            ++st;
+            unique_ptr<CExpr> inner(Compile(st, ed));
+            if (!inner)
+                return NULL;
+            if (st == ed || st->type != BRACKET)
             {
                 isErr = true;
-                lastErr = "Unknown command or variable: ";
-                substr_cpy(lastErr, PRTOFST(0).st, PRTOFST(0).ed);
-
-                return FAILURE;
+                lastErr = "Unmatched parentheses. Cannot parse.";
+                return NULL;
             }
-
+            ++st; // Step over the closing parenthesis
+            return inner.release();
         }
-        // Check for an assignment to a variable explicitly.
-        else if (ExprLen > 2 && isAssign(PRTOFST(1)))
+        // An empty pair of parentheses, or a close with nothing before it, falls through to the error below.
+        [[fallthrough]];
+    case OPERATOR:
+        isErr = true;
+        lastErr = "Expected numerical value, variable, or matrix at ";
+        lastErr += *(st->st);
+        return NULL;
+    default:
+        isErr = true;
+        lastErr = "Unexpected lexical element ";
+        substr_cpy(lastErr, st->st, st->ed);
+        return NULL;
+    }
+}
+
+// Whether name is a built-in or user-defined function.
+bool Calc::isFunction(const char* name)
+{
+    return CMathLib::find(name) != NULL || m_funcs->search(name) != NULL;
+}
+
+// Compiles a call of a built-in or user-defined function, leaving st after its closing parenthesis.
+CExpr* Calc::CompileCall(prtItr& st, prtItr ed)
+{
+    const CBuiltin* builtin = CMathLib::find(st->wdata);
+    CFunction* func = (builtin == NULL) ? m_funcs->search(st->wdata) : NULL;
+    if (builtin == NULL && func == NULL)
+    {
+        isErr = true;
+        lastErr = "Unknown function \"";
+        substr_cpy(lastErr, st->st, st->ed);
+        lastErr += "\".";
+        return NULL;
+    }
+
+    unique_ptr<CExpr> call(builtin ? new CExpr(builtin, st->wdata) : new CExpr(func, st->wdata));
+    st += 2; // Step over the name and the opening parenthesis
+
+    if (st != ed && st->type == BRACKET && st->bdata < 0)
+        ++st;
+    else
+    {
+        while (true)
         {
-            // Are we trying to assign to something other than a word? This is an error.
-            if (PRTOFST(0).type != WORD)
+            CExpr* arg = Compile(st, ed);
+            if (arg == NULL)
+                return NULL;
+            call->args.push_back(arg);
+
+            if (st == ed)
             {
                 isErr = true;
-                lastErr = "Cannot assign to non-variable type. That would break math.";
-                return FAILURE;
+                lastErr = "Unmatched parentheses. Cannot parse.";
+                return NULL;
             }
+            if ((st++)->type != COMMA)
+                break;
+        }
+    }
 
-            // See if the variable is already in the database and if not, create it.
-            asnTo = m_db->search(PRTOFST(0).wdata);
-            if (asnTo == 0)
-                asnTo = m_db->createVar(PRTOFST(0).wdata);
+    int nArgs = call->args.size();
+    if (builtin != NULL && (nArgs < builtin->minArgs || (builtin->maxArgs >= 0 && nArgs > builtin->maxArgs)))
+    {
+        isErr = true;
+        lastErr = "Function ";
+        lastErr += builtin->name;
+        lastErr += (builtin->maxArgs < 0) ? " takes at least " : " takes ";
+        lastErr += to_string(builtin->minArgs) + " arguments, not " + to_string(nArgs) + ".";
+        return NULL;
+    }
+    if (func != NULL && nArgs != int(func->Arity()))
+    {
+        isErr = true;
+        lastErr = "Function " + func->Signature() + " takes " + to_string(func->Arity()) + " arguments, not "
+                + to_string(nArgs) + ".";
+        return NULL;
+    }
+    return call.release();
+}
 
-            // Get the type of assignment (=, +=, etc.)
-            OP asnType = AssignOpToOp(PRTOFST(1).odata);
+// Compiles a whole expression, which must not have anything left over (like a stray comma) at the end.
+CExpr* Calc::CompileAll(prtItr st, prtItr ed)
+{
+    unique_ptr<CExpr> x(Compile(st, ed));
+    if (x && st != ed)
+    {
+        isErr = true;
+        lastErr = "Unexpected ";
+        substr_cpy(lastErr, st->st, st->ed);
+        lastErr += " in expression.";
+        return NULL;
+    }
+    return x.release();
+}
 
-            // Is it just plain old assignment...
-            if (asnType == ASN)
-            {
-                // Calculate whatever is beyond the equals sign.
-                e_st += 2;
-                calcValue = CalcExpr(e_st, e_ed);
-                if (!isErr)
-                    *asnTo = calcValue;
-                else
-                    return FAILURE;
-            }
-            // ...or a fancy one?
-            else
-            {
-                // Call the calculator on the part of the input which is beyond the equals sign.
-                e_st += 2;
-                calcValue = CalcExpr(e_st, e_ed);
+bool Calc::Infer(CExpr* x, bool report)
+{
+    for (size_t i = 0; i < x->args.size(); ++i)
+    {
+        if (!Infer(x->args[i], report))
+            return FAILURE;
+    }
 
-                //If there is no error in the calculation, then perform the fancy assignment.
-                if (!isErr)
-                    *asnTo = CalcOP(asnTo->Value(), asnType, calcValue);
-                else
-                    return FAILURE;
-            }
-        }
-        // Handle non-assignments (i.e. assign to "ans")
-        else
-        {
-            asnTo = m_db->getAns();
+    x->rows = x->cols = -1;
+    x->kernel = KNONE;
 
-            // Call the calculator on the entire expression (there is no equals sign, it is implied).
-            calcValue = CalcExpr(e_st,e_ed);
+    switch (x->type)
+    {
+    case XVALUE:
+        x->rows = x->value.getNRow();
+        x->cols = x->value.getNCol();
+        break;
+    case XVAR:
+        if (!x->var->isDirty())
+        {
+            x->rows = x->var->Value().getNRow();
+            x->cols = x->var->Value().getNCol();
+        }
+        break;
+    case XOP: {
+        const CExpr* a = x->args[0];
+        const CExpr* b = x->args[1];
+        if (a->rows < 0 || b->rows < 0)
+            break;
 
-            // If there is no error, then actually assign the returned value.
-            if (!isErr)
-                *asnTo = calcValue;
-            else
+        string err;
+        x->kernel = CKernel::plan(x->op, a->rows, a->cols, b->rows, b->cols, x->rows, x->cols, err);
+        if (x->kernel == KNONE)
+        {
+            x->rows = x->cols = -1;
+            if (report)
+            {
+                isErr = true;
+                lastErr = err;
                 return FAILURE;
+            }
+            break;
         }
+        x->planned[0] = a->rows;
+        x->planned[1] = a->cols;
+        x->planned[2] = b->rows;
+        x->planned[3] = b->cols;
+        break; }
+    default:
+        break;
     }
-
-    //Echo the variable onto the screen
-    Echo(asnTo);
-
     return SUCCESS;
 }
 
-// Echos a variable to the terminal.
-void Calc::Echo(CVariable* var)
-{
-    cout << '\t' << var->Name() << " = " << var->Value() << endl << endl;
-}
+/*********** Evaluator *************
 
-/*********** Calculator *************
+The Evaluator calculates the value of a compiled expression. Numbers, matrices and variables are returned by reference
+without being copied; anything which has to be calculated is left in tmp, which is what gets returned. Bound variables
+are brought up to date as they are reached. Errors set isErr and lastErr, and the returned value should then be ignored.
 
-The Calculator steps through the parts in m_Expr between the two iterators passed to it and sequentially (left-to-right)
-calculates the value of the expression as a double. In order to follow order of operations, it calls itself recursively.
+A function call evaluates its arguments, then evaluates the body with m_pFrame pointing at them, so that the body's
+argument slots read them in place. Arguments which are variables are not copied. Built-in functions get the same
+arguments and leave their result in tmp.
 
-    - When it reaches an element with a higher opLevel, it calls itself with st pointing to that element with one-higher opLevel
-    - When it reaches an element with a lower  opLevel, it returns cumulativeValue to whatever called it, whether
-      that be the Interpreter or another level of calculator recursion.
-    - Elements of the same opLevel are processed in left-to-right order.
+A selection with a comparison for its mask, like a(a > 0), compares as it selects, so the mask is never made.
 
-Note that after the Calculator runs, the iterator st is left pointing at the last element in m_Expr. If you need to preserve
-the location of st, pass in an lvalue copy of the iterator.
+Products, divisions and powers involving a matrix variable are looked up in the memo cache before being calculated, so
+a statement which repeats an A*B from an earlier one gets the earlier result as long as A and B haven't changed since.
+The key names each variable by its version (see MemoKey), so a changed variable never finds an old result.
 
 */
-CMatrix Calc::CalcExpr(prtItr& st, prtItr& ed, int opLevel)
+// True if any variable in x holds a matrix. Expressions with none are cheap enough to just calculate, so they skip the
+// memo cache altogether. A bound variable which is out of date may not have its new shape yet, which only costs a miss.
+static bool hasMatrixVar(const CExpr* x)
 {
-    CMatrix cumulativeValue{0.0};    //Holds the current value of the calculation for this level of recursion
-    CMatrix nextValue{0.0};          //Holds the next value of the equation. Then we perform thisOp on cumulativeValue and nextValue
-    prtItr thisOp = st;         //Default to start, although this is actually the location of the first integer.
-    prtItr thisValue = st;        //Get the very first token, which should be an integer (although if it's not, we don't have error checking yet, so oops)
-    bool firsttime = true;   //Set to true if we are at the top of the loop of this level of recursion. This allows us to 'add in' the first value in the expression to the cumulative value.;
-
-    prtItr nextOp = FindNextOp(st,ed);
-    bool exit = false;
+    if (x->type == XVAR)
+        return !x->var->Value().IsSingle();
+    for (size_t i = 0; i < x->args.size(); ++i)
+        if (hasMatrixVar(x->args[i]))
+            return true;
+    return false;
+}
 
-    // Begin to loop through reading 2 (actually three) ahead at a time
-    while (true)
+const CMatrix& Calc::Eval(const CExpr* x, CMatrix& tmp)
+{
+    switch (x->type)
     {
-        // Skip any parentheses (we just use the precalculated opLevels.
-        while (st->type == BRACKET && st != ed)
-            ++st;
+    case XVALUE:
+        return x->value;
+    case XVAR:
+        if (!Resolve(x->var))
+            return tmp;
+        return x->var->Value();
+    case XOP: {
+        string key;
+        bool memo = !m_bTiming && (x->op == MULT || x->op == DIV || x->op == EXP) && hasMatrixVar(x) && MemoKey(x, key);
+        if (isErr)
+            return tmp;
+        if (memo && m_pMemo->find(key, tmp))
+            return tmp;
 
-        // Exit when we get to the end.
-        if (st == ed)
-            break;
+        CMatrix lhsTmp, rhsTmp;
+        const CMatrix& lhs = Eval(x->args[0], lhsTmp);
+        if (isErr)
+            return tmp;
+        const CMatrix& rhs = Eval(x->args[1], rhsTmp);
+        if (isErr)
+            return tmp;
 
-        // Read in the tokens needed for this loop.
-        if (!firsttime)
+        // The kernel was planned while compiling, unless the sizes weren't known then or have changed since.
+        OPKERNEL kernel = x->kernel;
+        if (kernel == KNONE || lhs.getNRow() != x->planned[0] || lhs.getNCol() != x->planned[1]
+                            || rhs.getNRow() != x->planned[2] || rhs.getNCol() != x->planned[3])
         {
-            // Get the token at start, which should be an operator, but we're going to check
-            thisOp = st++;
-
-            if (thisOp->type != OPERATOR)
+            int rows, cols;
+            kernel = CKernel::plan(x->op, lhs.getNRow(), lhs.getNCol(), rhs.getNRow(), rhs.getNCol(), rows, cols, lastErr);
+            if (kernel == KNONE)
             {
                 isErr = true;
-                lastErr = "Expected operator at ";
-                lastErr += *(thisOp->st);
-                return CMatrix{};
+                return tmp;
             }
-
-            // Read the next token, which should be an double, matrix, or variable
-            thisValue = st;
         }
-        else
+
+        // tmp may be the storage of the variable being assigned to (see Store), which may also be an operand. Only
+        // element-wise arithmetic which keeps its size can write over an operand.
+        bool ok;
+        bool overlap = tmp.data() != NULL && (lhs.data() == tmp.data() || rhs.data() == tmp.data());
+        size_t size = (kernel == KSCALARMAT) ? rhs.Size() : lhs.Size();
         {
-            // Set thisValue to the first element in the expression, but don't move the start pointer forward just yet, since there's no operator.
-            thisValue = st;
+            CStats::Timer timer(m_pTimed, x->op);
+            CProfile::Area area(m_pProfiling, x->op);
+            if (overlap && (kernel == KGEMM || kernel == KGEMV || CMathLib::isComparison(x->op) || size != (size_t)tmp.Size()))
+            {
+                CMatrix out;
+                ok = CKernel::run(kernel, x->op, lhs, rhs, out);
+                if (ok)
+                    tmp.swap(out);
+            }
+            else
+                ok = CKernel::run(kernel, x->op, lhs, rhs, tmp);
         }
 
-        // Handle cases where we get an operator in an invalid spot.
-        if (thisValue->type == OPERATOR)
+        if (!ok)
         {
             isErr = true;
-            lastErr = "Expected numerical value, variable, or matrix at ";
-            lastErr += *(thisValue->st);
-            return CMatrix{};
+            lastErr = "Operation ";
+            lastErr += x->text;
+            lastErr += " returned null value. Check your operators.";
         }
-
-        // Find the next operator, but don't move start forward
-        nextOp = FindNextOp(st,ed);
-
-        if (nextOp != ed && isAssign(*nextOp))
+        else if (memo)
+            m_pMemo->insert(key, tmp);
+        return tmp; }
+    case XARG:
+        return *m_pFrame[x->slot];
+    case XINDEX: {
+        CMatrix ofTmp, lhsTmp, rhsTmp;
+        const CMatrix& of = Eval(x->args[0], ofTmp);
+        if (isErr)
+            return tmp;
+
+        // Any other mask is taken where it isn't zero.
+        const CExpr* mask = x->args[1];
+        const CMatrix* lhs;
+        const CMatrix* rhs = &s_Zero;
+        OP cmp = NE;
+        if (mask->type == XOP && CMathLib::isComparison(mask->op))
         {
-            isErr = true;
-            lastErr = "Cannot perform assignment within an expression.";
-            return CMatrix{};
+            lhs = &Eval(mask->args[0], lhsTmp);
+            if (!isErr)
+                rhs = &Eval(mask->args[1], rhsTmp);
+            cmp = mask->op;
         }
+        else
+            lhs = &Eval(mask, lhsTmp);
+        if (isErr)
+            return tmp;
 
-        // Handle order of operations
-        if (nextOp != ed && nextOp->opLevel > opLevel) // If the next operator has a higher opLevel:
+        const char* err = CMathLib::select(of, cmp, *lhs, *rhs, tmp);
+        if (err != NULL)
         {
-            // We need to recurse to find the proper nextValue to use. Enter recursion and print that we are doing so.
-            nextValue = CalcExpr(st,ed,opLevel+1);
-            // st now points to the next operator on our level after the subexpression we just consumed.
-
-            //Find the next operator, so we can tell whether we need to exit.
-            nextOp = FindNextOp(st,ed);
-
-            //If the recursion triggered an error, we need to abort all levels of recursion.
-            if (isErr)
-            {
-                return CMatrix{};
-            }
+            isErr = true;
+            lastErr = x->text + "(): " + err;
         }
-        else
+        return tmp; }
+    case XCALL:
+    case XBUILTIN: {
+        const CFunction* func = x->func;
+        size_t nArgs = x->args.size();
+
+        // The function may have been redefined since this call was compiled.
+        if (func != NULL && nArgs != func->Arity())
         {
-            // Get and print the value we need to calculate with next.
-            switch (thisValue -> type)
-            {
-            // If this value is a number
-            case DOUBLE:
-                nextValue = thisValue->ndata;
-                break;
-            // If this value is a variable that we have to look up.
-            case WORD: {
-                CVariable* thisVar = m_db->search(thisValue->wdata);
-
-                // Check whether this variable actually exists in the database.
-                if (thisVar == NULL)
-                {
-                    isErr = true;
-                    lastErr = "Unknown quantity \"";
-                    substr_cpy(lastErr, thisValue->st, thisValue->ed);
-                    lastErr += "\". Type \"who\" to list variables.";
-                    return CMatrix{};
-                }
-                // Set nextValue to the value stored in the variable
-                nextValue = thisVar->Value();
-                break; }
-            case MATRIX:
-                nextValue = *(thisValue->mdata);
-                break;
-            default:
-                isErr = true;
-                lastErr = "Unexpected lexical element ";
-                substr_cpy(lastErr, thisValue->st, thisValue->ed);
-                return CMatrix{};
-            }
-
-            // Move start to the next position (we're hoping this is an operator, though for things like unitary operators this may not work in the future).
-            ++st;
+            isErr = true;
+            lastErr = "Function " + func->Signature() + " takes " + to_string(func->Arity()) + " arguments, not "
+                    + to_string(nArgs) + ".";
+            return tmp;
         }
 
-        // If the next operator has a lower opLevel, then we need to break out of recursion
-        if (st == ed || (nextOp != ed && nextOp->opLevel < opLevel))
+        // Only max and min can have more arguments than fit here.
+        CMatrix argStack[FUNC_MAX_ARGS];
+        const CMatrix* frameStack[FUNC_MAX_ARGS];
+        vector<CMatrix> argHeap;
+        vector<const CMatrix*> frameHeap;
+        CMatrix* argTmp = argStack;
+        const CMatrix** frame = frameStack;
+        if (nArgs > FUNC_MAX_ARGS)
         {
-            // Exit the loop after this calculation and print that we are doing so.
-            exit = true;
+            argHeap.resize(nArgs);
+            frameHeap.resize(nArgs);
+            argTmp = argHeap.data();
+            frame = frameHeap.data();
         }
 
-        // Perform the calculation and store the cumulative result in cumulativeValue.
-        if (firsttime)
+        for (size_t i = 0; i < nArgs; ++i)
         {
-            // If this is the first time through, we just assign the value to cumulative value
-            cumulativeValue = nextValue;
-            firsttime = false;
+            frame[i] = &Eval(x->args[i], argTmp[i]);
+            if (isErr)
+                return tmp;
         }
-        else
+
+        if (func == NULL)
         {
-            // Otherwise we calculate it
-            cumulativeValue = CalcOP(cumulativeValue,thisOp->odata,nextValue);
-            if (cumulativeValue.IsNull())
+            const char* err = x->builtin->call(frame, nArgs, tmp);
+            if (err != NULL)
             {
                 isErr = true;
-                lastErr = "Operation ";
-                substr_cpy(lastErr, thisOp->st, thisOp->ed);
-                lastErr += " returned null value. Check your operators.";
-                return CMatrix{};
+                lastErr = x->text + ": " + err;
             }
+            return tmp;
         }
 
-        // If we need to exit, break;
-        if (exit)
-            break;
-    }
-    return cumulativeValue;
-}
-
-//*** Various calculator functions ****
-
-//Calculate a simple binary operator
-CMatrix Calc::CalcOP(const CMatrix& a, const OP& op, const CMatrix& b)
-{
-    switch (op)
-    {
-    case ADD:
-        return a + b;
-    case SUB:
-        return a - b;
-    case MULT:
-        return a * b;
-    case DIV:
-
-        if (b == 0)
-        {
-            isErr = true;
-            lastErr = "Friends don't let friends divide by zero. Are you my friend?";
-            return CMatrix{};
-        }
+        const CMatrix* const* caller = m_pFrame;
+        m_pFrame = frame;
+        const CMatrix& result = Eval(func->Body(), tmp);
+        m_pFrame = caller;
 
-        return a / b;
-    case EXP:
-        //Matrix powers not implemented yet
-        if (! a.IsSingle() || !b.IsSingle())
-        {
-            isErr = true;
-            lastErr = "Cannot use ^ with matrices.";
-            return CMatrix{};
-        }
-        return pow(double(a.element(0,0)),double(b.element(0,0)));
-    case MOD:
-        if (a.IsSingle() && b.IsSingle())
-            return int(a.element(0,0)) % int(b.element(0,0));
-        else
-        return CMatrix{};
-    default:
-        return CMatrix{}; //Not something we can compute
+        // The result may be one of the arguments, which are about to go away.
+        if (&result != &tmp && !isErr)
+            tmp = result;
+        return tmp; }
     }
+    return tmp;
 }
 
-//Calculate a simple unary operator
-CMatrix Calc::CalcOP(const CMatrix& a, const OP& op)
+// Writes the memo cache key of x into key: its structure, with each variable named by its current version and each
+// number by its exact bits. Bound variables are brought up to date first, since their version is only right then.
+// Returns false if x can't be cached because it has a matrix written out in it, which has no version.
+bool Calc::MemoKey(const CExpr* x, string& key)
 {
-    if (!a.IsSingle())
-    {
-        return CMatrix{};
-    }
-
-    switch (op)
+    switch (x->type)
     {
-    case INC:
-        return a+1;
-    case DEC:
-        return a-1;
+    case XVALUE: {
+        if (!x->value.IsSingle())
+            return false;
+        double d = x->value(0,0);
+        key += '#';
+        key.append(reinterpret_cast<const char*>(&d), sizeof(d));
+        return true; }
+    case XVAR:
+        if (!Resolve(x->var))
+            return false;
+        key += 'v';
+        key += to_string(x->var->Version());
+        return true;
+    case XOP:
+        key += '(';
+        if (!MemoKey(x->args[0], key))
+            return false;
+        key += char('A' + x->op);
+        if (!MemoKey(x->args[1], key))
+            return false;
+        key += ')';
+        return true;
     default:
-        return CMatrix{}; // Invalid operator
+        return false;
     }
 }
 
+//*** Various calculator functions ****
+
 bool Calc::isAssign(const part& p)
 {
-    return (p.type == OPERATOR && (p.odata == ASN || p.odata == ASNADD || p.odata == ASNSUB || p.odata == ASNMULT || p.odata == ASNDIV));
+    return (p.type == OPERATOR && (p.odata == ASN || p.odata == ASNADD || p.odata == ASNSUB || p.odata == ASNMULT || p.odata == ASNDIV || p.odata == BIND));
 }
 
 //Operator encoding
@@ -932,8 +3008,35 @@ OP Calc::EncodeOP(const strItr& chr)
     case '^': return EXP;
     case '%': return MOD;
 
+    case ':':
+        if (*(chr+1) == '=')
+            return BIND;
+        else
+            return RANGE;
+
     case '=':
-        return ASN;
+        if (*(chr+1) == '=')
+            return EQ;
+        else
+            return ASN;
+
+    case '<':
+        if (*(chr+1) == '=')
+            return LE;
+        else
+            return LT;
+
+    case '>':
+        if (*(chr+1) == '=')
+            return GE;
+        else
+            return GT;
+
+    case '!':
+        if (*(chr+1) == '=')
+            return NE;
+        else
+            return NULLOP;
     default:
         return NULLOP;
     }
@@ -969,17 +3072,23 @@ Calc::prtItr Calc::FindNextOp(prtItr st, prtItr ed)
     return ed; //if no operator was found
 }
 
-//Get the opLevel associated with the given operator.
+//Get the precedence of the given operator. Operators with a higher precedence are calculated first.
 int Calc::GetOpPrec(OP op)
 {
     switch (op)
     {
-        case ADD:   return 0;
-        case SUB:   return 0;
-        case MULT:   return 1;
-        case DIV:   return 1;
-        case EXP:   return 2;
-        case MOD:   return 1;
+        case EQ:    return 0;
+        case NE:    return 0;
+        case LT:    return 0;
+        case GT:    return 0;
+        case LE:    return 0;
+        case GE:    return 0;
+        case ADD:   return 1;
+        case SUB:   return 1;
+        case MULT:   return 2;
+        case DIV:   return 2;
+        case EXP:   return 3;
+        case MOD:   return 2;
         case ASN:   return 0;
         default:    return 0;
     }
@@ -1019,7 +3128,7 @@ bool Calc::isOp(char var)
 	// Output:
 	// return 1 when the input is valid operator
 	// return 0 when the input is invalid
-	if (var == '+' || var == '-' || var == '*' || var == '/' || var == '\\' || var == '^' || var == '%' || var == '=') //Note: ++ and -- cannot be checked because they are two-character strings.
+	if (var == '+' || var == '-' || var == '*' || var == '/' || var == '\\' || var == '^' || var == '%' || var == '=' || var == ':' || var == '<' || var == '>' || var == '!') //Note: ++ and -- cannot be checked because they are two-character strings.
         return true;
     else
         return false;
@@ -1038,18 +3147,37 @@ bool Calc::isParen(char var)
         return false;
 }
 
+Calc::~Calc()
+{
+    delete m_pPar;
+    delete m_pStats;
+    delete m_pProfile;
+    m_Expr.clear();
+    if (m_bOwnsDB)
+    {
+        delete m_db;
+        delete m_funcs;
+        delete m_pMemo;
+        delete m_pMem; // last, since everything above was charged to it
+    }
+}
+
 // Create a variable database for this Calc object.
 bool Calc::createDB()
 {
+    m_pMem = new CMemory;
+    CMemory::Scope scope(m_pMem);
     m_db = new CVarDB;
     m_ans = m_db->getAns();
+    m_funcs = new CFuncDB;
+    m_pMemo = new CMemo;
     return (m_db != 0);
 }
 
 // Print out an error
 void Calc::printError()
 {
-    cout << "\tError: " << lastErr << endl;
+    *Sink << "\tError: " << lastErr << '\n';
 }
 
 // Declaration of string copy functions.
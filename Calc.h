@@ -6,17 +6,29 @@
 #include <iostream>
 #include <fstream>
 #include "CVarDB.h"
+#include "CFuncDB.h"
 #include "CVariable.h"
 #include "CMatrix.h"
+#include "CSink.h"
+#include "CFormatter.h"
+#include "CExpr.h"
+#include "CStmt.h"
+#include "CMemo.h"
+#include "CMemory.h"
+#include "CError.h"
+#include "CStats.h"
+#include "CProfile.h"
 
 #define SUCCESS 1
 #define FAILURE 0
 
-using namespace std;
+#define BATCH_BLOCK (1 << 20) //How many bytes the batch mode reads from its source at a time
+#define PAR_WINDOW  64        //How many statements the parallel batch mode reads ahead
+#define TIME_MAX    1000000   //The most runs "time N expr" will do
 
-enum OP {ASN, ADD, SUB, MULT, DIV, EXP, MOD, INC, DEC, ASNADD, ASNSUB, ASNMULT, ASNDIV, NULLOP};
+using namespace std;
 
-enum PARTTYPE {DOUBLE,WORD,OPERATOR,MATRIX,BRACKET,END};
+enum PARTTYPE {DOUBLE,WORD,OPERATOR,MATRIX,BRACKET,COMMA,END};
 
 typedef string::iterator strItr;
 
@@ -33,7 +45,7 @@ typedef struct part
         CMatrix* mdata;
         short bdata; //Bracket data
         };
-    int opLevel; //For handling order of operations at a later date.
+    int sym; //The symbol of a word (see CVarDB)
 
     //type and bounds constructor
     part(PARTTYPE t, strItr s, strItr e)
@@ -41,8 +53,8 @@ typedef struct part
         type = t;
         st = s;
         ed = e;
-        opLevel = 0;
         wdata = 0; //Set the union to a default value of zero.
+        sym = -1;
     }
 
     //Destructor for killing our matrix or word.
@@ -64,34 +76,110 @@ typedef struct part
     }
 } part;
 
+struct ParWindow; //The read-ahead window of the parallel batch mode (Calc.cpp)
+struct ParStmt;
+
 /*********************************
         Calculator Class
 *********************************/
 
+/* Calculators share nothing, so any number of them can run at once, each on its own thread (the server gives every
+   session one). A single Calc must only be used by one thread at a time; setThreads() lets it use more itself. All
+   of its output goes to the sinks it was given, never straight to cout or cerr.
+*/
+
 class Calc
 {
     typedef vector<part>::iterator prtItr;
     vector<part>    m_Expr;
     string          Input;
     istream*        Source;
+    ostream*        Sink;
+    ostream*        ErrSink;        //Where messages about the calculator itself go, rather than about statements
+    CFormatter      m_fmt;          //Formats results before they go to Sink
     CVarDB*         m_db;
+    CFuncDB*        m_funcs;        //User-defined functions
     CVariable*      m_ans;
     bool            quitNext;
+    CMemo*          m_pMemo;        //Results of expensive subexpressions, kept until their variables change
+    CMemory*        m_pMem;         //What the matrices of this calculator are charged to (shared with its workers)
+    CStats*         m_pStats;       //Where the time goes, or NULL when stats are off (every worker has its own)
+    CStats*         m_pTimed;       //m_pStats while a statement it sampled is running, otherwise NULL
+    CProfile*       m_pProfile;     //Where the allocations go, or NULL when profiling is off (every worker has its own)
+    CProfile*       m_pProfiling;   //m_pProfile while a statement is being profiled, otherwise NULL
+    bool            m_bTiming;      //True while "time" runs an expression, which keeps it away from the memo cache
+    string*         m_pName;        //Where evaluate() wants the name of the variable shown, or NULL to echo it
+    CMatrix*        m_pValue;       //and its value
+    bool            m_bOwnsDB;      //False for workers, which use their parent's databases and memo cache
+    int             m_nThreads;     //Threads used by runBatch()
+    int             m_nWindow;      //Statements read ahead when running on several threads
+    vector<string>  m_Pending;      //Lines waiting for the read-ahead window
+    ParWindow*      m_pPar;         //NULL unless running on several threads
+    const vector<string>*   m_pParams;  //Arguments of the function being compiled, NULL outside of definitions
+    const CMatrix* const*   m_pFrame;   //Arguments of the function being evaluated, by slot
+    vector<string>  m_Block;        //Lines of the loop being read in, up to its end
+    int             m_nDepth;       //Loops in m_Block which have not reached their end yet
+
+    //Worker constructor: shares the parent's variables but has its own parts, errors and output.
+    explicit Calc(const Calc* parent);
+    friend struct ParStmt;
 
     //sub-routines that I will use.
     bool createDB();            //Creates a variable database
     void enumerateVars();
+    void reportMemory();        //Prints the memory account. Called when the user types "memory".
+    void reportProfile();       //Prints the allocations of this calculator and its workers. Called when the user types "profile".
+    void reportStats();         //Prints the stats of this calculator and its workers. Called when the user types "stats".
     bool ReadInput();           //Reads input from Source into Input
     bool CommandCheck();        //Checks for special commands such as who and quit.
+    void TimeExpr();            //Runs time N expr, which CommandCheck found in m_Expr.
+    bool FileCommand();         //Runs snapshot or restore if Input holds one. False if it doesn't.
+    string Keyword(const string& line, size_t& rest);   //The word a command or loop line starts with, if it isn't being assigned to.
     bool Partition();           //Partitions the Input string and fills m_Expr;
     bool Convert();             //Converts the character references in m_Expr to actual values and operators and matrices.
     bool Interpret();           //Interpret the expression and call the calculator functions to find its value.
+    bool Define();              //Defines the function in m_Expr (function y = f(a, b) = ...).
+    bool Process();             //Runs the statement in Input through all of the above and reports any errors.
+    bool Parse();               //Partition and Convert, reporting errors.
+    void ClearParts();          //Empties m_Expr.
+    bool Execute();             //CommandCheck and Interpret, reporting errors.
+    void Publish();             //Commits a new version of the variables, if they are versioned.
+    void Spill();               //Spills the coldest variables to disk, if they are over their budget.
+
+    //Parallel batch mode
+    long Submit();              //Runs the line in Input now, or queues it for the read-ahead window.
+    long RunPending();          //Runs every line in the read-ahead window.
+    long Analyze(long first, long n);   //Works out which statements of the window wait for which, up to the next barrier.
+    void RunSegment(long first, long end);
+    void RunStmt(long k);
+    void Follow(const Calc& parent);    //Takes the format of parent, and whether its stats and profile are on.
+    bool Accesses(vector<int>& reads, vector<int>& writes);  //Which variables (by symbol) the statement in m_Expr reads and writes.
     void Echo(CVariable*);
 
+    //Loops
+    int     LoopDepth(const string& line);  //+1 if line starts a loop (for, while), -1 if it ends one (end), otherwise 0.
+    bool    RunLoop();                      //Compiles the loop collected in m_Block and runs it, reporting errors.
+    CStmt*  CompileLoop(size_t& at);        //Compiles the loop starting at line at of m_Block, leaving at after its end.
+    CStmt*  CompileStmt(int line);          //Compiles the statement in m_Expr as part of a loop body.
+    bool    ParseLine(size_t at);           //Partitions and converts line at of m_Block without reporting errors.
+    bool    Exec(const CStmt* s);           //Runs a compiled statement.
+    bool    ExecBody(const CStmt* s);
+    void    SetLoopVar(CVariable* var, double value);
+
     //Various calculator functions
-    CMatrix  CalcExpr(prtItr& st, prtItr& ed, int opLevel = 0); //Calculates the entire expression between the two places in the vector string and returns the value.
-    CMatrix CalcOP(const CMatrix& a,const OP& op,const CMatrix& b);
-    CMatrix CalcOP(const CMatrix& a, const OP& op);
+    CExpr*  Compile(prtItr& st, prtItr ed, int minPrec = 0);  //Compiles the expression starting at st into a tree, leaving st after it. NULL on errors.
+    CExpr*  CompileValue(prtItr& st, prtItr ed);                //Compiles a single number, matrix, variable or parenthesized expression.
+    CExpr*  CompileCall(prtItr& st, prtItr ed);                 //Compiles a function call, name(arg, ...).
+    bool    isFunction(const char* name);                       //Is name a built-in or user-defined function?
+    CExpr*  CompileAll(prtItr st, prtItr ed);                   //Compiles all of [st, ed) as one expression. NULL on errors.
+    bool    Infer(CExpr* x, bool report = true);                //Works out the sizes in x and plans its operators, failing on sizes which don't fit if report is set.
+    const CMatrix& Eval(const CExpr* x, CMatrix& tmp);          //Calculates the value of a compiled expression, using tmp for storage if needed.
+    bool    MemoKey(const CExpr* x, string& key);               //Builds the memo cache key of a subexpression. False if it can't be cached.
+    bool    Resolve(CVariable* var);                            //Recomputes a bound variable if it is out of date.
+    void    Assign(CVariable* var, const CMatrix& value);       //Stores a value in a variable and tells the variables bound to it.
+    bool    Update(CVariable* var, OP op, const CMatrix& value);//Compound assignment, var op= value, in place where it can be.
+    bool    Store(CVariable* var, const CExpr* expr, CMatrix& tmp); //Plain assignment, var = expr, straight into var's storage where it can be.
+    bool    Bind(CVariable* var, CExpr* expr);                  //Binds a variable to an expression (:=).
     bool    isAssign(const part& p);
     OP      AssignOpToOp(OP op);
     OP      EncodeOP(const strItr& chr);
@@ -110,25 +198,82 @@ class Calc
     void    printError();
 
 public:
-    Calc() : Source(&cin), isErr{false} {
+    Calc() : Source(&cin), Sink(&cout), ErrSink(&cerr), quitNext{false}, m_pStats{NULL}, m_pTimed{NULL}, m_pProfile{NULL}, m_pProfiling{NULL}, m_bTiming{false}, m_pName{NULL}, m_pValue{NULL}, m_bOwnsDB{true}, m_nThreads{1}, m_nWindow{PAR_WINDOW}, m_pPar{NULL}, m_pParams{NULL}, m_pFrame{NULL}, m_nDepth{0}, isErr{false} {
         if (!createDB())
-            cout << "Unable to allocate variable database.";
+            *ErrSink << "Unable to allocate variable database.";
     };
 
-    Calc(istream& in) : Source(&in), isErr{false}  {
+    Calc(istream& in) : Source(&in), Sink(&cout), ErrSink(&cerr), quitNext{false}, m_pStats{NULL}, m_pTimed{NULL}, m_pProfile{NULL}, m_pProfiling{NULL}, m_bTiming{false}, m_pName{NULL}, m_pValue{NULL}, m_bOwnsDB{true}, m_nThreads{1}, m_nWindow{PAR_WINDOW}, m_pPar{NULL}, m_pParams{NULL}, m_pFrame{NULL}, m_nDepth{0}, isErr{false}  {
         if (!createDB())
-            cout << "Unable to allocate variable database.";
+            *ErrSink << "Unable to allocate variable database.";
     };
 
-    ~Calc(){
-        delete m_db;
-    }
+    Calc(istream& in, ostream& out, ostream& err) : Source(&in), Sink(&out), ErrSink(&err), quitNext{false}, m_pStats{NULL}, m_pTimed{NULL}, m_pProfile{NULL}, m_pProfiling{NULL}, m_bTiming{false}, m_pName{NULL}, m_pValue{NULL}, m_bOwnsDB{true}, m_nThreads{1}, m_nWindow{PAR_WINDOW}, m_pPar{NULL}, m_pParams{NULL}, m_pFrame{NULL}, m_nDepth{0}, isErr{false}  {
+        if (!createDB())
+            *ErrSink << "Unable to allocate variable database.";
+    };
+
+    ~Calc();
 
     //Run the calculator.
     void run();
 
+    //Run the calculator non-interactively over the whole of Source, with no prompts or echo. Results are buffered into
+    //Sink and the throughput is reported on ErrSink at the end. Returns the number of statements processed.
+    long runBatch();
+
+    //Runs one line as if it had been read from Source, without prompts or echo, with its output going to Sink. Lines
+    //of a loop are held until its end. Returns false once the calculator has been told to quit.
+    bool runLine(const string& line);
+
+    //Runs one line for a program rather than a person (see CPipe). It is processed as by runLine(), but the variable
+    //it sets or shows is copied into value, with its name, instead of being echoed, and an error goes into err instead
+    //of Sink. Anything else the line prints (who, memory, ...) still goes to Sink. Returns false on errors. name is
+    //left empty when nothing is shown, as for commands and the lines of a loop before its end.
+    bool evaluate(const string& line, string& name, CMatrix& value, string& err);
+    bool hasQuit() const { return quitNext; };
+
+    //The first two stages of a statement on their own, for measuring them (see calc_bench). partition() splits line
+    //into parts, and convert() turns the parts it left into numbers, matrices and operators. Both return false on
+    //errors, which aren't printed, and neither runs anything.
+    bool partition(const string& line);
+    bool convert();
+
     //Allows the program to redefine the source, if I ever figure out how to make new streams which are not temporary.
     void setSource( istream& in) { Source = &in; };
+
+    //Redirects all of the calculator's output.
+    void setSink( ostream& out) { Sink = &out; };
+    ostream& sink() const { return *Sink; };
+
+    //Redirects the throughput report of runBatch() and any other messages which aren't output (cerr by default).
+    void setErrSink( ostream& err) { ErrSink = &err; };
+
+    //Lets runBatch() run independent statements at the same time on nThreads threads, reading window statements ahead.
+    //Output is still in program order. One thread (the default) runs every statement in turn.
+    void setThreads(int nThreads, int window = PAR_WINDOW);
+
+    //With versions on, a new version of the variables is committed after every statement, which other threads can
+    //read at any time, without waiting, through a CVarView of variables().
+    void setVersioned(bool on) { m_db->setVersioned(on); if (on) Publish(); };
+
+    //Limits the memory the matrices of this calculator can hold at once, variables and temporaries together, to bytes
+    //(0 for no limit). A statement which needs more fails with an error, and changes nothing.
+    void setQuota(long long bytes) { m_pMem->setQuota(bytes); };
+    const CMemory& memory() const { return *m_pMem; };
+
+    //Keeps latency histograms of every stage and operator (see CStats), which "stats" prints. Off by default; turning
+    //them off again pauses them.
+    void setStats(bool on);
+
+    //Counts the allocations and frees of every statement and operator (see CProfile), which "profile" ranks. Off by
+    //default; turning it off again pauses it.
+    void setProfile(bool on);
+
+    //Keeps the values of the variables within bytes of memory between statements (0 for no limit), by spilling the
+    //least recently used ones to the file at path until they are read again. See CVarDB.
+    void setBudget(long long bytes, const string& path) { m_db->setBudget(bytes, path); };
+    const CVarDB& variables() const { return *m_db; };
 };
 
 #endif //CALC_H
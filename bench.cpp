@@ -0,0 +1,441 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <ctime>
+#include <cstdlib>
+#include "Calc.h"
+#include "CKernel.h"
+#include "CMathLib.h"
+#include "CHistogram.h"
+#include "CStats.h"
+
+using namespace std;
+
+/* Benchmarks for the calculator, meant to be run on every release and compared with the last one.
+
+   kernel/...   ::: Every CKernel kernel, and the element-wise functions of CMathLib, on square matrices from 1x1 up to
+                    --max (4096x4096 by default; the matrix product at that size takes a minute on its own).
+   parse/...    ::: The Partitioner and the Converter on their own, on long generated expressions and big matrix
+                    literals.
+   replay/...   ::: Whole generated scripts run through Calc in batch mode, as personal_calc -b would, with the output
+                    thrown away. TestCase.txt is replayed too, if it is in the working directory.
+
+   Each benchmark runs its operation in batches, doubling the batch until a batch takes long enough to time, and keeps
+   going until --time seconds have passed (at least one batch). The time per operation of every batch goes into a
+   CHistogram. The results are written as JSON, one object per benchmark, with the mean, minimum, median and 99th
+   percentile in nanoseconds per operation, and a rate (elements, flops, bytes or statements per second).
+
+   Usage: calc_bench [--filter text] [--time seconds] [--max size] [--list] [-o results.json]
+*/
+
+#define BENCH_BATCH_NS  20000   //A batch is doubled until it takes at least this long
+
+// Swallows the calculator's output.
+struct NullBuf : streambuf
+{
+    int         overflow(int c) { return c; }
+    streamsize  xsputn(const char*, streamsize n) { return n; }
+};
+static NullBuf  s_NullBuf;
+static ostream  s_Null(&s_NullBuf);
+
+struct Result
+{
+    string      name;
+    uint64_t    ops;        // operations run, over every batch
+    double      secs;       // time they took
+    double      minNs;      // per operation, in the fastest batch
+    CHistogram  hist;       // nanoseconds per operation of every batch
+    double      items;      // items (elements, flops, bytes, statements) in one operation
+    string      unit;
+};
+
+struct Bench
+{
+    string                  name;
+    function<Result()>      run;
+};
+
+static double s_Budget = 0.5;   // seconds per benchmark
+
+// Times op, which handles items of unit each time it is called.
+static Result measure(const string& name, double items, const string& unit, const function<void()>& op)
+{
+    Result r;
+    r.name  = name;
+    r.ops   = 0;
+    r.secs  = 0;
+    r.minNs = 0;
+    r.items = items;
+    r.unit  = unit;
+
+    uint64_t batch = 1;
+    while (true)
+    {
+        uint64_t start = CStats::now();
+        for (uint64_t i = 0; i < batch; ++i)
+            op();
+        uint64_t ns = CStats::now() - start;
+
+        // Batches which are too short to time are only for finding the batch size.
+        if (ns >= BENCH_BATCH_NS || r.secs + ns / 1e9 >= s_Budget)
+        {
+            double perOp = double(ns) / batch;
+            r.hist.record(uint64_t(perOp + 0.5));
+            r.minNs = (r.ops == 0) ? perOp : min(r.minNs, perOp);
+            r.ops  += batch;
+        }
+        else
+            batch *= 2;
+
+        r.secs += ns / 1e9;
+        if (r.secs >= s_Budget && r.ops > 0)
+            return r;
+    }
+}
+
+/*** Kernels ***/
+
+static CMatrix filled(int rows, int cols, double seed)
+{
+    CMatrix m(rows, cols);
+    for (int i = 0; i < m.Size(); ++i)
+        m.data()[i] = seed + (i % 97) * 0.25;
+    return m;
+}
+
+static void addKernels(vector<Bench>& benches, int maxSize)
+{
+    benches.push_back({"kernel/scalar", []
+    {
+        CMatrix a{3.0}, b{4.0}, out;
+        return measure("kernel/scalar", 1, "elements/s", [&]{ CKernel::run(KSCALAR, ADD, a, b, out); });
+    }});
+
+    for (int n = 4; n <= maxSize; n *= 4)
+    {
+        string size = to_string(n) + "x" + to_string(n);
+        double elems = double(n) * n;
+
+        benches.push_back({"kernel/scalarmat/" + size, [=]
+        {
+            CMatrix s{2.0}, m = filled(n, n, 1), out;
+            return measure("kernel/scalarmat/" + size, elems, "elements/s", [&]{ CKernel::run(KSCALARMAT, SUB, s, m, out); });
+        }});
+        benches.push_back({"kernel/matscalar/" + size, [=]
+        {
+            CMatrix m = filled(n, n, 1), s{2.0}, out;
+            return measure("kernel/matscalar/" + size, elems, "elements/s", [&]{ CKernel::run(KMATSCALAR, MULT, m, s, out); });
+        }});
+        benches.push_back({"kernel/element/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), b = filled(n, n, 2), out;
+            return measure("kernel/element/" + size, elems, "elements/s", [&]{ CKernel::run(KELEMENT, ADD, a, b, out); });
+        }});
+        benches.push_back({"kernel/update/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), b = filled(n, n, 2);
+            return measure("kernel/update/" + size, elems, "elements/s", [&]{ CKernel::update(KELEMENT, ADD, a, b); });
+        }});
+        benches.push_back({"kernel/gemv/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), x = filled(n, 1, 2), out;
+            return measure("kernel/gemv/" + size, 2 * elems, "flops", [&]{ CKernel::run(KGEMV, MULT, a, x, out); });
+        }});
+        benches.push_back({"kernel/gemm/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), b = filled(n, n, 2), out;
+            return measure("kernel/gemm/" + size, 2 * elems * n, "flops", [&]{ CKernel::run(KGEMM, MULT, a, b, out); });
+        }});
+        benches.push_back({"kernel/compare/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), b = filled(n, n, 2), out;
+            return measure("kernel/compare/" + size, elems, "elements/s", [&]{ CMathLib::compare(LT, a, b, out); });
+        }});
+        benches.push_back({"kernel/sin/" + size, [=]
+        {
+            CMatrix a = filled(n, n, 1), out(n, n);
+            return measure("kernel/sin/" + size, elems, "elements/s", [&]{ CMathLib::sin(a.data(), out.data(), a.Size()); });
+        }});
+    }
+}
+
+/*** Parser ***/
+
+static string longExpr(int terms)
+{
+    string s = "x0";
+    const char* ops[] = {" + ", " - ", "*", "/"};
+    for (int i = 1; i < terms; ++i)
+    {
+        s += ops[i % 4];
+        if (i % 3 == 0)
+            s += "(x" + to_string(i % 50) + " + " + to_string(i) + ".5)";
+        else
+            s += "x" + to_string(i % 50);
+    }
+    return s;
+}
+
+static string bigLiteral(int n)
+{
+    string s = "[";
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < n; ++j)
+            s += to_string((i * n + j) % 1000) + ((j + 1 < n) ? " " : "");
+        s += (i + 1 < n) ? "; " : "]";
+    }
+    return s;
+}
+
+static void addParser(vector<Bench>& benches)
+{
+    vector<pair<string, string>> inputs;
+    for (int terms : {10, 100, 1000})
+        inputs.push_back(make_pair("expr-" + to_string(terms), longExpr(terms)));
+    for (int n : {10, 100, 300})
+        inputs.push_back(make_pair("literal-" + to_string(n) + "x" + to_string(n), "A = " + bigLiteral(n)));
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        string what = inputs[i].first;
+        string line = inputs[i].second;
+
+        benches.push_back({"parse/partition/" + what, [=]
+        {
+            istringstream none;
+            Calc calc(none, s_Null, s_Null);
+            return measure("parse/partition/" + what, line.size(), "bytes/s", [&]{ calc.partition(line); });
+        }});
+
+        // Converting uses up the parts, so each one is partitioned again, and only the conversion is timed.
+        benches.push_back({"parse/convert/" + what, [=]
+        {
+            istringstream none;
+            Calc calc(none, s_Null, s_Null);
+            Result r;
+            r.name  = "parse/convert/" + what;
+            r.ops   = 0;
+            r.secs  = 0;
+            r.minNs = 0;
+            r.items = line.size();
+            r.unit  = "bytes/s";
+            while (r.secs < s_Budget)
+            {
+                calc.partition(line);
+                uint64_t start = CStats::now();
+                bool ok = calc.convert();
+                uint64_t ns = CStats::now() - start;
+                if (!ok)
+                    cerr << r.name << " failed to convert" << endl;
+                r.hist.record(ns);
+                r.minNs = (r.ops == 0) ? ns : min(r.minNs, double(ns));
+                r.ops  += 1;
+                r.secs += ns / 1e9;
+            }
+            return r;
+        }});
+    }
+}
+
+/*** Replay ***/
+
+// A small linear congruential generator, so the scripts are the same on every platform and every run.
+static unsigned s_Seed;
+static unsigned next(unsigned n)
+{
+    s_Seed = s_Seed * 1103515245u + 12345u;
+    return (s_Seed >> 16) % n;
+}
+
+static string scalarScript(int n)
+{
+    s_Seed = 1;
+    const char* stmts[] = {"z = x*y + z - 3", "x = x + 1", "y = (x + z)/2", "z += x*2", "x*y + z", "w = sin(x) + max(y, z)"};
+    string s = "x = 1\ny = 2.5\nz = 0\n";
+    for (int i = 0; i < n; ++i)
+        s += string(stmts[next(6)]) + "\n";
+    return s;
+}
+
+static string matrixScript(int n)
+{
+    s_Seed = 2;
+    const char* stmts[] = {"C = A*B", "D = A + B", "A = A/2 + B", "E = A(A > 50)", "B *= 0.5", "F = A*v"};
+    string s = "A = " + bigLiteral(32) + "\nB = A + 1\n";
+    string col = "[";
+    for (int i = 0; i < 32; ++i)
+        col += to_string(i) + ((i < 31) ? "; " : "]");
+    s += "v = " + col + "\n";
+    for (int i = 0; i < n; ++i)
+        s += string(stmts[next(6)]) + "\n";
+    return s;
+}
+
+static string loopScript()
+{
+    return "s = 0\n"
+           "for i = 1:100000\n"
+           "s += i*2\n"
+           "end\n"
+           "k = 0\n"
+           "while k < 50000\n"
+           "k = k + 1\n"
+           "end\n";
+}
+
+static string functionScript(int n)
+{
+    string s = "function y = f(a, b) = a*b + 1\n"
+               "function g(x) = f(x, x) + x\n";
+    for (int i = 0; i < n; ++i)
+        s += "g(" + to_string(i % 100) + ") + f(" + to_string(i) + ", 2)\n";
+    return s;
+}
+
+static int lines(const string& script)
+{
+    return count(script.begin(), script.end(), '\n');
+}
+
+static void addReplay(vector<Bench>& benches)
+{
+    vector<pair<string, string>> scripts;
+    scripts.push_back(make_pair("scalar", scalarScript(20000)));
+    scripts.push_back(make_pair("matrix", matrixScript(2000)));
+    scripts.push_back(make_pair("loop", loopScript()));
+    scripts.push_back(make_pair("functions", functionScript(10000)));
+
+    ifstream testCase("TestCase.txt", ios::binary);
+    if (testCase)
+    {
+        stringstream text;
+        text << testCase.rdbuf();
+        scripts.push_back(make_pair("testcase", text.str()));
+    }
+
+    for (size_t i = 0; i < scripts.size(); ++i)
+    {
+        for (int threads : {1, 4})
+        {
+            string name = "replay/" + scripts[i].first + ((threads > 1) ? "/j" + to_string(threads) : "");
+            string script = scripts[i].second;
+            benches.push_back({name, [=]
+            {
+                return measure(name, lines(script), "statements/s", [&]
+                {
+                    istringstream in(script);
+                    Calc calc(in, s_Null, s_Null);
+                    calc.setThreads(threads);
+                    calc.runBatch();
+                });
+            }});
+        }
+    }
+}
+
+/*** Output ***/
+
+static string quoted(const string& s)
+{
+    string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void writeJson(ostream& out, const vector<Result>& results)
+{
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    out << "{\n  \"context\": {\"date\": " << quoted(date) << ", \"compiler\": " << quoted(__VERSION__)
+        << ", \"hardware_threads\": " << thread::hardware_concurrency() << ", \"seconds_per_benchmark\": " << s_Budget
+        << "},\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        double mean = r.secs * 1e9 / r.ops;
+        out << ((i > 0) ? ",\n" : "\n") << "    {\"name\": " << quoted(r.name) << ", \"iterations\": " << r.ops
+            << ", \"mean_ns\": " << mean << ", \"min_ns\": " << r.minNs << ", \"p50_ns\": " << r.hist.percentile(50)
+            << ", \"p99_ns\": " << r.hist.percentile(99) << ", \"rate\": " << r.items * 1e9 / mean
+            << ", \"rate_unit\": " << quoted(r.unit) << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    string filter, outName;
+    int maxSize = 4096;
+    bool list = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--filter" && i+1 < argc)
+            filter = argv[++i];
+        else if (arg == "--time" && i+1 < argc)
+            s_Budget = max(0.001, atof(argv[++i]));
+        else if (arg == "--max" && i+1 < argc)
+            maxSize = max(1, atoi(argv[++i]));
+        else if (arg == "--list")
+            list = true;
+        else if (arg == "-o" && i+1 < argc)
+            outName = argv[++i];
+        else
+        {
+            cerr << "Usage: calc_bench [--filter text] [--time seconds] [--max size] [--list] [-o results.json]" << endl;
+            return 1;
+        }
+    }
+
+    vector<Bench> benches;
+    addKernels(benches, maxSize);
+    addParser(benches);
+    addReplay(benches);
+
+    vector<Result> results;
+    for (size_t i = 0; i < benches.size(); ++i)
+    {
+        if (benches[i].name.find(filter) == string::npos)
+            continue;
+        if (list)
+        {
+            cout << benches[i].name << endl;
+            continue;
+        }
+
+        cerr << benches[i].name << "... " << flush;
+        results.push_back(benches[i].run());
+        const Result& r = results.back();
+        cerr << r.secs * 1e9 / r.ops << " ns" << endl;
+    }
+    if (list)
+        return 0;
+
+    if (outName.empty())
+        writeJson(cout, results);
+    else
+    {
+        ofstream out(outName);
+        if (!out)
+        {
+            cerr << "Cannot write " << outName << endl;
+            return 1;
+        }
+        writeJson(out, results);
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "CServer.h"
+
+using namespace std;
+
+/* Load generator for the calculator's server mode (personal_calc -s socket).
+
+   Opens a number of connections, each on its own thread, and on each one sends the setup lines once and then the
+   request line over and over, waiting for each response (up to the SERVER_END line) before sending the next. Reports
+   the requests per second over all connections, and the latency percentiles of the requests.
+
+   Usage: calc_load socket [-c connections] [-n requests per connection] [-s setup line]... [request line]
+*/
+
+struct Client
+{
+    int             fd;
+    string          buf;        // what has been received past the last response
+    vector<double>  latency;    // of every request, in microseconds
+    string          err;
+};
+
+static bool sendLine(Client& c, const string& line)
+{
+    string out = line + '\n';
+    size_t sent = 0;
+    while (sent < out.size())
+    {
+        ssize_t n = send(c.fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            c.err = string("send: ") + strerror(errno);
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Waits for the end of the next response, a line holding only SERVER_END.
+static bool receive(Client& c)
+{
+    char chunk[4096];
+    size_t line = 0;
+    while (true)
+    {
+        size_t eol;
+        while ((eol = c.buf.find('\n', line)) != string::npos)
+        {
+            if (c.buf.compare(line, eol + 1 - line, SERVER_END) == 0)
+            {
+                c.buf.erase(0, eol + 1);
+                return true;
+            }
+            line = eol + 1;
+        }
+
+        ssize_t n = recv(c.fd, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+        {
+            c.err = (n == 0) ? "the server closed the connection" : string("recv: ") + strerror(errno);
+            return false;
+        }
+        c.buf.append(chunk, n);
+    }
+}
+
+static void runClient(Client& c, const string& path, const vector<string>& setup, const string& request, int n)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    c.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c.fd < 0 || connect(c.fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        c.err = string("connect: ") + strerror(errno);
+        return;
+    }
+
+    for (size_t i = 0; i < setup.size(); ++i)
+    {
+        if (!sendLine(c, setup[i]) || !receive(c))
+            return;
+    }
+
+    c.latency.reserve(n);
+    for (int i = 0; i < n; ++i)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!sendLine(c, request) || !receive(c))
+            return;
+        c.latency.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+
+    sendLine(c, "quit");
+    close(c.fd);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: calc_load socket [-c connections] [-n requests] [-s setup line]... [request line]" << endl;
+        return 1;
+    }
+
+    string path = argv[1];
+    int connections = 8, requests = 10000;
+    vector<string> setup;
+    string request = "x = x + 1";
+
+    for (int i = 2; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-c" && i+1 < argc)
+            connections = max(1, atoi(argv[++i]));
+        else if (arg == "-n" && i+1 < argc)
+            requests = max(1, atoi(argv[++i]));
+        else if (arg == "-s" && i+1 < argc)
+            setup.push_back(argv[++i]);
+        else
+            request = arg;
+    }
+    if (setup.empty() && request == "x = x + 1")
+        setup.push_back("x = 0");
+
+    vector<Client> clients(connections);
+    vector<thread> threads;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < connections; ++i)
+        threads.emplace_back(runClient, ref(clients[i]), cref(path), cref(setup), cref(request), requests);
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<double> all;
+    for (int i = 0; i < connections; ++i)
+    {
+        if (!clients[i].err.empty())
+            cerr << "Connection " << i << ": " << clients[i].err << endl;
+        all.insert(all.end(), clients[i].latency.begin(), clients[i].latency.end());
+    }
+    if (all.empty())
+        return 1;
+
+    sort(all.begin(), all.end());
+    auto pct = [&all](double p) { return all[min(all.size() - 1, size_t(p * all.size()))]; };
+
+    cout << all.size() << " requests on " << connections << " connections in " << secs << " s ("
+         << all.size() / secs << " requests/sec)" << endl;
+    cout << "Latency (us): p50 " << pct(0.50) << ", p90 " << pct(0.90) << ", p99 " << pct(0.99) << ", p99.9 "
+         << pct(0.999) << ", max " << all.back() << endl;
+    return (all.size() == size_t(connections) * requests) ? 0 : 1;
+}
@@ -0,0 +1,307 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include "Calc.h"
+#include "CMatrix.h"
+#include "CVarView.h"
+
+using namespace std;
+
+/* Stress test for calculators running side by side (build the Stress target, which has ThreadSanitizer on).
+
+   Starts a number of sessions, each a Calc with its own variables and its own output, on threads of their own, and
+   has every one run a script over and over which takes values from its session number: assignments, functions,
+   statements which make null matrices and fail, and who. Every round's output has to be the same as that of a
+   reference session which ran the same script alone, before any thread was started. Between rounds each thread also
+   reads and writes elements out of range and uses null matrices directly, which must give NaN and nulls whatever the
+   other threads are doing. Reports the sessions which went wrong, and exits with 1 if any did.
+
+   Before the sessions start, a script with commands between its statements (format, profile) is run in batch mode on
+   one thread and on several, which have to print the same.
+
+   After them, one calculator with versions on (see CVarView) runs a round of statements after another, now and then
+   saving a snapshot and restoring it, so that some versions hold values which are paged out, while other threads open
+   views of it as fast as they can. b is bound to a * 2, so every view has to have b = a * 2, and a view never goes
+   back to an earlier version than one its thread has already seen.
+
+   Usage: calc_stress [-n sessions] [-r rounds] [-v viewers]
+*/
+
+static vector<string> script(int k)
+{
+    string x = to_string(k + 1);
+    return {
+        "x = " + x,
+        "m = [1 2; 3 4] * x",
+        "function f(a, b) = a*b + 1",
+        "y = f(m, x)",
+        "d = m / (x - x)",                  // null, so an error
+        "z = [1 2] + [1 2 3]",              // shapes which don't match
+        "e = m ^ 2",                        // ^ of a matrix
+        "w = y - m*x",
+        "v = [x x x; 1 2 3] * 0.5 + x",
+        "who",
+    };
+}
+
+static string runScript(Calc& calc, ostringstream& out, const vector<string>& lines)
+{
+    out.str("");
+    for (size_t i = 0; i < lines.size(); ++i)
+        calc.runLine(lines[i]);
+    return out.str();
+}
+
+// Out-of-range elements and null matrices, which used to share one static element between every matrix.
+static string checkMatrices(int k)
+{
+    CMatrix m(2, 3);
+    m.element(1, 2) = k;
+    const CMatrix& c = m;
+    CMatrix null;
+
+    m.element(5, 5) = k;                // goes nowhere
+    if (!std::isnan(m.element(2, 0)) || !std::isnan(m(-1, 0)))
+        return "an out-of-range element is not NaN";
+    if (!std::isnan(c.element(0, 3)) || !std::isnan(c(9, 9)))
+        return "an out-of-range const element is not NaN";
+    if (m.element(1, 2) != k || m.element(0, 0) != 0)
+        return "an element changed";
+    if (!null.IsNull() || null.Size() != 0 || !std::isnan(null.element(0, 0)))
+        return "a null matrix has elements";
+    if (!(m / CMatrix(0.0)).IsNull() || !(m + null).IsNull())
+        return "an operation which fails does not give a null matrix";
+    return "";
+}
+
+// Runs lines in batch mode on nThreads threads, and returns what they printed.
+static string runBatch(const string& lines, int nThreads)
+{
+    istringstream in(lines);
+    ostringstream out, err;
+    Calc calc(in, out, err);
+    calc.setThreads(nThreads);
+    calc.runBatch();
+    return out.str();
+}
+
+// The parallel batch mode runs the statements between two commands together, and every one of them has to follow the
+// commands before it, as they would on one thread.
+static string checkThreads()
+{
+    string big = "M = [";
+    for (int i = 0; i < 40; ++i)
+    {
+        for (int j = 0; j < 40; ++j)
+            big += to_string((i * j) % 10) + ((j < 39) ? " " : "");
+        big += (i < 39) ? "; " : "]\n";
+    }
+    string lines = big + "format short\nN = M * 2\nx = 1\nformat long\nP = M + 1\ny = x + 1\n"
+                         "profile on\nformat short\nQ = P - N\nR = Q * 2\nprofile off\nformat long\nS = R + 1\n";
+
+    string one = runBatch(lines, 1);
+    if (one.find("...") == string::npos)
+        return "format short doesn't summarize on one thread";
+    for (int nThreads = 2; nThreads <= 8; nThreads *= 2)
+    {
+        if (runBatch(lines, nThreads) != one)
+            return "batch mode on " + to_string(nThreads) + " threads prints something else than on one";
+    }
+    return "";
+}
+
+// A view is consistent if a and b have the same shape, b = a * 2, and a counts up from a(0, 0).
+static string checkView(const CVarView& view)
+{
+    const CMatrix* a = view.find("a");
+    const CMatrix* b = view.find("b");
+    if (a == NULL || b == NULL)
+        return "a view has no a or no b";
+    if (a->getNRow() != b->getNRow() || a->getNCol() != b->getNCol())
+        return "a view has a and b of different shapes";
+    for (int i = 0; i < a->Size(); ++i)
+    {
+        if (b->data()[i] != a->data()[i] * 2 || a->data()[i] != a->data()[0] + i)
+            return "a view of version " + to_string(view.number()) + " isn't consistent";
+    }
+    return "";
+}
+
+// Views opened on nViewers threads while one calculator commits rounds versions.
+static string checkViews(int nViewers, int rounds)
+{
+    istringstream in;
+    ostringstream out, err;
+    Calc calc(in, out, err);
+    calc.setVersioned(true);
+
+    // Big enough to be worth paging, and to take a while to copy.
+    string base = "base = [";
+    for (int i = 0; i < 1000; ++i)
+        base += to_string(i) + ((i < 999) ? " " : "]");
+    string snap = "calc_stress." + to_string(rand()) + ".snap";
+
+    // Between these there is a version with a but no b, so they come before anyone looks.
+    calc.runLine(base);
+    calc.runLine("a = base");
+    calc.runLine("b := a * 2");
+
+    atomic<bool> done{false};
+    vector<string> errs(nViewers);
+    vector<long> views(nViewers, 0);
+    vector<thread> viewers;
+    for (int t = 0; t < nViewers; ++t)
+    {
+        viewers.emplace_back([&calc, &done, &errs, &views, t]
+        {
+            unsigned long long last = 0;
+            while (!done.load() && errs[t].empty())
+            {
+                CVarView view(calc.variables());
+                if (view.number() < last)
+                    errs[t] = "a view went back from version " + to_string(last) + " to " + to_string(view.number());
+                else
+                    errs[t] = checkView(view);
+                last = view.number();
+                ++views[t];
+            }
+        });
+    }
+
+    for (int r = 0; r < rounds; ++r)
+    {
+        calc.runLine("a = base + " + to_string(r));
+        if (r % 10 == 9)
+        {
+            calc.runLine("snapshot " + snap);
+            calc.runLine("restore " + snap);   // which leaves a and b paged out, and b no longer bound
+            calc.runLine("b := a * 2");
+        }
+    }
+    done = true;
+    for (size_t t = 0; t < viewers.size(); ++t)
+        viewers[t].join();
+    remove(snap.c_str());
+
+    if (out.str().find("Error") != string::npos)
+        return "the calculator failed:\n" + out.str();
+    long total = 0;
+    for (int t = 0; t < nViewers; ++t)
+    {
+        if (!errs[t].empty())
+            return "viewer " + to_string(t) + ": " + errs[t];
+        total += views[t];
+    }
+    cout << nViewers << " viewers opened " << total << " views of " << rounds << " rounds: all consistent" << endl;
+    return "";
+}
+
+struct Session
+{
+    vector<string>  lines;
+    string          expected;   // the output of one round
+    long            rounds;     // rounds run as expected
+    string          err;
+};
+
+static void runSession(Session& s, int k, int rounds)
+{
+    istringstream in;
+    ostringstream out, err;
+    Calc calc(in, out, err);
+
+    for (s.rounds = 0; s.rounds < rounds; ++s.rounds)
+    {
+        string got = runScript(calc, out, s.lines);
+        if (got != s.expected)
+        {
+            size_t at = mismatch(got.begin(), got.begin() + min(got.size(), s.expected.size()), s.expected.begin()).first - got.begin();
+            s.err = "round " + to_string(s.rounds) + ": the output differs from the reference at character " + to_string(at);
+            return;
+        }
+        s.err = checkMatrices(k);
+        if (!s.err.empty())
+        {
+            s.err = "round " + to_string(s.rounds) + ": " + s.err;
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int sessions = 32, rounds = 200, viewers = 8;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-n" && i+1 < argc)
+            sessions = max(1, atoi(argv[++i]));
+        else if (arg == "-r" && i+1 < argc)
+            rounds = max(1, atoi(argv[++i]));
+        else if (arg == "-v" && i+1 < argc)
+            viewers = max(1, atoi(argv[++i]));
+        else
+        {
+            cerr << "Usage: calc_stress [-n sessions] [-r rounds] [-v viewers]" << endl;
+            return 1;
+        }
+    }
+
+    string err = checkThreads();
+    if (!err.empty())
+    {
+        cerr << err << endl;
+        return 1;
+    }
+
+    // The references, one session at a time.
+    vector<Session> all(sessions);
+    for (int k = 0; k < sessions; ++k)
+    {
+        istringstream in;
+        ostringstream out, err;
+        Calc calc(in, out, err);
+        all[k].lines = script(k);
+        all[k].expected = runScript(calc, out, all[k].lines);
+        if (all[k].expected.find("\tx = " + to_string(k + 1) + "\n") == string::npos)
+        {
+            cerr << "Session " << k << " doesn't work even on its own:\n" << all[k].expected;
+            return 1;
+        }
+    }
+
+    vector<thread> threads;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int k = 0; k < sessions; ++k)
+        threads.emplace_back(runSession, ref(all[k]), k, rounds);
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (int k = 0; k < sessions; ++k)
+    {
+        if (all[k].err.empty())
+            continue;
+        cerr << "Session " << k << ": " << all[k].err << endl;
+        ++failed;
+    }
+    cout << sessions << " sessions of " << rounds << " rounds in " << secs << " s: "
+         << (failed == 0 ? "all as expected" : to_string(failed) + " failed") << endl;
+
+    err = checkViews(viewers, rounds);
+    if (!err.empty())
+    {
+        cerr << err << endl;
+        ++failed;
+    }
+    return (failed == 0) ? 0 : 1;
+}
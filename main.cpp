@@ -2,10 +2,23 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <csignal>
 #include "Calc.h"
+#include "CServer.h"
+#include "CPipe.h"
 
 using namespace std;
 
+static CServer* server = NULL;
+
+// Ctrl+C and kill stop the server cleanly, so its socket is removed.
+static void stopServer(int)
+{
+    if (server != NULL)
+        server->stop();
+}
+
 int main2() //testing
 {
     CMatrix mtrx{"[1 2 3; 4 5 6]"}, mtrx2{5}, mtrx3{"[1,2,3;4,5,6]"};
@@ -17,19 +30,123 @@ int main2() //testing
     cout << v1.Value() << endl;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	string testfilename = "TestCase.txt";
+	string outfilename;
+	string socketname;
+	bool batch = false;
+	bool pipe = false;
+	int threads = 1;
+	long long quota = 0;
+	long long budget = 0;
+	string spillname;
+
+	// Command line: [-b|--batch] [-p|--pipe] [-j|--threads <n>] [-o|--output <file>] [-s|--serve <socket>]
+	//               [-q|--quota <bytes>] [-m|--budget <bytes>] [--spill <file>] [script file]
+	for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-b" || arg == "--batch")
+            batch = true;
+        else if (arg == "-p" || arg == "--pipe")
+            pipe = true;
+        else if ((arg == "-j" || arg == "--threads") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if ((arg == "-o" || arg == "--output") && i+1 < argc)
+            outfilename = argv[++i];
+        else if ((arg == "-s" || arg == "--serve") && i+1 < argc)
+            socketname = argv[++i];
+        else if ((arg == "-q" || arg == "--quota") && i+1 < argc)
+            quota = atoll(argv[++i]);
+        else if ((arg == "-m" || arg == "--budget") && i+1 < argc)
+            budget = atoll(argv[++i]);
+        else if (arg == "--spill" && i+1 < argc)
+            spillname = argv[++i];
+        else
+            testfilename = arg;
+    }
+
+	// Server mode runs a calculator for every client of the socket, on the given number of threads.
+	if (!socketname.empty())
+    {
+        CServer calcServer(socketname, threads > 1 ? threads : 4, quota, budget, spillname);
+        server = &calcServer;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+
+        string err;
+        bool ok = calcServer.run(err);
+        server = NULL;
+        if (!ok)
+        {
+            cerr << err << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+	// Pipe mode answers JSON requests on stdin with JSON responses on stdout, for other programs (see CPipe).
+	if (pipe)
+    {
+        ios::sync_with_stdio(false);
+
+        Calc pipeCalc;
+        pipeCalc.setQuota(quota);
+        if (budget > 0)
+            pipeCalc.setBudget(budget, spillname.empty() ? "personal_calc.spill" : spillname);
+        CPipe calcPipe(cin, cout, pipeCalc);
+        calcPipe.run();
+        return 0;
+    }
+
+	// Batch mode reads the whole script without prompts and writes only the results.
+	if (batch)
+    {
+        ios::sync_with_stdio(false);
+
+        ifstream scriptfile(testfilename, ios::binary);
+        if (!scriptfile.is_open())
+        {
+            cerr << "Error reading script file \"" << testfilename << '"' << endl;
+            return 1;
+        }
+
+        ofstream outfile;
+        if (!outfilename.empty())
+        {
+            outfile.open(outfilename, ios::binary);
+            if (!outfile.is_open())
+            {
+                cerr << "Error opening output file \"" << outfilename << '"' << endl;
+                return 1;
+            }
+        }
+
+        Calc batchCalc(scriptfile);
+        if (outfile.is_open())
+            batchCalc.setSink(outfile);
+        batchCalc.setThreads(threads);
+        batchCalc.setQuota(quota);
+        if (budget > 0)
+            batchCalc.setBudget(budget, spillname.empty() ? "personal_calc.spill" : spillname);
+        batchCalc.runBatch();
+
+        return 0;
+    }
+
 	// print welcome message
 	cout << endl;
 	cout << "\tWelcome to the EECS 211 MP#5: A Programmable Calculator" << endl;
 	cout << "\t\tName: Alexander Martin"<< endl; // your name here
 	cout << "\t\t   Copyright, 2014   " << endl << endl;
 
-	string testfilename = "TestCase.txt";
-
 	ifstream testfile(testfilename);
 
 	Calc newCalc;
+	newCalc.setQuota(quota);
+	if (budget > 0)
+		newCalc.setBudget(budget, spillname.empty() ? "personal_calc.spill" : spillname);
 
     //Create a new calculator from the right source.
 	if (!testfile.is_open())
@@ -47,4 +164,3 @@ int main()
 
     return 0;
 }
-